@@ -0,0 +1,170 @@
+/*
+  ==============================================================================
+
+    LegacyDelayProcessor.h
+
+    Frozen copy of the original per-sample KadenzeDelay processBlock, kept so
+    the benchmark can report the current engine against the implementation
+    it replaced. Not part of the plugin build.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+
+//==============================================================================
+class LegacyDelayProcessor  : public juce::AudioProcessor
+{
+public:
+    LegacyDelayProcessor()
+        : AudioProcessor (BusesProperties()
+                            .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                            .withOutput ("Output", juce::AudioChannelSet::stereo(), true))
+    {
+        addParameter (mDryWetParameter = new juce::AudioParameterFloat ("drywet", "Dry Wet", 0.0f, 1.0f, 0.5f));
+        addParameter (mFeedbackParameter = new juce::AudioParameterFloat ("feedback", "Feedback", 0.01f, 0.98f, 0.5f));
+        addParameter (mDelayTimeLeftParameter = new juce::AudioParameterFloat ("delayTimeLeft", "Delay Time Left", 0.01f, kMaxDelayTime, 0.5f));
+        addParameter (mDelayTimeRightParameter = new juce::AudioParameterFloat ("delayTimeRight", "Delay Time Right", 0.01f, kMaxDelayTime, 1.0f));
+    }
+
+    ~LegacyDelayProcessor() override
+    {
+        delete [] mCircularBufferLeft;
+        delete [] mCircularBufferRight;
+    }
+
+    //==============================================================================
+    void prepareToPlay (double sampleRate, int) override
+    {
+        delete [] mCircularBufferLeft;
+        delete [] mCircularBufferRight;
+
+        mCircularBufferLength = (int) (sampleRate * kMaxDelayTime);
+        mCircularBufferLeft = new float[(size_t) mCircularBufferLength + 1]();
+        mCircularBufferRight = new float[(size_t) mCircularBufferLength + 1]();
+
+        mCircularBufferWriteHeadLeft = 0;
+        mCircularBufferWriteHeadRight = 0;
+        mFeedbackLeft = 0;
+        mFeedbackRight = 0;
+
+        mDelayTimeLeftSmoothed = *mDelayTimeLeftParameter;
+        mDelayTimeRightSmoothed = *mDelayTimeRightParameter;
+    }
+
+    void releaseResources() override {}
+
+    void processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer&) override
+    {
+        juce::ScopedNoDenormals noDenormals;
+
+        float* leftChannel = buffer.getWritePointer (0);
+        float* rightChannel = buffer.getWritePointer (1);
+
+        for (int i = 0; i < buffer.getNumSamples(); i++)
+        {
+            mDelayTimeLeftSmoothed = mDelayTimeLeftSmoothed - 0.001 * (mDelayTimeLeftSmoothed - *mDelayTimeLeftParameter);
+            mDelayTimeRightSmoothed = mDelayTimeRightSmoothed - 0.001 * (mDelayTimeRightSmoothed - *mDelayTimeRightParameter);
+
+            mDelayTimeLeftInSamples = getSampleRate() * mDelayTimeLeftSmoothed;
+            mDelayTimeRightInSamples = getSampleRate() * mDelayTimeRightSmoothed;
+
+            mCircularBufferLeft[mCircularBufferWriteHeadLeft] = rightChannel[i] + mFeedbackRight;
+            mCircularBufferRight[mCircularBufferWriteHeadRight] = leftChannel[i] + mFeedbackLeft;
+
+            mDelayReadHeadLeft = mCircularBufferWriteHeadLeft - mDelayTimeLeftInSamples;
+            mDelayReadHeadRight = mCircularBufferWriteHeadRight - mDelayTimeRightInSamples;
+
+            if (mDelayReadHeadLeft < 0)
+                mDelayReadHeadLeft += mCircularBufferLength;
+
+            if (mDelayReadHeadRight < 0)
+                mDelayReadHeadRight += mCircularBufferLength;
+
+            int readHeadL_x = (int) mDelayReadHeadLeft;
+            int readHeadL_x1 = readHeadL_x + 1;
+            float readHeadFloatL = mDelayReadHeadLeft - readHeadL_x;
+
+            int readHeadR_x = (int) mDelayReadHeadRight;
+            int readHeadR_x1 = readHeadR_x + 1;
+            float readHeadFloatR = mDelayReadHeadRight - readHeadR_x;
+
+            if (readHeadL_x1 >= mCircularBufferLength)
+                readHeadL_x1 -= mCircularBufferLength;
+
+            if (readHeadR_x1 >= mCircularBufferLength)
+                readHeadR_x1 -= mCircularBufferLength;
+
+            float delay_sample_left = lin_interp (mCircularBufferLeft[readHeadL_x], mCircularBufferLeft[readHeadL_x1], readHeadFloatL);
+            float delay_sample_right = lin_interp (mCircularBufferRight[readHeadR_x], mCircularBufferRight[readHeadR_x1], readHeadFloatR);
+
+            mFeedbackLeft = delay_sample_left * *mFeedbackParameter;
+            mFeedbackRight = delay_sample_right * *mFeedbackParameter;
+
+            mCircularBufferWriteHeadLeft++;
+            mCircularBufferWriteHeadRight++;
+
+            buffer.setSample (0, i, buffer.getSample (0, i) * (1 - *mDryWetParameter) + delay_sample_left * *mDryWetParameter);
+            buffer.setSample (1, i, buffer.getSample (1, i) * (1 - *mDryWetParameter) + delay_sample_right * *mDryWetParameter);
+
+            if (mCircularBufferWriteHeadLeft >= mCircularBufferLength)
+                mCircularBufferWriteHeadLeft = 0;
+
+            if (mCircularBufferWriteHeadRight >= mCircularBufferLength)
+                mCircularBufferWriteHeadRight = 0;
+        }
+    }
+
+    // out of line in the original so it is not inlined into the loop
+    JUCE_NOINLINE float lin_interp (float sample_x, float sample_x1, float inPhase)
+    {
+        return (1 - inPhase) * sample_x + inPhase * sample_x1;
+    }
+
+    //==============================================================================
+    juce::AudioProcessorEditor* createEditor() override         { return nullptr; }
+    bool hasEditor() const override                             { return false; }
+    const juce::String getName() const override                 { return "LegacyKadenzeDelay"; }
+    bool acceptsMidi() const override                           { return false; }
+    bool producesMidi() const override                          { return false; }
+    double getTailLengthSeconds() const override                { return 0.0; }
+    int getNumPrograms() override                               { return 1; }
+    int getCurrentProgram() override                            { return 0; }
+    void setCurrentProgram (int) override                       {}
+    const juce::String getProgramName (int) override            { return {}; }
+    void changeProgramName (int, const juce::String&) override  {}
+    void getStateInformation (juce::MemoryBlock&) override      {}
+    void setStateInformation (const void*, int) override        {}
+
+private:
+    // the original's compile-time MAX_DELAY_TIME
+    static constexpr float kMaxDelayTime = 2.0f;
+
+    float mDelayTimeLeftSmoothed = 0;
+    float mDelayTimeRightSmoothed = 0;
+
+    juce::AudioParameterFloat* mDryWetParameter;
+    juce::AudioParameterFloat* mFeedbackParameter;
+    juce::AudioParameterFloat* mDelayTimeLeftParameter;
+    juce::AudioParameterFloat* mDelayTimeRightParameter;
+
+    float mFeedbackLeft = 0;
+    float mFeedbackRight = 0;
+
+    float mDelayTimeLeftInSamples = 0;
+    float mDelayTimeRightInSamples = 0;
+    float mDelayReadHeadLeft = 0;
+    float mDelayReadHeadRight = 0;
+
+    int mCircularBufferWriteHeadLeft = 0;
+    int mCircularBufferWriteHeadRight = 0;
+    int mCircularBufferLength = 0;
+
+    float* mCircularBufferLeft = nullptr;
+    float* mCircularBufferRight = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (LegacyDelayProcessor)
+};
@@ -0,0 +1,1097 @@
+/*
+  ==============================================================================
+
+    Headless processBlock benchmark for KadenzeDelay.
+
+    Instantiates KadenzeDelayAudioProcessor without an editor and drives
+    processBlock across a matrix of sample rates, block sizes and parameter
+    automation patterns. Results are written as JSON (default) or CSV so they
+    can be collected from render nodes.
+
+    Every configuration is run through the current processor ("processBlock"),
+    the same processor with its SIMD kernels disabled ("scalar") and a frozen
+    copy of the original per-sample loop ("legacy"). The JSON output carries
+    the speedups between them.
+
+    The "unsplit" suite runs the processor with its control interval set to
+    the block size, so parameters are only picked up once per block. The
+    JSON comparisons carry "splittingCost", processBlock's time over this,
+    which is what sample-accurate automation costs for that configuration.
+
+    Alongside its own timing, the benchmark reads the processor's built-in
+    load instrumentation (DspLoad) for the timed blocks. Results from the
+    current processor carry it as "selfReport": mean, rolling and worst
+    percent of the real-time budget, cycles per sample where the CPU has a
+    cycle counter, and the load histogram.
+
+    The "compact" suite runs the processor with half-float delay memory.
+    The JSON comparisons carry "compactSpeedup", processBlock's time over
+    this.
+
+    The "double" suite runs the processor at double precision, on double
+    buffers with double delay memory, as a host with a 64-bit mix bus
+    would. The JSON comparisons carry "doubleCost", its time over
+    processBlock's.
+
+    The "shaped" suite runs the processor with the feedback loop's low cut,
+    high cut and oversampled saturator all on. The JSON comparisons carry
+    "shapingCost", its time over processBlock's, which has them all off.
+
+    The "modulated" suite runs the processor with the LFO moving the read
+    heads. The JSON comparisons carry "modulationCost", its time over
+    processBlock's, which reads at steady delays.
+
+    The "smear" suite runs the 16-line feedback delay network in place of
+    the two lines. The JSON comparisons carry "smearCost", its time over
+    processBlock's.
+
+    The "ducked" suite runs the processor with the wet signal ducked under
+    its own input. The JSON comparisons carry "duckingCost", its time over
+    processBlock's, which doesn't follow the key.
+
+    The "granular" suite runs the processor in granular playback with a
+    dense cloud, enough grains to fill every voice. The JSON comparisons
+    carry "granularCost", its time over processBlock's, which is the bound
+    on what any grain setting costs.
+
+    The "shimmer" suite runs the processor with all of the feedback pitch
+    shifted. Benchmarks render offline, so this is the shifter's dearer
+    offline mode. The JSON comparisons carry "shimmerCost", its time over
+    processBlock's.
+
+    The "multiTap" suite runs even tap patterns of increasing size with the
+    multi-tap forced to direct taps and then to the FFT convolution, and
+    reports the smallest tap count at which the convolution wins for each
+    sample rate and block size ("multiTapCrossover").
+
+    The "longDelay" suite sets the processor's maximum delay to each of
+    --max-delays seconds and reports, per sample rate, how long
+    prepareToPlay takes and how much delay memory is committed after it and
+    after running at the default delay times ("longDelay"). Neither should
+    grow with the maximum.
+
+    The "sessionLoad" suite restores one saved state into many instances,
+    as a host does when it reloads a large session, and reports how long
+    getStateInformation and setStateInformation take per instance
+    ("sessionLoad"). Both run on the message thread.
+
+    The "blockSize" suite checks rather than times. It renders the same
+    automated bounce at every block size, plus a few that don't divide the
+    control interval, and compares each render bit for bit with one made a
+    sample at a time ("blockSizeInvariance"). It does so for the loop plain,
+    with everything in it running, in smear mode, in reverse and granular
+    playback, and with Thiran reads into the saturator and the shimmer.
+    Any difference is reported on stderr and the benchmark exits with an
+    error.
+
+    Every processor runs as an offline render would, since the benchmark
+    runs faster than real time.
+
+    Usage:
+        KadenzeDelayBenchmark [--quick] [--csv] [--seconds=N]
+                              [--sample-rates=44100,48000,...]
+                              [--block-sizes=1,64,512,...]
+                              [--patterns=static,sweep,stepped,dense]
+                              [--suites=processBlock,scalar,unsplit,compact,double,shaped,modulated,smear,ducked,granular,shimmer,legacy,multiTap,longDelay,sessionLoad,blockSize]
+                              [--tap-counts=1,2,4,...]
+                              [--max-delays=2,60,600,...]
+                              [--interpolation=Linear|Cubic Hermite|Lagrange|...]
+                              [--tempo-sync]
+                              [--output=results.json]
+
+  ==============================================================================
+*/
+
+#include <JuceHeader.h>
+#include "../../Source/PluginProcessor.h"
+#include "LegacyDelayProcessor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    //==============================================================================
+    enum class Automation
+    {
+        staticParameters,   // parameters never change
+        sweep,              // delay times follow a slow triangle, updated every block
+        stepped,            // delay times jump to new values every 250 ms
+        dense               // every parameter changes every block
+    };
+
+    const char* getAutomationName (Automation a)
+    {
+        switch (a)
+        {
+            case Automation::staticParameters: return "static";
+            case Automation::sweep:            return "sweep";
+            case Automation::stepped:          return "stepped";
+            case Automation::dense:            return "dense";
+        }
+
+        return "unknown";
+    }
+
+    bool parseAutomation (const juce::String& name, Automation& result)
+    {
+        for (auto a : { Automation::staticParameters, Automation::sweep, Automation::stepped, Automation::dense })
+        {
+            if (name.trim().equalsIgnoreCase (getAutomationName (a)))
+            {
+                result = a;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //==============================================================================
+    struct BenchmarkConfig
+    {
+        double sampleRate;
+        int blockSize;
+        Automation automation;
+    };
+
+    struct BenchmarkResult
+    {
+        BenchmarkConfig config;
+        juce::String suite;
+        int numTaps = 0;
+        int numBlocks = 0;
+        double nsPerSample = 0;
+        double meanBlockNs = 0;
+        double worstBlockNs = 0;
+        double p50BlockNs = 0;
+        double p90BlockNs = 0;
+        double p99BlockNs = 0;
+        double p999BlockNs = 0;
+        double budgetBlockNs = 0;
+        bool hasSelfReport = false;
+        DspLoad::Snapshot selfReport;
+
+        juce::var toVar() const
+        {
+            auto* obj = new juce::DynamicObject();
+            obj->setProperty ("suite", suite);
+            obj->setProperty ("sampleRate", config.sampleRate);
+            obj->setProperty ("blockSize", config.blockSize);
+            obj->setProperty ("automation", getAutomationName (config.automation));
+
+            if (numTaps > 0)
+                obj->setProperty ("taps", numTaps);
+
+            obj->setProperty ("blocks", numBlocks);
+            obj->setProperty ("nsPerSample", nsPerSample);
+            obj->setProperty ("meanBlockNs", meanBlockNs);
+            obj->setProperty ("worstBlockNs", worstBlockNs);
+            obj->setProperty ("p50BlockNs", p50BlockNs);
+            obj->setProperty ("p90BlockNs", p90BlockNs);
+            obj->setProperty ("p99BlockNs", p99BlockNs);
+            obj->setProperty ("p999BlockNs", p999BlockNs);
+            obj->setProperty ("budgetBlockNs", budgetBlockNs);
+            obj->setProperty ("budgetPercentMean", 100.0 * meanBlockNs / budgetBlockNs);
+            obj->setProperty ("budgetPercentWorst", 100.0 * worstBlockNs / budgetBlockNs);
+            obj->setProperty ("instancesPerCoreMean", budgetBlockNs / meanBlockNs);
+            obj->setProperty ("instancesPerCoreP99", budgetBlockNs / p99BlockNs);
+
+            if (hasSelfReport)
+            {
+                auto* self = new juce::DynamicObject();
+                self->setProperty ("blocks", selfReport.numBlocks);
+                self->setProperty ("budgetPercentMean", selfReport.meanPercent);
+                self->setProperty ("budgetPercentRolling", selfReport.averagePercent);
+                self->setProperty ("budgetPercentWorst", selfReport.worstPercent);
+                self->setProperty ("overruns", selfReport.getNumOverruns());
+
+                if (DspLoad::hasCycleCounter())
+                    self->setProperty ("cyclesPerSample", selfReport.cyclesPerSample);
+
+                juce::Array<juce::var> histogram;
+
+                for (auto count : selfReport.histogram)
+                    histogram.add (count);
+
+                self->setProperty ("histogram", histogram);
+                obj->setProperty ("selfReport", self);
+            }
+
+            return obj;
+        }
+
+        static juce::String getCsvHeader()
+        {
+            return "suite,sampleRate,blockSize,automation,blocks,nsPerSample,meanBlockNs,worstBlockNs,"
+                   "p50BlockNs,p90BlockNs,p99BlockNs,p999BlockNs,budgetBlockNs,instancesPerCoreP99,taps,"
+                   "selfBudgetPercentMean,selfBudgetPercentWorst,selfCyclesPerSample";
+        }
+
+        juce::String toCsv() const
+        {
+            juce::StringArray fields;
+            fields.add (suite);
+            fields.add (juce::String (config.sampleRate));
+            fields.add (juce::String (config.blockSize));
+            fields.add (getAutomationName (config.automation));
+            fields.add (juce::String (numBlocks));
+
+            for (auto v : { nsPerSample, meanBlockNs, worstBlockNs, p50BlockNs, p90BlockNs,
+                            p99BlockNs, p999BlockNs, budgetBlockNs, budgetBlockNs / p99BlockNs })
+                fields.add (juce::String (v, 3));
+
+            fields.add (juce::String (numTaps));
+
+            // empty for the legacy processor, which has no instrumentation
+            fields.add (hasSelfReport ? juce::String (selfReport.meanPercent, 3) : juce::String());
+            fields.add (hasSelfReport ? juce::String (selfReport.worstPercent, 3) : juce::String());
+            fields.add (hasSelfReport ? juce::String (selfReport.cyclesPerSample, 3) : juce::String());
+            return fields.joinIntoString (",");
+        }
+    };
+
+    //==============================================================================
+    /** Moves the processor's parameters the way a host would during playback. */
+    class ParameterAutomator
+    {
+    public:
+        ParameterAutomator (juce::AudioProcessor& processor, Automation a)
+            : automation (a)
+        {
+            for (auto* p : processor.getParameters())
+            {
+                if (auto* ranged = dynamic_cast<juce::RangedAudioParameter*> (p))
+                {
+                    if (ranged->paramID == "drywet")              dryWet = ranged;
+                    else if (ranged->paramID == "feedback")       feedback = ranged;
+                    else if (ranged->paramID == "delayTimeLeft")  delayTimeLeft = ranged;
+                    else if (ranged->paramID == "delayTimeRight") delayTimeRight = ranged;
+                }
+            }
+        }
+
+        void applyForBlock (double blockStartSeconds)
+        {
+            switch (automation)
+            {
+                case Automation::staticParameters:
+                    break;
+
+                case Automation::sweep:
+                {
+                    // 0.25 Hz triangle between 50 ms and 1.5 s
+                    auto phase = std::fmod (blockStartSeconds * 0.25, 1.0);
+                    auto tri = phase < 0.5 ? phase * 2.0 : 2.0 - phase * 2.0;
+                    set (delayTimeLeft, (float) (0.05 + tri * 1.45));
+                    set (delayTimeRight, (float) (0.05 + (1.0 - tri) * 1.45));
+                    break;
+                }
+
+                case Automation::stepped:
+                {
+                    auto step = (int) (blockStartSeconds / 0.25);
+
+                    if (step != lastStep)
+                    {
+                        lastStep = step;
+                        set (delayTimeLeft, 0.05f + random.nextFloat() * 1.9f);
+                        set (delayTimeRight, 0.05f + random.nextFloat() * 1.9f);
+                    }
+                    break;
+                }
+
+                case Automation::dense:
+                {
+                    set (dryWet, random.nextFloat());
+                    set (feedback, 0.01f + random.nextFloat() * 0.97f);
+                    set (delayTimeLeft, 0.01f + random.nextFloat() * 1.99f);
+                    set (delayTimeRight, 0.01f + random.nextFloat() * 1.99f);
+                    break;
+                }
+            }
+        }
+
+    private:
+        static void set (juce::RangedAudioParameter* p, float value)
+        {
+            if (p != nullptr)
+                p->setValue (p->convertTo0to1 (value));
+        }
+
+        Automation automation;
+        juce::RangedAudioParameter* dryWet = nullptr;
+        juce::RangedAudioParameter* feedback = nullptr;
+        juce::RangedAudioParameter* delayTimeLeft = nullptr;
+        juce::RangedAudioParameter* delayTimeRight = nullptr;
+        juce::Random random { 0x4b44 };
+        int lastStep = -1;
+    };
+
+    //==============================================================================
+    double getPercentile (const std::vector<double>& sorted, double percentile)
+    {
+        if (sorted.empty())
+            return 0.0;
+
+        auto index = (size_t) juce::jlimit (0.0, (double) (sorted.size() - 1),
+                                            std::ceil (percentile / 100.0 * (double) sorted.size()) - 1.0);
+        return sorted[index];
+    }
+
+    void summarise (BenchmarkResult& result, std::vector<double>& blockNs)
+    {
+        std::sort (blockNs.begin(), blockNs.end());
+
+        double total = 0;
+        for (auto ns : blockNs)
+            total += ns;
+
+        result.numBlocks = (int) blockNs.size();
+        result.meanBlockNs = total / (double) blockNs.size();
+        result.nsPerSample = result.meanBlockNs / (double) result.config.blockSize;
+        result.worstBlockNs = blockNs.back();
+        result.p50BlockNs = getPercentile (blockNs, 50.0);
+        result.p90BlockNs = getPercentile (blockNs, 90.0);
+        result.p99BlockNs = getPercentile (blockNs, 99.0);
+        result.p999BlockNs = getPercentile (blockNs, 99.9);
+        result.budgetBlockNs = 1.0e9 * (double) result.config.blockSize / result.config.sampleRate;
+    }
+
+    /** The processor's own load figures. Only the current processor has them. */
+    void resetSelfReport (KadenzeDelayAudioProcessor& processor)    { processor.getDspLoad().resetStatistics(); }
+    void resetSelfReport (LegacyDelayProcessor&)                    {}
+
+    bool getSelfReport (KadenzeDelayAudioProcessor& processor, DspLoad::Snapshot& snapshot)
+    {
+        snapshot = processor.getDspLoad().getSnapshot();
+        return true;
+    }
+
+    bool getSelfReport (LegacyDelayProcessor&, DspLoad::Snapshot&)  { return false; }
+
+    /** Fills the buffer with the same noise every run so results are comparable. */
+    template <typename SampleType>
+    void fillWithNoise (juce::AudioBuffer<SampleType>& buffer, juce::Random& random)
+    {
+        for (int ch = 0; ch < buffer.getNumChannels(); ++ch)
+        {
+            auto* data = buffer.getWritePointer (ch);
+
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                data[i] = (SampleType) (random.nextFloat() * 0.5f - 0.25f);
+        }
+    }
+
+    /** Sets parameters by ID, as a host would: floats to the value given,
+        choices to it as an index.
+    */
+    void setParameters (juce::AudioProcessor& processor, std::initializer_list<std::pair<const char*, float>> values)
+    {
+        for (auto* param : processor.getParameters())
+        {
+            for (auto& value : values)
+            {
+                if (auto* ranged = dynamic_cast<juce::AudioParameterFloat*> (param))
+                {
+                    if (ranged->paramID == value.first)
+                        *ranged = value.second;
+                }
+                else if (auto* choice = dynamic_cast<juce::AudioParameterChoice*> (param))
+                {
+                    if (choice->paramID == value.first)
+                        *choice = (int) value.second;
+                }
+            }
+        }
+    }
+
+    //==============================================================================
+    /** Times processBlock on SampleType buffers, at the matching precision. */
+    template <typename ProcessorType, typename SampleType = float>
+    BenchmarkResult runProcessorBenchmark (const BenchmarkConfig& config, double secondsOfAudio, const juce::String& suite,
+                                           std::function<void (ProcessorType&)> setup = {})
+    {
+        using Clock = std::chrono::steady_clock;
+
+        ProcessorType processor;
+        processor.setNonRealtime (true);
+        processor.setProcessingPrecision (std::is_same_v<SampleType, double> ? juce::AudioProcessor::doublePrecision
+                                                                              : juce::AudioProcessor::singlePrecision);
+
+        if (setup)
+            setup (processor);
+
+        processor.setRateAndBufferSizeDetails (config.sampleRate, config.blockSize);
+        processor.prepareToPlay (config.sampleRate, config.blockSize);
+
+        auto numChannels = juce::jmax (processor.getTotalNumInputChannels(),
+                                       processor.getTotalNumOutputChannels());
+
+        // pre-render one second of input so refilling the buffer stays out of the timed region
+        auto sourceLength = juce::jmax (config.blockSize, (int) config.sampleRate);
+        juce::AudioBuffer<SampleType> source (numChannels, sourceLength);
+        juce::Random random (0x1234);
+        fillWithNoise (source, random);
+
+        juce::AudioBuffer<SampleType> buffer (numChannels, config.blockSize);
+        juce::MidiBuffer midi;
+        ParameterAutomator automator (processor, config.automation);
+
+        auto numBlocks = juce::jmax (1, (int) (secondsOfAudio * config.sampleRate / config.blockSize));
+        auto numWarmupBlocks = juce::jmax (1, numBlocks / 8);
+
+        std::vector<double> blockNs;
+        blockNs.reserve ((size_t) numBlocks);
+
+        int sourcePosition = 0;
+
+        for (int block = 0; block < numWarmupBlocks + numBlocks; ++block)
+        {
+            if (sourcePosition + config.blockSize > sourceLength)
+                sourcePosition = 0;
+
+            for (int ch = 0; ch < numChannels; ++ch)
+                buffer.copyFrom (ch, 0, source, ch, sourcePosition, config.blockSize);
+
+            sourcePosition += config.blockSize;
+
+            automator.applyForBlock ((double) block * config.blockSize / config.sampleRate);
+
+            // the processor's statistics cover the same blocks as ours
+            if (block == numWarmupBlocks)
+                resetSelfReport (processor);
+
+            auto start = Clock::now();
+            processor.processBlock (buffer, midi);
+            auto end = Clock::now();
+
+            if (block >= numWarmupBlocks)
+                blockNs.push_back ((double) std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count());
+        }
+
+        BenchmarkResult result;
+        result.config = config;
+        result.suite = suite;
+        result.hasSelfReport = getSelfReport (processor, result.selfReport);
+        summarise (result, blockNs);
+
+        processor.releaseResources();
+        return result;
+    }
+
+    /** Times prepareToPlay with a given maximum delay, and reads how much delay
+        memory is committed after it and after secondsOfAudio of noise at the
+        default delay times.
+    */
+    juce::var runLongDelayBenchmark (double sampleRate, int blockSize, double maximumDelaySeconds, double secondsOfAudio)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        KadenzeDelayAudioProcessor processor;
+        processor.setNonRealtime (true);
+        processor.setMaximumDelayTime (maximumDelaySeconds);
+        processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+
+        auto start = Clock::now();
+        processor.prepareToPlay (sampleRate, blockSize);
+        auto end = Clock::now();
+
+        auto* obj = new juce::DynamicObject();
+        obj->setProperty ("sampleRate", sampleRate);
+        obj->setProperty ("maximumDelaySeconds", processor.getMaximumDelayTime());
+        obj->setProperty ("prepareMs", (double) std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count() * 1.0e-6);
+        obj->setProperty ("committedBytesAfterPrepare", (juce::int64) processor.getDelayMemoryBytes());
+
+        auto numChannels = juce::jmax (processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        juce::AudioBuffer<float> buffer (numChannels, blockSize);
+        juce::MidiBuffer midi;
+        juce::Random random (0x1234);
+
+        auto numBlocks = juce::jmax (1, (int) (secondsOfAudio * sampleRate / blockSize));
+
+        for (int block = 0; block < numBlocks; ++block)
+        {
+            fillWithNoise (buffer, random);
+            processor.processBlock (buffer, midi);
+        }
+
+        obj->setProperty ("committedBytesAfterRun", (juce::int64) processor.getDelayMemoryBytes());
+
+        processor.releaseResources();
+        return juce::var (obj);
+    }
+
+    /** Saves a state with every parameter away from its default and times
+        restoring it into numInstances fresh processors.
+    */
+    juce::var runSessionLoadBenchmark (int numInstances)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        KadenzeDelayAudioProcessor source;
+        juce::Random random (0x1234);
+
+        for (auto* param : source.getParameters())
+            param->setValue (random.nextFloat());
+
+        juce::MemoryBlock state;
+        auto start = Clock::now();
+        source.getStateInformation (state);
+        auto end = Clock::now();
+        const double saveUs = (double) std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count() * 1.0e-3;
+
+        juce::OwnedArray<KadenzeDelayAudioProcessor> instances;
+
+        for (int i = 0; i < numInstances; ++i)
+            instances.add (new KadenzeDelayAudioProcessor());
+
+        start = Clock::now();
+
+        for (auto* instance : instances)
+            instance->setStateInformation (state.getData(), (int) state.getSize());
+
+        end = Clock::now();
+        const double restoreMs = (double) std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count() * 1.0e-6;
+
+        auto* obj = new juce::DynamicObject();
+        obj->setProperty ("instances", numInstances);
+        obj->setProperty ("stateBytes", (int) state.getSize());
+        obj->setProperty ("saveUs", saveUs);
+        obj->setProperty ("restoreMsTotal", restoreMs);
+        obj->setProperty ("restoreUsPerInstance", restoreMs * 1000.0 / numInstances);
+        return juce::var (obj);
+    }
+
+    /** Renders secondsOfAudio of noise in blocks of blockSize, with the
+        delay times stepping about every half second, long enough for them
+        to settle and let the processor run flat. Blocks are also split where
+        the automation moves, as a host splits them at automation points, so
+        every block size sees each change at the same sample.
+    */
+    juce::AudioBuffer<float> renderBounce (double sampleRate, int blockSize, double secondsOfAudio,
+                                           const std::function<void (KadenzeDelayAudioProcessor&)>& setup)
+    {
+        KadenzeDelayAudioProcessor processor;
+        processor.setNonRealtime (true);
+        setup (processor);
+        processor.setRateAndBufferSizeDetails (sampleRate, blockSize);
+        processor.prepareToPlay (sampleRate, blockSize);
+
+        auto numChannels = juce::jmax (processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        auto numSamples = juce::jmax (1, (int) (secondsOfAudio * sampleRate));
+
+        // processed in place, so the noise is overwritten by the output
+        juce::AudioBuffer<float> output (numChannels, numSamples);
+        juce::Random random (0x1234);
+        fillWithNoise (output, random);
+
+        juce::MidiBuffer midi;
+        ParameterAutomator automator (processor, Automation::stepped);
+        // an odd number of samples, so the changes land all over the control
+        // grid rather than only where an interval starts
+        auto stepLength = (int) (sampleRate * 0.5) | 1;
+
+        for (int position = 0; position < numSamples;)
+        {
+            // the stepped pattern moves every 250 ms of the time it is given
+            if (position % stepLength == 0)
+                automator.applyForBlock ((double) (position / stepLength) * 0.25);
+
+            auto length = juce::jmin (blockSize, numSamples - position, stepLength - position % stepLength);
+            juce::AudioBuffer<float> block (output.getArrayOfWritePointers(), numChannels, position, length);
+            processor.processBlock (block, midi);
+            position += length;
+        }
+
+        processor.releaseResources();
+        return output;
+    }
+
+    /** Renders the bounce at each of blockSizes and compares it bit for bit
+        with a render made a sample at a time. Adds one entry per block size
+        to results, and returns false if any of them differs.
+    */
+    bool checkBlockSizeInvariance (double sampleRate, const juce::Array<int>& blockSizes, double secondsOfAudio,
+                                   const juce::String& name, const std::function<void (KadenzeDelayAudioProcessor&)>& setup,
+                                   juce::Array<juce::var>& results)
+    {
+        auto reference = renderBounce (sampleRate, 1, secondsOfAudio, setup);
+        bool allIdentical = true;
+
+        for (auto blockSize : blockSizes)
+        {
+            auto render = renderBounce (sampleRate, blockSize, secondsOfAudio, setup);
+            int firstDifference = -1;
+            double maximumDifference = 0.0;
+
+            for (int ch = 0; ch < render.getNumChannels(); ++ch)
+            {
+                auto* expected = reference.getReadPointer (ch);
+                auto* actual = render.getReadPointer (ch);
+
+                for (int i = 0; i < render.getNumSamples(); ++i)
+                {
+                    // compared as bits, so even a NaN in both renders matches
+                    if (std::memcmp (expected + i, actual + i, sizeof (float)) != 0)
+                    {
+                        firstDifference = firstDifference < 0 ? i : juce::jmin (firstDifference, i);
+                        maximumDifference = juce::jmax (maximumDifference, (double) std::abs (expected[i] - actual[i]));
+                    }
+                }
+            }
+
+            if (firstDifference >= 0)
+            {
+                allIdentical = false;
+                std::cerr << "Block size " << blockSize << " changes the \"" << name << "\" bounce at "
+                          << sampleRate << " Hz from sample " << firstDifference << std::endl;
+            }
+
+            auto* obj = new juce::DynamicObject();
+            obj->setProperty ("setup", name);
+            obj->setProperty ("sampleRate", sampleRate);
+            obj->setProperty ("blockSize", blockSize);
+            obj->setProperty ("identical", firstDifference < 0);
+
+            if (firstDifference >= 0)
+            {
+                obj->setProperty ("firstDifference", firstDifference);
+                obj->setProperty ("maximumDifference", maximumDifference);
+            }
+
+            results.add (obj);
+        }
+
+        return allIdentical;
+    }
+
+    /** Estimates how much of each measurement is the clock itself. */
+    double measureTimerOverheadNs()
+    {
+        using Clock = std::chrono::steady_clock;
+        constexpr int numReads = 100000;
+
+        auto start = Clock::now();
+        for (int i = 0; i < numReads; ++i)
+            juce::ignoreUnused (Clock::now());
+        auto end = Clock::now();
+
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count() / numReads;
+    }
+
+    //==============================================================================
+    template <typename Type>
+    juce::Array<Type> parseList (const juce::String& text, juce::Array<Type> defaults)
+    {
+        if (text.isEmpty())
+            return defaults;
+
+        juce::Array<Type> values;
+
+        for (auto& token : juce::StringArray::fromTokens (text, ",", {}))
+            if (token.trim().isNotEmpty())
+                values.add ((Type) token.trim().getDoubleValue());
+
+        return values.isEmpty() ? defaults : values;
+    }
+}
+
+//==============================================================================
+int main (int argc, char* argv[])
+{
+    // the processor runs a timer, which needs a message manager to exist
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList args (argc, argv);
+
+    auto quick = args.containsOption ("--quick");
+    auto csv = args.containsOption ("--csv");
+
+    auto secondsOfAudio = args.getValueForOption ("--seconds").getDoubleValue();
+    if (secondsOfAudio <= 0.0)
+        secondsOfAudio = quick ? 0.5 : 4.0;
+
+    auto sampleRates = parseList<double> (args.getValueForOption ("--sample-rates"),
+                                          quick ? juce::Array<double> { 48000.0, 192000.0 }
+                                                : juce::Array<double> { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 });
+
+    auto blockSizes = parseList<int> (args.getValueForOption ("--block-sizes"),
+                                      quick ? juce::Array<int> { 1, 64, 512, 4096 }
+                                            : juce::Array<int> { 1, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 });
+
+    juce::Array<Automation> patterns;
+
+    for (auto& name : juce::StringArray::fromTokens (args.getValueForOption ("--patterns"), ",", {}))
+    {
+        Automation a;
+
+        if (parseAutomation (name, a))
+            patterns.add (a);
+        else if (name.trim().isNotEmpty())
+            std::cerr << "Unknown automation pattern: " << name << std::endl;
+    }
+
+    if (patterns.isEmpty())
+        patterns = { Automation::staticParameters, Automation::sweep, Automation::stepped, Automation::dense };
+
+    auto suites = juce::StringArray::fromTokens (args.getValueForOption ("--suites"), ",", {});
+    suites.trim();
+    suites.removeEmptyStrings();
+
+    if (suites.isEmpty())
+        suites = { "processBlock", "scalar", "unsplit", "compact", "double", "shaped", "modulated", "smear", "ducked", "granular", "shimmer", "legacy", "multiTap", "longDelay", "sessionLoad", "blockSize" };
+
+    auto tapCounts = parseList<int> (args.getValueForOption ("--tap-counts"),
+                                     quick ? juce::Array<int> { 4, 16, 64, 256 }
+                                           : juce::Array<int> { 1, 2, 4, 8, 16, 32, 64, 128, 256 });
+
+    auto maximumDelays = parseList<double> (args.getValueForOption ("--max-delays"),
+                                            quick ? juce::Array<double> { 2.0, 600.0 }
+                                                  : juce::Array<double> { 2.0, 10.0, 60.0, 300.0, 600.0 });
+
+    // the plugin's suites run with one interpolator, chosen by name
+    auto interpolationName = args.getValueForOption ("--interpolation").trim();
+    auto interpolation = interpolationName.isEmpty() ? 0 : Interpolators::getQualityNames().indexOf (interpolationName, true);
+
+    if (interpolation < 0)
+    {
+        std::cerr << "Unknown interpolation: " << interpolationName << std::endl;
+        return 1;
+    }
+
+    // --tempo-sync runs them with note-value times instead. there's no host,
+    // so they follow the processor's default tempo
+    auto tempoSync = args.containsOption ("--tempo-sync");
+
+    auto configure = [interpolation, tempoSync] (KadenzeDelayAudioProcessor& p)
+    {
+        for (auto* param : p.getParameters())
+        {
+            if (auto* choice = dynamic_cast<juce::AudioParameterChoice*> (param))
+                if (choice->paramID == "interpolation")
+                    *choice = interpolation;
+
+            if (auto* toggle = dynamic_cast<juce::AudioParameterBool*> (param))
+                if (toggle->paramID == "tempoSync")
+                    *toggle = tempoSync;
+        }
+    };
+
+    // the suites timed against processBlock, in the order they run, with
+    // the key their ratio to it is reported under. most report their own
+    // time over processBlock's. unsplit and compact trade something away
+    // for speed, so they report processBlock's over theirs
+    using SuiteRunner = std::function<BenchmarkResult (const BenchmarkConfig&, const juce::String&)>;
+
+    struct ComparedSuite
+    {
+        const char* name;
+        const char* resultKey;
+        bool isCurrentOverSuite;
+        SuiteRunner run;
+    };
+
+    auto withSetup = [&] (std::function<void (KadenzeDelayAudioProcessor&, const BenchmarkConfig&)> setup) -> SuiteRunner
+    {
+        return [&, setup] (const BenchmarkConfig& config, const juce::String& suite)
+        {
+            return runProcessorBenchmark<KadenzeDelayAudioProcessor> (config, secondsOfAudio, suite,
+                                                                      [&] (KadenzeDelayAudioProcessor& p)
+                                                                      {
+                                                                          configure (p);
+                                                                          setup (p, config);
+                                                                      });
+        };
+    };
+
+    const ComparedSuite comparedSuites[] =
+    {
+        { "scalar", "speedupVsScalar", false,
+          withSetup ([] (auto& p, auto&) { p.setSimdEnabled (false); }) },
+
+        { "unsplit", "splittingCost", true,
+          withSetup ([] (auto& p, auto& config) { p.setControlInterval (config.blockSize); }) },
+
+        { "compact", "compactSpeedup", true,
+          withSetup ([] (auto& p, auto&) { p.setMemoryFormat (DelayMemory::Format::float16); }) },
+
+        { "double", "doubleCost", false,
+          [&] (const BenchmarkConfig& config, const juce::String& suite)
+          {
+              return runProcessorBenchmark<KadenzeDelayAudioProcessor, double> (config, secondsOfAudio, suite, configure);
+          } },
+
+        { "shaped", "shapingCost", false,
+          withSetup ([] (auto& p, auto&) { setParameters (p, { { "lowCut", 200.0f }, { "highCut", 5000.0f }, { "drive", 50.0f } }); }) },
+
+        { "modulated", "modulationCost", false,
+          withSetup ([] (auto& p, auto&) { setParameters (p, { { "modDepth", 3.0f }, { "modRate", 0.8f } }); }) },
+
+        { "smear", "smearCost", false,
+          withSetup ([] (auto& p, auto&) { setParameters (p, { { "smear", 2.0f } }); }) },
+
+        { "ducked", "duckingCost", false,
+          withSetup ([] (auto& p, auto&) { setParameters (p, { { "duck", 100.0f }, { "duckThreshold", -40.0f } }); }) },
+
+        { "granular", "granularCost", false,
+          withSetup ([] (auto& p, auto&)
+                     {
+                         setParameters (p, { { "playback", (float) GrainCloud::Mode::granular },
+                                             { "grainSize", 500.0f },
+                                             { "grainDensity", 100.0f } });
+                     }) },
+
+        { "shimmer", "shimmerCost", false,
+          withSetup ([] (auto& p, auto&) { setParameters (p, { { "shimmer", 100.0f } }); }) },
+
+        { "legacy", "speedupVsLegacy", false,
+          [&] (const BenchmarkConfig& config, const juce::String& suite)
+          {
+              return runProcessorBenchmark<LegacyDelayProcessor> (config, secondsOfAudio, suite);
+          } },
+    };
+
+    juce::Array<BenchmarkResult> results;
+    juce::Array<juce::var> comparisons;
+
+    for (auto sampleRate : sampleRates)
+    {
+        for (auto blockSize : blockSizes)
+        {
+            for (auto pattern : patterns)
+            {
+                BenchmarkConfig config { sampleRate, juce::jmax (1, blockSize), pattern };
+                double currentMean = 0;
+
+                if (suites.contains ("processBlock"))
+                {
+                    results.add (runProcessorBenchmark<KadenzeDelayAudioProcessor> (config, secondsOfAudio, "processBlock",
+                                                                                    configure));
+                    currentMean = results.getReference (results.size() - 1).meanBlockNs;
+                }
+
+                juce::DynamicObject* obj = nullptr;
+
+                for (auto& compared : comparedSuites)
+                {
+                    if (! suites.contains (compared.name))
+                        continue;
+
+                    results.add (compared.run (config, compared.name));
+                    auto mean = results.getReference (results.size() - 1).meanBlockNs;
+
+                    if (currentMean <= 0 || mean <= 0)
+                        continue;
+
+                    if (obj == nullptr)
+                    {
+                        obj = new juce::DynamicObject();
+                        obj->setProperty ("sampleRate", sampleRate);
+                        obj->setProperty ("blockSize", config.blockSize);
+                        obj->setProperty ("automation", getAutomationName (pattern));
+                        comparisons.add (obj);
+                    }
+
+                    obj->setProperty (compared.resultKey, compared.isCurrentOverSuite ? currentMean / mean
+                                                                                       : mean / currentMean);
+                }
+            }
+        }
+    }
+
+    // multi-tap crossover: same patterns, direct taps against the convolution.
+    // parameters stay static so only the tap engine differs between runs
+    juce::Array<juce::var> crossovers;
+
+    if (suites.contains ("multiTap"))
+    {
+        for (auto sampleRate : sampleRates)
+        {
+            for (auto blockSize : blockSizes)
+            {
+                BenchmarkConfig config { sampleRate, juce::jmax (1, blockSize), Automation::staticParameters };
+                int crossover = 0;
+
+                for (auto numTaps : tapCounts)
+                {
+                    double means[2] = {};
+                    int index = 0;
+
+                    for (auto mode : { MultiTapDelay::Mode::direct, MultiTapDelay::Mode::convolution })
+                    {
+                        auto suite = mode == MultiTapDelay::Mode::direct ? "multiTapDirect" : "multiTapConvolution";
+                        auto result = runProcessorBenchmark<KadenzeDelayAudioProcessor> (config, secondsOfAudio, suite,
+                                                                                         [&] (KadenzeDelayAudioProcessor& p)
+                                                                                         {
+                                                                                             configure (p);
+                                                                                             p.setMultiTapMode (mode);
+                                                                                             p.setTapPattern (MultiTapDelay::makeEvenPattern (numTaps, 1.0));
+                                                                                         });
+                        result.numTaps = numTaps;
+                        means[index++] = result.meanBlockNs;
+                        results.add (result);
+                    }
+
+                    if (crossover == 0 && means[1] < means[0])
+                        crossover = numTaps;
+                }
+
+                auto* obj = new juce::DynamicObject();
+                obj->setProperty ("sampleRate", sampleRate);
+                obj->setProperty ("blockSize", config.blockSize);
+
+                // 0 when the convolution never won in the measured range
+                obj->setProperty ("taps", crossover);
+                crossovers.add (obj);
+            }
+        }
+    }
+
+    // long delays: prepare time and committed memory against the maximum.
+    // the block size doesn't matter here, so the largest one is used
+    juce::Array<juce::var> longDelays;
+
+    if (suites.contains ("longDelay"))
+    {
+        int blockSize = 1;
+
+        for (auto size : blockSizes)
+            blockSize = juce::jmax (blockSize, size);
+
+        for (auto sampleRate : sampleRates)
+            for (auto maximumDelay : maximumDelays)
+                longDelays.add (runLongDelayBenchmark (sampleRate, blockSize, maximumDelay, secondsOfAudio));
+    }
+
+    juce::var sessionLoad;
+
+    if (suites.contains ("sessionLoad"))
+        sessionLoad = runSessionLoadBenchmark (quick ? 64 : 512);
+
+    // block-size invariance: a bounce for each of the engine's paths, at
+    // the given block sizes and a few odd ones
+    juce::Array<juce::var> invariance;
+    bool isInvariant = true;
+
+    if (suites.contains ("blockSize"))
+    {
+        auto invarianceBlockSizes = blockSizes;
+
+        for (auto blockSize : { 7, 100, 333, 1000 })
+            invarianceBlockSizes.addIfNotAlreadyThere (blockSize);
+
+        auto configureEverything = [&] (KadenzeDelayAudioProcessor& p)
+        {
+            configure (p);
+            setParameters (p, { { "lowCut", 200.0f }, { "highCut", 5000.0f }, { "drive", 50.0f },
+                                { "modDepth", 3.0f }, { "duck", 100.0f }, { "duckThreshold", -40.0f },
+                                { "shimmer", 50.0f } });
+        };
+
+        struct InvarianceSetup
+        {
+            const char* name;
+            std::function<void (KadenzeDelayAudioProcessor&)> setup;
+        };
+
+        // smear and the grain playback have read paths of their own, and
+        // Thiran reads carry state from sample to sample, so each gets a
+        // bounce rather than relying on "everything" to cover it
+        const InvarianceSetup invarianceSetups[] =
+        {
+            { "plain", configure },
+            { "everything", configureEverything },
+            { "smear", [&] (auto& p) { configure (p); setParameters (p, { { "smear", 2.0f } }); } },
+            { "reverse", [&] (auto& p) { configure (p); setParameters (p, { { "playback", (float) GrainCloud::Mode::reverse } }); } },
+            { "granular", [&] (auto& p)
+                          {
+                              configure (p);
+                              setParameters (p, { { "playback", (float) GrainCloud::Mode::granular },
+                                                  { "grainSize", 500.0f },
+                                                  { "grainDensity", 100.0f } });
+                          } },
+            { "thiranDriveShimmer", [&] (auto& p)
+                                    {
+                                        configure (p);
+                                        setParameters (p, { { "interpolation", (float) Interpolators::Quality::thiran },
+                                                            { "drive", 50.0f },
+                                                            { "shimmer", 50.0f } });
+                                    } }
+        };
+
+        for (auto sampleRate : sampleRates)
+            for (auto& setup : invarianceSetups)
+                isInvariant = checkBlockSizeInvariance (sampleRate, invarianceBlockSizes, 2.0, setup.name, setup.setup, invariance) && isInvariant;
+    }
+
+    juce::String output;
+
+    if (csv)
+    {
+        output << BenchmarkResult::getCsvHeader() << juce::newLine;
+
+        for (auto& r : results)
+            output << r.toCsv() << juce::newLine;
+    }
+    else
+    {
+        juce::Array<juce::var> resultVars;
+
+        for (auto& r : results)
+            resultVars.add (r.toVar());
+
+        auto* root = new juce::DynamicObject();
+        root->setProperty ("benchmark", ProjectInfo::projectName);
+        root->setProperty ("version", ProjectInfo::versionString);
+        root->setProperty ("juceVersion", juce::SystemStats::getJUCEVersion());
+        root->setProperty ("cpu", juce::SystemStats::getCpuModel());
+        root->setProperty ("secondsOfAudio", secondsOfAudio);
+        root->setProperty ("interpolation", Interpolators::getQualityNames()[interpolation]);
+        root->setProperty ("tempoSync", tempoSync);
+        root->setProperty ("timerOverheadNs", measureTimerOverheadNs());
+        root->setProperty ("cycleCounter", DspLoad::hasCycleCounter());
+
+        juce::Array<juce::var> histogramEdges;
+
+        for (auto edge : DspLoad::kHistogramEdges)
+            histogramEdges.add (edge);
+
+        // upper edges in percent of the budget; the last bin is overruns
+        root->setProperty ("selfReportHistogramEdges", histogramEdges);
+        root->setProperty ("results", resultVars);
+        root->setProperty ("comparisons", comparisons);
+        root->setProperty ("multiTapCrossover", crossovers);
+        root->setProperty ("longDelay", longDelays);
+        root->setProperty ("sessionLoad", sessionLoad);
+        root->setProperty ("blockSizeInvariance", invariance);
+
+        output = juce::JSON::toString (juce::var (root));
+    }
+
+    auto outputPath = args.getValueForOption ("--output");
+
+    if (outputPath.isNotEmpty())
+    {
+        juce::File file (juce::File::getCurrentWorkingDirectory().getChildFile (outputPath));
+
+        if (! file.replaceWithText (output))
+        {
+            std::cerr << "Could not write " << file.getFullPathName() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << output << std::endl;
+    }
+
+    return isInvariant ? 0 : 2;
+}
@@ -0,0 +1,105 @@
+/*
+  ==============================================================================
+
+    BlockSmoother.h
+
+    One-pole parameter smoothing evaluated once per fixed-length step instead
+    of once per sample.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+/** A straight-line segment covering one smoothing step.
+
+    Sample i of the step uses start + increment * (i + 1), so the per-sample
+    cost is a multiply and an add, and the value at any sample depends only
+    on where that sample sits in the step, not on how the step was split.
+*/
+struct ParameterRamp
+{
+    float start = 0.0f;
+    float increment = 0.0f;
+
+    float getEnd (int numSamples) const    { return start + increment * (float) numSamples; }
+    bool isFlat() const                    { return increment == 0.0f; }
+};
+
+//==============================================================================
+/** Exponential glide towards a target, advanced a fixed number of samples at
+    a time.
+
+    The glide time is given in milliseconds and is the time constant of the
+    exponential, so the glide sounds the same at every sample rate. The step
+    length is fixed in prepare() rather than following the host's block
+    size: the exponential is evaluated once per step and the step is covered
+    by a linear ramp, so every host block size produces the same values.
+*/
+class BlockSmoother
+{
+public:
+    void prepare (double sampleRate, int stepSize)
+    {
+        mSampleRate = sampleRate;
+        mStepSize = juce::jmax (1, stepSize);
+        updateCoefficient();
+    }
+
+    /** Changes the glide time. Cheap when the time hasn't changed, so it can be
+        called every block with the latest parameter value.
+    */
+    void setGlideTime (float milliseconds)
+    {
+        if (milliseconds != mGlideMilliseconds)
+        {
+            mGlideMilliseconds = milliseconds;
+            updateCoefficient();
+        }
+    }
+
+    float getGlideTime() const              { return mGlideMilliseconds; }
+    int getStepSize() const                 { return mStepSize; }
+
+    void setCurrentValue (float value)      { mCurrent = value; }
+    float getCurrentValue() const           { return mCurrent; }
+
+    /** True once the glide has reached target, after which every step is flat. */
+    bool isSettled (float target) const     { return mCurrent == target; }
+
+    /** Moves one step towards target and returns the ramp to use for it. */
+    ParameterRamp advance (float target)
+    {
+        ParameterRamp ramp;
+        ramp.start = mCurrent;
+
+        auto end = mCurrent + (target - mCurrent) * mStepCoefficient;
+
+        // snap once we are inaudibly close so the ramp becomes flat
+        if (std::abs (target - end) < 1.0e-6f)
+            end = target;
+
+        ramp.increment = (end - mCurrent) / (float) mStepSize;
+        mCurrent = end;
+        return ramp;
+    }
+
+private:
+    void updateCoefficient()
+    {
+        const double samplesPerTimeConstant = mSampleRate * (double) mGlideMilliseconds * 0.001;
+
+        // no glide time means jumping straight to the target
+        mStepCoefficient = samplesPerTimeConstant > 0.0 ? (float) (1.0 - std::exp (-(double) mStepSize / samplesPerTimeConstant))
+                                                        : 1.0f;
+    }
+
+    double mSampleRate = 44100.0;
+    float mGlideMilliseconds = 0.0f;
+    float mCurrent = 0.0f;
+    float mStepCoefficient = 1.0f;
+    int mStepSize = 1;
+};
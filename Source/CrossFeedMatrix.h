@@ -0,0 +1,151 @@
+/*
+  ==============================================================================
+
+    CrossFeedMatrix.h
+
+    Routes the per-channel feedback signals (input plus delayed output) into
+    the delay lines. Line d is fed sum over s of gain(d, s) * source s. The
+    original ping-pong swap is the pingPong preset with two channels.
+
+    Presets that are plain permutations with unit gains are routed by
+    pointer, so they cost nothing per sample. Anything else is mixed with
+    FloatVectorOperations, one row at a time over whole chunks.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+class CrossFeedMatrix
+{
+public:
+    /** The widest layout the engine handles, e.g. 7.1.4 or third-order ambisonics. */
+    static constexpr int kMaxChannels = 16;
+
+    /** The presets in the order of the "Cross Feed" parameter. */
+    enum class Preset
+    {
+        pingPong = 0,   // each line is fed by the next channel round
+        straight,       // each line is fed by its own channel
+        diffuse         // every line is fed an equal share of every channel
+    };
+
+    static juce::StringArray getPresetNames()
+    {
+        return { "Ping Pong", "Straight", "Diffuse" };
+    }
+
+    CrossFeedMatrix()
+    {
+        setPreset (Preset::pingPong, 2);
+    }
+
+    //==============================================================================
+    /** Loads one of the presets for numChannels channels. Doesn't allocate,
+        so it can be called from processBlock.
+    */
+    void setPreset (Preset preset, int numChannels) noexcept
+    {
+        jassert (numChannels > 0 && numChannels <= kMaxChannels);
+
+        mNumChannels = numChannels;
+        mPreset = preset;
+
+        for (int d = 0; d < numChannels; ++d)
+        {
+            for (int s = 0; s < numChannels; ++s)
+            {
+                switch (preset)
+                {
+                    case Preset::pingPong:  mGains[d][s] = s == (d + 1) % numChannels ? 1.0f : 0.0f; break;
+                    case Preset::straight:  mGains[d][s] = s == d ? 1.0f : 0.0f; break;
+                    case Preset::diffuse:   mGains[d][s] = 1.0f / (float) numChannels; break;
+                    default:                jassertfalse; break;
+                }
+            }
+        }
+
+        updatePermutation();
+    }
+
+    /** Sets a single gain, for routings the presets don't cover. */
+    void setGain (int destination, int source, float gain) noexcept
+    {
+        jassert (juce::isPositiveAndBelow (destination, mNumChannels) && juce::isPositiveAndBelow (source, mNumChannels));
+
+        mGains[destination][source] = gain;
+        updatePermutation();
+    }
+
+    float getGain (int destination, int source) const noexcept  { return mGains[destination][source]; }
+    int getNumChannels() const noexcept                         { return mNumChannels; }
+    Preset getPreset() const noexcept                           { return mPreset; }
+
+    //==============================================================================
+    /** Works out what each line is fed for numSamples samples. lineInputs[d]
+        is set to the buffer holding line d's input: one of sources when the
+        matrix is a permutation, in which case nothing is copied, otherwise
+        mixBuffers[d], which is filled here. Sample is float or double.
+    */
+    template <typename Sample>
+    void process (const Sample* const* sources, Sample* const* mixBuffers, const Sample** lineInputs, int numSamples) const noexcept
+    {
+        if (mIsPermutation)
+        {
+            for (int d = 0; d < mNumChannels; ++d)
+                lineInputs[d] = sources[mSourceForLine[d]];
+
+            return;
+        }
+
+        for (int d = 0; d < mNumChannels; ++d)
+        {
+            Sample* const dest = mixBuffers[d];
+            juce::FloatVectorOperations::multiply (dest, sources[0], (Sample) mGains[d][0], numSamples);
+
+            for (int s = 1; s < mNumChannels; ++s)
+                if (mGains[d][s] != 0.0f)
+                    juce::FloatVectorOperations::addWithMultiply (dest, sources[s], (Sample) mGains[d][s], numSamples);
+
+            lineInputs[d] = dest;
+        }
+    }
+
+private:
+    void updatePermutation() noexcept
+    {
+        mIsPermutation = true;
+
+        for (int d = 0; d < mNumChannels && mIsPermutation; ++d)
+        {
+            int numUnity = 0;
+
+            for (int s = 0; s < mNumChannels; ++s)
+            {
+                if (mGains[d][s] == 1.0f)
+                {
+                    mSourceForLine[d] = s;
+                    ++numUnity;
+                }
+                else if (mGains[d][s] != 0.0f)
+                {
+                    mIsPermutation = false;
+                }
+            }
+
+            if (numUnity != 1)
+                mIsPermutation = false;
+        }
+    }
+
+    float mGains[kMaxChannels][kMaxChannels] = {};
+    int mSourceForLine[kMaxChannels] = {};
+    int mNumChannels = 0;
+    Preset mPreset = Preset::pingPong;
+    bool mIsPermutation = false;
+
+    JUCE_LEAK_DETECTOR (CrossFeedMatrix)
+};
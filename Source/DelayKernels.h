@@ -0,0 +1,687 @@
+/*
+  ==============================================================================
+
+    DelayKernels.h
+
+    The per-chunk loops of the delay: constant-delay FIR interpolation, the
+    ping-pong feedback write, the network's Hadamard mixing and feedback
+    write, the ducking gain, the ramped dry/wet mix and the feedback
+    saturator. Each has a scalar version and a juce::dsp::SIMDRegister
+    version, and each is a template on the sample type, for the float and
+    double processing paths. isSimdAvailable() decides at runtime which one
+    a processor uses.
+
+    Also the wavetable lookup the LFO, the grain windows and the pitch
+    shifter's window share, and the conversions to and from the half-float
+    samples of compact delay memory. SIMDRegister has no integer shifts or
+    conversions, so their SIMD versions use F16C where the CPU has it, SSE2
+    on other x86 CPUs, and the scalar loops elsewhere. All three give the
+    same bits for any number.
+
+    None of these loops depends on its own output, which is what the
+    chunking in processBlock guarantees: a chunk is always shorter than the
+    delay, so the samples it reads were written before it started. The
+    feedback shaper's one-poles are the exception. They are recursive along
+    time and have only the scalar version.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_USE_SIMD && JUCE_INTEL
+ #include <immintrin.h>
+
+ // F16C code is compiled for that instruction set alone and only called
+ // once the CPU has been checked
+ #if JUCE_MSVC
+  #define DELAY_KERNELS_F16C
+ #else
+  #define DELAY_KERNELS_F16C __attribute__ ((target ("avx,f16c")))
+ #endif
+#endif
+
+namespace DelayKernels
+{
+    //==============================================================================
+    // scalar
+
+    // ramps are evaluated as start + increment * (offset + i + 1) for every
+    // sample, never accumulated, so a sample gets the same value whichever
+    // chunk or lane computes it. the products are kept in their own
+    // statements so the compiler doesn't fuse them into a multiply-add the
+    // SIMD versions don't use
+
+    /** The value of a ramp at index: start + increment * index. */
+    template <typename Sample>
+    inline Sample getRampValue (Sample start, Sample increment, int index) noexcept
+    {
+        const Sample step = increment * (Sample) index;
+        return start + step;
+    }
+
+    /** Reads a table of (1 << kTableBits) + 1 points at a 32-bit phase, one
+        cycle per wrap, blending linearly between the nearest two. The top
+        bits of the phase pick the point and the rest the blend, so no index
+        ever needs wrapping or clamping.
+    */
+    template <int kTableBits>
+    inline float lookUpTable (const float* table, juce::uint32 phase) noexcept
+    {
+        constexpr int kFractionBits = 32 - kTableBits;
+        constexpr juce::uint32 kFractionMask = (1u << kFractionBits) - 1u;
+        constexpr float kFractionScale = 1.0f / (float) (1u << kFractionBits);
+
+        const juce::uint32 index = phase >> kFractionBits;
+        const float fraction = (float) (int) (phase & kFractionMask) * kFractionScale;
+        const float step = fraction * (table[index + 1] - table[index]);
+        return table[index] + step;
+    }
+
+    /** dest[i] = sum over k of c[k] * x[i + k]. Used for constant-delay reads,
+        where every output sample shares one set of interpolation coefficients.
+    */
+    template <int kTaps, typename Sample>
+    inline void firScalar (Sample* dest, const Sample* x, int numSamples, const Sample* c) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            Sample sum = c[0] * x[i];
+
+            for (int k = 1; k < kTaps; ++k)
+            {
+                const Sample product = c[k] * x[i + k];
+                sum += product;
+            }
+
+            dest[i] = sum;
+        }
+    }
+
+    /** dest[i] = input[i] + wet[i - 1] * gain(offset + i), with dest[0] = input[0] + carry.
+        gain(n) = gainStart + gainIncrement * n
+    */
+    template <typename Sample>
+    inline void feedScalar (Sample* dest, const Sample* input, const Sample* wet, Sample carry,
+                            int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        dest[0] = input[0] + carry;
+
+        for (int i = 1; i < numSamples; ++i)
+        {
+            const Sample feedback = wet[i - 1] * getRampValue (gainStart, gainIncrement, offset + i);
+            dest[i] = input[i] + feedback;
+        }
+    }
+
+    /** dest[i] = input[i] + x[i] * gain(offset + i + 1), gain(n) = gainStart + gainIncrement * n.
+        The feedback network's write, where the feedback has no extra sample of delay.
+    */
+    template <typename Sample>
+    inline void addScaledScalar (Sample* dest, const Sample* input, const Sample* x,
+                                 int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const Sample feedback = x[i] * getRampValue (gainStart, gainIncrement, offset + i + 1);
+            dest[i] = input[i] + feedback;
+        }
+    }
+
+    /** The 2-point Hadamard transform in place, sample by sample: (a, b) -> (a + b, a - b). */
+    template <typename Sample>
+    inline void hadamard2Scalar (Sample* a, Sample* b, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const Sample sum = a[i] + b[i];
+            const Sample difference = a[i] - b[i];
+            a[i] = sum;
+            b[i] = difference;
+        }
+    }
+
+    /** The 4-point Hadamard transform in place, sample by sample: two
+        stages of hadamard2 in one pass, so each sample is loaded and stored
+        once rather than twice.
+    */
+    template <typename Sample>
+    inline void hadamard4Scalar (Sample* a, Sample* b, Sample* c, Sample* d, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const Sample ab = a[i] + b[i];
+            const Sample aMinusB = a[i] - b[i];
+            const Sample cd = c[i] + d[i];
+            const Sample cMinusD = c[i] - d[i];
+            a[i] = ab + cd;
+            b[i] = aMinusB + cMinusD;
+            c[i] = ab - cd;
+            d[i] = aMinusB - cMinusD;
+        }
+    }
+
+    /** Topology-preserving one-poles, one per channel, in place: v = (x -
+        s) * coefficient, low = v + s, s = low + v, and the output is low,
+        or x - low for the low cut. states holds each channel's s.
+    */
+    template <bool kIsLowCut, typename Sample>
+    inline void onePoleScalar (Sample* const* io, int numChannels, int numSamples, Sample coefficient, Sample* states) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            Sample* const data = io[channel];
+            Sample s = states[channel];
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const Sample v = (data[i] - s) * coefficient;
+                const Sample low = v + s;
+                s = low + v;
+                data[i] = kIsLowCut ? data[i] - low : low;
+            }
+
+            states[channel] = s;
+        }
+    }
+
+    /** io[i] = io[i] * gain(offset + i + 1), gain(n) = gainStart + gainIncrement * n */
+    template <typename Sample>
+    inline void gainScalar (Sample* io, int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            io[i] = io[i] * getRampValue (gainStart, gainIncrement, offset + i + 1);
+    }
+
+    /** io[i] = io[i] + mix(i) * (wet[i] - io[i]), mix(i) = mixStart + mixIncrement * (offset + i + 1) */
+    template <typename Sample>
+    inline void mixScalar (Sample* io, const Sample* wet, int numSamples, Sample mixStart, Sample mixIncrement, int offset) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const Sample mix = getRampValue (mixStart, mixIncrement, offset + i + 1);
+            const Sample wetPart = mix * (wet[i] - io[i]);
+            io[i] = io[i] + wetPart;
+        }
+    }
+
+    /** Tape-style saturation, blended in by amount:
+        io[i] = io[i] + amount * (shape(gain * io[i]) / gain - io[i]),
+        shape(u) = u - 4/27 u^3 with u held to +-1.5. The curve leaves zero
+        with a slope of one and flattens out at +-1, so quiet signals pass at
+        unity gain whatever the drive and only the peaks are squashed.
+    */
+    template <typename Sample>
+    inline void saturateScalar (Sample* io, int numSamples, Sample amount, Sample gain, Sample inverseGain) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const Sample u = juce::jlimit (Sample (-1.5), Sample (1.5), gain * io[i]);
+            const Sample cube = u * u * u;
+            const Sample bend = Sample (4.0 / 27.0) * cube;
+            const Sample shaped = (u - bend) * inverseGain;
+            const Sample blend = amount * (shaped - io[i]);
+            io[i] = io[i] + blend;
+        }
+    }
+
+    //==============================================================================
+    // half floats
+
+    // IEEE binary16: 11 bits of precision, so about 66 dB below the signal
+    // itself, whatever its level. subnormals are kept, which takes the floor
+    // down to 2^-24 (-144 dBFS). nothing is ever rounded to infinity: values
+    // past the largest half saturate there, so a runaway feedback loop stays
+    // finite. each sample converts on its own, so the result never depends
+    // on how a write was split up
+
+    static constexpr juce::uint32 kHalfMaxBits = 0x477fe000u;       // 65504, the largest half, as float bits
+    static constexpr juce::uint32 kHalfMinNormalBits = 0x38800000u; // 2^-14, the smallest normal half
+    static constexpr juce::uint32 kHalfSubnormalMagic = 0x3f000000u; // 0.5f, see toHalf
+    static constexpr juce::uint32 kHalfRebias = 0xc8000fffu;        // exponent 127 -> 15, plus rounding
+    static constexpr juce::uint16 kHalfMax = 0x7bff;
+
+    inline juce::uint16 toHalf (float value) noexcept
+    {
+        juce::uint32 bits;
+        std::memcpy (&bits, &value, sizeof (bits));
+
+        const juce::uint32 sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        juce::uint32 half;
+
+        if (bits >= kHalfMaxBits)
+        {
+            half = kHalfMax;
+        }
+        else if (bits < kHalfMinNormalBits)
+        {
+            // adding 0.5 lines the mantissa up with a half's subnormal
+            // mantissa, and the FPU rounds it to nearest even
+            float magnitude;
+            std::memcpy (&magnitude, &bits, sizeof (magnitude));
+            magnitude += 0.5f;
+            std::memcpy (&bits, &magnitude, sizeof (bits));
+            half = bits - kHalfSubnormalMagic;
+        }
+        else
+        {
+            // rebias the exponent and round the mantissa to nearest even
+            half = (bits + kHalfRebias + ((bits >> 13) & 1u)) >> 13;
+        }
+
+        return (juce::uint16) (half | (sign >> 16));
+    }
+
+    inline float fromHalf (juce::uint16 half) noexcept
+    {
+        const juce::uint32 magnitude = half & 0x7fffu;
+        juce::uint32 bits;
+
+        if (magnitude < 0x0400u)
+        {
+            // subnormal: the mantissa times 2^-24, exact in float
+            const float value = (float) (int) magnitude * (1.0f / 16777216.0f);
+            std::memcpy (&bits, &value, sizeof (bits));
+        }
+        else
+        {
+            bits = (magnitude << 13) + 0x38000000u;
+        }
+
+        bits |= (juce::uint32) (half & 0x8000u) << 16;
+
+        float value;
+        std::memcpy (&value, &bits, sizeof (value));
+        return value;
+    }
+
+    inline void toHalfScalar (juce::uint16* dest, const float* source, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = toHalf (source[i]);
+    }
+
+    inline void fromHalfScalar (float* dest, const juce::uint16* source, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = fromHalf (source[i]);
+    }
+
+    //==============================================================================
+    // SIMD
+   #if JUCE_USE_SIMD
+    template <typename Sample>
+    using SimdRegister = juce::dsp::SIMDRegister<Sample>;
+
+    template <typename Sample>
+    constexpr int kNumLanes = (int) SimdRegister<Sample>::SIMDNumElements;
+
+    // SIMDRegister::fromRawArray needs aligned memory; delay reads and host
+    // buffers are not, so go through memcpy, which compiles to an unaligned
+    // load or store
+    template <typename Sample>
+    inline SimdRegister<Sample> loadUnaligned (const Sample* source) noexcept
+    {
+        SimdRegister<Sample> v;
+        std::memcpy (&v.value, source, sizeof (v.value));
+        return v;
+    }
+
+    template <typename Sample>
+    inline void storeUnaligned (Sample* dest, SimdRegister<Sample> v) noexcept
+    {
+        std::memcpy (dest, &v.value, sizeof (v.value));
+    }
+
+    /** Ramp indices firstIndex + i for lane i. Whole numbers stay exact in
+        float, so stepping these is exact where stepping the ramp isn't.
+    */
+    template <typename Sample>
+    inline SimdRegister<Sample> makeIndices (int firstIndex) noexcept
+    {
+        alignas (sizeof (SimdRegister<Sample>)) Sample lanes[kNumLanes<Sample>];
+
+        for (int i = 0; i < kNumLanes<Sample>; ++i)
+            lanes[i] = (Sample) (firstIndex + i);
+
+        return SimdRegister<Sample>::fromRawArray (lanes);
+    }
+
+    template <int kTaps, typename Sample>
+    inline void firSimd (Sample* dest, const Sample* x, int numSamples, const Sample* c) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+        Vec coefficients[kTaps];
+
+        for (int k = 0; k < kTaps; ++k)
+            coefficients[k] = Vec::expand (c[k]);
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            Vec sum = coefficients[0] * loadUnaligned (x + i);
+
+            for (int k = 1; k < kTaps; ++k)
+                sum += coefficients[k] * loadUnaligned (x + i + k);
+
+            storeUnaligned (dest + i, sum);
+        }
+
+        firScalar<kTaps> (dest + numVectorised, x + numVectorised, numSamples - numVectorised, c);
+    }
+
+    template <typename Sample>
+    inline void feedSimd (Sample* dest, const Sample* input, const Sample* wet, Sample carry,
+                          int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        dest[0] = input[0] + carry;
+
+        // lanes cover samples 1 .. numVectorised, reading wet one sample behind
+        const int numVectorised = (numSamples - 1) - (numSamples - 1) % kVecSize;
+        const Vec start = Vec::expand (gainStart);
+        const Vec increment = Vec::expand (gainIncrement);
+        const Vec indexStep = Vec::expand ((Sample) kVecSize);
+        Vec indices = makeIndices<Sample> (offset + 1);
+
+        for (int i = 1; i <= numVectorised; i += kVecSize)
+        {
+            const Vec gain = start + increment * indices;
+            storeUnaligned (dest + i, loadUnaligned (input + i) + loadUnaligned (wet + i - 1) * gain);
+            indices += indexStep;
+        }
+
+        for (int i = numVectorised + 1; i < numSamples; ++i)
+        {
+            const Sample feedback = wet[i - 1] * getRampValue (gainStart, gainIncrement, offset + i);
+            dest[i] = input[i] + feedback;
+        }
+    }
+
+    template <typename Sample>
+    inline void hadamard2Simd (Sample* a, Sample* b, int numSamples) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            const Vec x = loadUnaligned (a + i);
+            const Vec y = loadUnaligned (b + i);
+            storeUnaligned (a + i, x + y);
+            storeUnaligned (b + i, x - y);
+        }
+
+        hadamard2Scalar (a + numVectorised, b + numVectorised, numSamples - numVectorised);
+    }
+
+    template <typename Sample>
+    inline void hadamard4Simd (Sample* a, Sample* b, Sample* c, Sample* d, int numSamples) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            const Vec w = loadUnaligned (a + i);
+            const Vec x = loadUnaligned (b + i);
+            const Vec y = loadUnaligned (c + i);
+            const Vec z = loadUnaligned (d + i);
+            const Vec wx = w + x;
+            const Vec wMinusX = w - x;
+            const Vec yz = y + z;
+            const Vec yMinusZ = y - z;
+            storeUnaligned (a + i, wx + yz);
+            storeUnaligned (b + i, wMinusX + yMinusZ);
+            storeUnaligned (c + i, wx - yz);
+            storeUnaligned (d + i, wMinusX - yMinusZ);
+        }
+
+        hadamard4Scalar (a + numVectorised, b + numVectorised, c + numVectorised, d + numVectorised,
+                         numSamples - numVectorised);
+    }
+
+    template <typename Sample>
+    inline void addScaledSimd (Sample* dest, const Sample* input, const Sample* x,
+                               int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+        const Vec start = Vec::expand (gainStart);
+        const Vec increment = Vec::expand (gainIncrement);
+        const Vec indexStep = Vec::expand ((Sample) kVecSize);
+        Vec indices = makeIndices<Sample> (offset + 1);
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            const Vec gain = start + increment * indices;
+            storeUnaligned (dest + i, loadUnaligned (input + i) + loadUnaligned (x + i) * gain);
+            indices += indexStep;
+        }
+
+        addScaledScalar (dest + numVectorised, input + numVectorised, x + numVectorised, numSamples - numVectorised,
+                         gainStart, gainIncrement, offset + numVectorised);
+    }
+
+    template <typename Sample>
+    inline void gainSimd (Sample* io, int numSamples, Sample gainStart, Sample gainIncrement, int offset) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+        const Vec start = Vec::expand (gainStart);
+        const Vec increment = Vec::expand (gainIncrement);
+        const Vec indexStep = Vec::expand ((Sample) kVecSize);
+        Vec indices = makeIndices<Sample> (offset + 1);
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            storeUnaligned (io + i, loadUnaligned (io + i) * (start + increment * indices));
+            indices += indexStep;
+        }
+
+        gainScalar (io + numVectorised, numSamples - numVectorised, gainStart, gainIncrement, offset + numVectorised);
+    }
+
+    template <typename Sample>
+    inline void mixSimd (Sample* io, const Sample* wet, int numSamples, Sample mixStart, Sample mixIncrement, int offset) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+        const Vec start = Vec::expand (mixStart);
+        const Vec increment = Vec::expand (mixIncrement);
+        const Vec indexStep = Vec::expand ((Sample) kVecSize);
+        Vec indices = makeIndices<Sample> (offset + 1);
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            const Vec mix = start + increment * indices;
+            const Vec dry = loadUnaligned (io + i);
+            storeUnaligned (io + i, dry + mix * (loadUnaligned (wet + i) - dry));
+            indices += indexStep;
+        }
+
+        mixScalar (io + numVectorised, wet + numVectorised, numSamples - numVectorised,
+                   mixStart, mixIncrement, offset + numVectorised);
+    }
+
+    template <typename Sample>
+    inline void saturateSimd (Sample* io, int numSamples, Sample amount, Sample gain, Sample inverseGain) noexcept
+    {
+        constexpr int kVecSize = kNumLanes<Sample>;
+        using Vec = SimdRegister<Sample>;
+
+        const int numVectorised = numSamples - numSamples % kVecSize;
+        const Vec low = Vec::expand (Sample (-1.5));
+        const Vec high = Vec::expand (Sample (1.5));
+        const Vec bendFactor = Vec::expand (Sample (4.0 / 27.0));
+        const Vec amounts = Vec::expand (amount);
+        const Vec gains = Vec::expand (gain);
+        const Vec inverseGains = Vec::expand (inverseGain);
+
+        for (int i = 0; i < numVectorised; i += kVecSize)
+        {
+            const Vec x = loadUnaligned (io + i);
+            const Vec u = Vec::max (low, Vec::min (high, gains * x));
+            const Vec shaped = (u - bendFactor * (u * u * u)) * inverseGains;
+            storeUnaligned (io + i, x + amounts * (shaped - x));
+        }
+
+        saturateScalar (io + numVectorised, numSamples - numVectorised, amount, gain, inverseGain);
+    }
+
+   #if JUCE_INTEL
+    /** toHalf for four floats, as four 32-bit lanes ready for _mm_packs_epi32. */
+    inline __m128i toHalfLanes (__m128 value) noexcept
+    {
+        const __m128i bits = _mm_castps_si128 (value);
+        const __m128i sign = _mm_and_si128 (bits, _mm_set1_epi32 ((int) 0x80000000u));
+        const __m128i magnitude = _mm_xor_si128 (bits, sign);
+
+        const __m128i isSaturated = _mm_cmpgt_epi32 (magnitude, _mm_set1_epi32 ((int) kHalfMaxBits - 1));
+        const __m128i isSubnormal = _mm_cmpgt_epi32 (_mm_set1_epi32 ((int) kHalfMinNormalBits), magnitude);
+
+        const __m128 magic = _mm_castsi128_ps (_mm_set1_epi32 ((int) kHalfSubnormalMagic));
+        const __m128i subnormal = _mm_sub_epi32 (_mm_castps_si128 (_mm_add_ps (_mm_castsi128_ps (magnitude), magic)),
+                                                 _mm_castps_si128 (magic));
+
+        const __m128i mantissaOdd = _mm_and_si128 (_mm_srli_epi32 (magnitude, 13), _mm_set1_epi32 (1));
+        const __m128i normal = _mm_srli_epi32 (_mm_add_epi32 (_mm_add_epi32 (magnitude, _mm_set1_epi32 ((int) kHalfRebias)), mantissaOdd), 13);
+
+        __m128i half = _mm_or_si128 (_mm_and_si128 (isSubnormal, subnormal), _mm_andnot_si128 (isSubnormal, normal));
+        half = _mm_or_si128 (_mm_and_si128 (isSaturated, _mm_set1_epi32 (kHalfMax)), _mm_andnot_si128 (isSaturated, half));
+
+        // the sign shifted arithmetically, so negative halves are negative
+        // 32-bit lanes and the signed pack keeps their bits
+        return _mm_or_si128 (half, _mm_srai_epi32 (sign, 16));
+    }
+
+    /** fromHalf for four halves in 32-bit lanes. */
+    inline __m128 fromHalfLanes (__m128i half) noexcept
+    {
+        const __m128i magnitude = _mm_and_si128 (half, _mm_set1_epi32 (0x7fff));
+        const __m128i sign = _mm_slli_epi32 (_mm_xor_si128 (half, magnitude), 16);
+
+        const __m128i isSubnormal = _mm_cmpgt_epi32 (_mm_set1_epi32 (0x0400), magnitude);
+        const __m128i subnormal = _mm_castps_si128 (_mm_mul_ps (_mm_cvtepi32_ps (magnitude), _mm_set1_ps (1.0f / 16777216.0f)));
+        const __m128i normal = _mm_add_epi32 (_mm_slli_epi32 (magnitude, 13), _mm_set1_epi32 (0x38000000));
+
+        const __m128i bits = _mm_or_si128 (_mm_and_si128 (isSubnormal, subnormal), _mm_andnot_si128 (isSubnormal, normal));
+        return _mm_castsi128_ps (_mm_or_si128 (bits, sign));
+    }
+
+    /** The hardware conversions, which round the same way toHalf does.
+        Inputs are clamped first, as the hardware would round past the
+        largest half to infinity.
+    */
+    DELAY_KERNELS_F16C inline int toHalfF16C (juce::uint16* dest, const float* source, int numSamples) noexcept
+    {
+        const __m256 largest = _mm256_set1_ps (65504.0f);
+        int done = 0;
+
+        for (; done + 8 <= numSamples; done += 8)
+        {
+            const __m256 clamped = _mm256_max_ps (_mm256_min_ps (_mm256_loadu_ps (source + done), largest), _mm256_sub_ps (_mm256_setzero_ps(), largest));
+            _mm_storeu_si128 (reinterpret_cast<__m128i*> (dest + done), _mm256_cvtps_ph (clamped, _MM_FROUND_TO_NEAREST_INT));
+        }
+
+        return done;
+    }
+
+    DELAY_KERNELS_F16C inline int fromHalfF16C (float* dest, const juce::uint16* source, int numSamples) noexcept
+    {
+        int done = 0;
+
+        for (; done + 8 <= numSamples; done += 8)
+            _mm256_storeu_ps (dest + done, _mm256_cvtph_ps (_mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + done))));
+
+        return done;
+    }
+
+    /** F16C came in alongside AVX, and every CPU with AVX2 has it. */
+    inline bool hasF16C()
+    {
+        static const bool hasIt = juce::SystemStats::hasAVX2();
+        return hasIt;
+    }
+   #endif
+
+    /** toHalfScalar, eight samples at a time where there is F16C or SSE2. */
+    inline void toHalfSimd (juce::uint16* dest, const float* source, int numSamples) noexcept
+    {
+        int done = 0;
+
+       #if JUCE_INTEL
+        if (hasF16C())
+            done = toHalfF16C (dest, source, numSamples);
+
+        for (; done + 8 <= numSamples; done += 8)
+        {
+            const __m128i low = toHalfLanes (_mm_loadu_ps (source + done));
+            const __m128i high = toHalfLanes (_mm_loadu_ps (source + done + 4));
+            _mm_storeu_si128 (reinterpret_cast<__m128i*> (dest + done), _mm_packs_epi32 (low, high));
+        }
+       #endif
+
+        toHalfScalar (dest + done, source + done, numSamples - done);
+    }
+
+    /** fromHalfScalar, eight samples at a time where there is F16C or SSE2. */
+    inline void fromHalfSimd (float* dest, const juce::uint16* source, int numSamples) noexcept
+    {
+        int done = 0;
+
+       #if JUCE_INTEL
+        if (hasF16C())
+            done = fromHalfF16C (dest, source, numSamples);
+
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; done + 8 <= numSamples; done += 8)
+        {
+            const __m128i halves = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (source + done));
+            _mm_storeu_ps (dest + done, fromHalfLanes (_mm_unpacklo_epi16 (halves, zero)));
+            _mm_storeu_ps (dest + done + 4, fromHalfLanes (_mm_unpackhi_epi16 (halves, zero)));
+        }
+       #endif
+
+        fromHalfScalar (dest + done, source + done, numSamples - done);
+    }
+   #endif
+
+    //==============================================================================
+    /** True when this build has SIMDRegister support and the CPU it is running
+        on has the matching instruction set.
+    */
+    inline bool isSimdAvailable()
+    {
+       #if JUCE_USE_SIMD
+        #if JUCE_INTEL
+         return juce::SystemStats::hasSSE2();
+        #elif JUCE_ARM
+         return juce::SystemStats::hasNeon();
+        #else
+         return false;
+        #endif
+       #else
+        return false;
+       #endif
+    }
+}
@@ -0,0 +1,506 @@
+/*
+  ==============================================================================
+
+    DelayLine.h
+
+    Multi-channel circular buffer with a power-of-two length and a shared
+    write position. The interpolator is a template argument of read(), see
+    Interpolators.h. Reads and writes work on whole runs of samples:
+    positions are wrapped with a mask and runs are split where they cross
+    the end of a page of DelayMemory, so the inner loops carry no wrap-around
+    branches. The guard samples in DelayMemory let interpolation read past
+    the end of a page without looking up the next one.
+
+    The line can be minutes long. Memory is only committed for the history
+    the delay times reach, which the owner sets with setRetainedLength().
+
+    Reads and writes are templates on the sample type, float or double, and
+    work with memory in any format. Where the memory holds another type,
+    writes convert straight into it and reads convert the samples they need
+    back into a small stack buffer, then run the same interpolation over it.
+    That is how the compact format works, and how a double-precision
+    processor would use float memory.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "DelayMemory.h"
+#include "DelayKernels.h"
+#include "Interpolators.h"
+
+//==============================================================================
+class DelayLine
+{
+public:
+    /** Sizes the line for numChannels channels of at least minimumLength
+        samples (rounded up to a power of two).
+
+        Nothing is reallocated when the size hasn't changed. Otherwise the
+        recent history is carried over into the new memory, stretched by
+        resampleRatio (new sample rate over old), so a rate change keeps the
+        tail that was ringing out, and so does a change of format. Call
+        clear() to start from silence.
+
+        This allocates, so it belongs in prepareToPlay, never in processBlock.
+        It only allocates the page table and whatever history is carried
+        over, so it takes the same time however long the line is.
+    */
+    void prepare (int numChannels, int minimumLength, double resampleRatio = 1.0,
+                  DelayMemory::Format format = DelayMemory::Format::float32)
+    {
+        const int length = juce::nextPowerOfTwo (juce::jmax (2, minimumLength));
+
+        if (numChannels != mMemory.getNumChannels() || length != mLength || resampleRatio != 1.0
+             || format != mMemory.getFormat())
+        {
+            if (mLength > 0)
+            {
+                DelayMemory next;
+                next.allocate (numChannels, length, format);
+                next.resampleFrom (mMemory, mWriteIndex, resampleRatio);
+                mMemory.swapWith (next);
+            }
+            else
+            {
+                mMemory.allocate (numChannels, length, format);
+            }
+
+            mLength = length;
+            mMask = length - 1;
+            mPageSamples = mMemory.getPageSamples();
+            mPageShift = mMemory.getPageShift();
+            mPageMask = mPageSamples - 1;
+            mWriteIndex = 0;
+        }
+
+        if (numChannels != mNumStates)
+        {
+            mThiranStates.allocate ((size_t) numChannels * kMaxStreams, true);
+            mNumStates = numChannels;
+        }
+    }
+
+    void clear()
+    {
+        mMemory.clear();
+        mWriteIndex = 0;
+
+        for (int i = 0; i < mNumStates * kMaxStreams; ++i)
+            mThiranStates[i].reset();
+    }
+
+    /** Lets the line allocate pages on the audio thread while rendering
+        offline, see DelayMemory::setNonRealtime.
+    */
+    void setNonRealtime (bool isNonRealtime) noexcept   { mMemory.setNonRealtime (isNonRealtime); }
+
+    /** Selects the SIMD or scalar kernels for reads. */
+    void setUseSimd (bool shouldUseSimd)  { mUseSimd = shouldUseSimd; }
+
+    /** Reads of one channel that run side by side, at different delays.
+        Each has its own state for recursive interpolators, which would
+        otherwise carry one read's output into the next.
+    */
+    static constexpr int kMaxStreams = 3;
+
+    /** Starts a stream's recursive interpolator state again from rest, on
+        every channel. For when a stream starts or stops reading.
+    */
+    void resetStream (int stream) noexcept
+    {
+        jassert (juce::isPositiveAndBelow (stream, kMaxStreams));
+
+        for (int channel = 0; channel < mNumStates; ++channel)
+            mThiranStates[channel * kMaxStreams + stream].reset();
+    }
+
+    int getNumChannels() const                  { return mMemory.getNumChannels(); }
+    int getLength() const                       { return mLength; }
+    int getWriteIndex() const                   { return mWriteIndex; }
+    DelayMemory::Format getFormat() const       { return mMemory.getFormat(); }
+    size_t getAllocatedBytes() const            { return mMemory.getAllocatedBytes(); }
+
+    /** Sets how far back reads will reach, in samples, from now until it is
+        set again. History older than that is handed back and reads as
+        silence from then on. Audio thread; lines keep everything until told
+        otherwise.
+    */
+    void setRetainedLength (int numSamples) noexcept
+    {
+        // interpolators read a few samples either side of the delay
+        mMemory.setRetainedLength (numSamples + DelayMemory::kGuardSamples);
+    }
+
+    /** How far back the line can still hold anything but silence. */
+    int getHistoryLength() const noexcept       { return mMemory.getHistoryLength(); }
+
+    /** How far past the integer read position an interpolator reads. A chunk
+        must end this many samples before the shortest delay in it.
+    */
+    template <typename Interpolator>
+    static constexpr int getReadAhead()     { return Interpolator::kTaps - Interpolator::kBefore - 1; }
+
+    //==============================================================================
+    /** Reads numSamples interpolated samples, one per sample period, relative
+        to the current write position.
+
+        Sample i is read delayStart + delayIncrement * (offset + i + 1) samples
+        behind the position it would be written to. The caller must keep
+        numSamples below the smallest delay in the run minus getReadAhead(),
+        so that nothing read here is written before the next advance().
+
+        The fraction only depends on the delay, never on the write position,
+        so a sample reads the same value however the calls are split.
+
+        Sample is float or double. Memory in another format is converted as
+        it is read. Reads of the same channel at different delays must each
+        use a stream of their own.
+    */
+    template <typename Interpolator, typename Sample>
+    void read (int channel, Sample* dest, int numSamples, double delayStart, double delayIncrement, int offset,
+               int stream = 0)
+    {
+        switch (mMemory.getFormat())
+        {
+            case DelayMemory::Format::float16:
+                readFrom<Interpolator, juce::uint16> (channel, dest, numSamples, delayStart, delayIncrement, offset, stream);
+                break;
+
+            case DelayMemory::Format::float64:
+                readFrom<Interpolator, double> (channel, dest, numSamples, delayStart, delayIncrement, offset, stream);
+                break;
+
+            case DelayMemory::Format::float32:
+            default:
+                readFrom<Interpolator, float> (channel, dest, numSamples, delayStart, delayIncrement, offset, stream);
+                break;
+        }
+    }
+
+    /** Reads numSamples interpolated samples with a delay of their own:
+        sample i is read delays[i] samples behind the position it would be
+        written to. This is how modulation moves the heads. The same limits
+        as read() apply, for the shortest of the delays, and so do streams.
+    */
+    template <typename Interpolator, typename Sample>
+    void readModulated (int channel, Sample* dest, int numSamples, const double* delays, int stream = 0)
+    {
+        auto getDelay = [delays] (int i) { return delays[i]; };
+
+        switch (mMemory.getFormat())
+        {
+            case DelayMemory::Format::float16:
+                readMoving<Interpolator, juce::uint16> (channel, dest, numSamples, getDelay, stream);
+                break;
+
+            case DelayMemory::Format::float64:
+                readMoving<Interpolator, double> (channel, dest, numSamples, getDelay, stream);
+                break;
+
+            case DelayMemory::Format::float32:
+            default:
+                readMoving<Interpolator, float> (channel, dest, numSamples, getDelay, stream);
+                break;
+        }
+    }
+
+    /** Writes numSamples to a channel at the write position. The position
+        moves on once every channel has been written, with advance().
+
+        A page the write position enters is committed from the spares the
+        background thread keeps ready. If it has fallen so far behind that
+        there are none, the samples are dropped and later read as silence.
+    */
+    template <typename Sample>
+    void write (int channel, const Sample* source, int numSamples)
+    {
+        switch (mMemory.getFormat())
+        {
+            case DelayMemory::Format::float16:  writeTo<juce::uint16> (channel, source, numSamples); break;
+            case DelayMemory::Format::float64:  writeTo<double> (channel, source, numSamples); break;
+            case DelayMemory::Format::float32:
+            default:                            writeTo<float> (channel, source, numSamples); break;
+        }
+    }
+
+    /** Moves the write position on. History that falls out of the retained
+        length is handed back here.
+    */
+    void advance (int numSamples)
+    {
+        mWriteIndex = (mWriteIndex + numSamples) & mMask;
+        mMemory.setWritePosition (mWriteIndex);
+    }
+
+private:
+    /** Samples a constant-delay read from memory in another format converts
+        at a time, on the stack.
+    */
+    static constexpr int kConvertSamples = 256;
+
+    /** read(), from memory that stores Stored samples. */
+    template <typename Interpolator, typename Stored, typename Sample>
+    void readFrom (int channel, Sample* dest, int numSamples, double delayStart, double delayIncrement, int offset,
+                   int stream)
+    {
+        constexpr bool isConverted = ! std::is_same_v<Stored, Sample>;
+        const int mask = mMask;
+        auto& state = getState (static_cast<typename Interpolator::State*> (nullptr), channel, stream);
+
+        if (delayIncrement == 0.0)
+        {
+            // constant delay: every read is one sample further along, so the
+            // run is contiguous and only needs splitting where it leaves a
+            // page. the guard covers taps that run past the page's last sample
+            const int wholeDelay = getWholeDelay (delayStart);
+            const Sample fraction = (Sample) ((double) wholeDelay - delayStart);
+
+            Sample coefficients[Interpolator::kTaps] = {};
+
+            if constexpr (! Interpolator::kIsRecursive)
+                Interpolator::getCoefficients (fraction, coefficients);
+
+            int index = (mWriteIndex - wholeDelay - Interpolator::kBefore) & mask;
+            int done = 0;
+
+            while (done < numSamples)
+            {
+                const int page = index >> mPageShift;
+                const int offsetInPage = index & mPageMask;
+                const int run = juce::jmin (numSamples - done, mPageSamples - offsetInPage);
+                const Stored* const data = getPage (static_cast<const Stored*> (nullptr), channel, page) + offsetInPage;
+
+                if constexpr (isConverted)
+                {
+                    // convert a piece at a time, with the taps that run past
+                    // its end, and interpolate from the converted copy
+                    Sample converted[kConvertSamples + Interpolator::kTaps];
+
+                    for (int piece = 0; piece < run; piece += kConvertSamples)
+                    {
+                        const int length = juce::jmin (kConvertSamples, run - piece);
+
+                        if constexpr (std::is_same_v<Interpolator, Interpolators::None>)
+                        {
+                            convert (dest + done + piece, data + piece, length);
+                        }
+                        else
+                        {
+                            convert (converted, data + piece, length + Interpolator::kTaps - 1);
+                            interpolateRun<Interpolator> (dest + done + piece, converted, length, fraction, coefficients, state);
+                        }
+                    }
+                }
+                else if constexpr (std::is_same_v<Interpolator, Interpolators::None>)
+                {
+                    // whole-sample reads are plain copies
+                    std::copy (data, data + run, dest + done);
+                }
+                else
+                {
+                    interpolateRun<Interpolator> (dest + done, data, run, fraction, coefficients, state);
+                }
+
+                done += run;
+                index = (index + run) & mask;
+            }
+
+            return;
+        }
+
+        readMoving<Interpolator, Stored> (channel, dest, numSamples,
+                                          [delayStart, delayIncrement, offset] (int i)
+                                          {
+                                              return delayStart + delayIncrement * (double) (offset + i + 1);
+                                          },
+                                          stream);
+    }
+
+    /** Reads where the delay changes from sample to sample, getDelay (i)
+        being sample i's. The read position drifts against the write
+        position, but while the whole delay holds still the reads are
+        consecutive, so each such stretch finds its page once. The guard
+        covers taps that run past the page's last sample.
+    */
+    template <typename Interpolator, typename Stored, typename Sample, typename DelayFunction>
+    void readMoving (int channel, Sample* dest, int numSamples, DelayFunction getDelay, int stream)
+    {
+        constexpr bool isConverted = ! std::is_same_v<Stored, Sample>;
+        const int mask = mMask;
+        auto& state = getState (static_cast<typename Interpolator::State*> (nullptr), channel, stream);
+
+        double delay = getDelay (0);
+
+        for (int i = 0; i < numSamples;)
+        {
+            const int wholeDelay = getWholeDelay (delay);
+            const int index = (mWriteIndex + i - wholeDelay - Interpolator::kBefore) & mask;
+            const int offsetInPage = index & mPageMask;
+            const int end = i + juce::jmin (numSamples - i, mPageSamples - offsetInPage);
+            const Stored* const taps = getPage (static_cast<const Stored*> (nullptr), channel, index >> mPageShift) + offsetInPage;
+            const int first = i;
+
+            do
+            {
+                const Sample fraction = (Sample) ((double) wholeDelay - delay);
+
+                if constexpr (isConverted)
+                {
+                    Sample x[Interpolator::kTaps];
+
+                    for (int k = 0; k < Interpolator::kTaps; ++k)
+                        x[k] = convertSample<Sample> (taps[i - first + k]);
+
+                    dest[i] = Interpolator::interpolate (x, fraction, state);
+                }
+                else
+                {
+                    dest[i] = Interpolator::interpolate (taps + (i - first), fraction, state);
+                }
+
+                if (++i < numSamples)
+                    delay = getDelay (i);
+            }
+            while (i < end && getWholeDelay (delay) == wholeDelay);
+        }
+    }
+
+    /** write(), to memory that stores Stored samples. */
+    template <typename Stored, typename Sample>
+    void writeTo (int channel, const Sample* source, int numSamples)
+    {
+        int index = mWriteIndex;
+        int done = 0;
+
+        while (done < numSamples)
+        {
+            const int page = index >> mPageShift;
+            const int offsetInPage = index & mPageMask;
+            const int run = juce::jmin (numSamples - done, mPageSamples - offsetInPage);
+
+            if (auto* data = getPageForWriting (static_cast<Stored*> (nullptr), channel, page, offsetInPage))
+            {
+                if constexpr (std::is_same_v<Stored, Sample>)
+                    std::copy (source + done, source + done + run, data + offsetInPage);
+                else
+                    convert (data + offsetInPage, source + done, run);
+            }
+
+            mMemory.updateGuard (channel, page, offsetInPage, run);
+
+            done += run;
+            index = (index + run) & mMask;
+        }
+    }
+
+    /** Interpolates a contiguous run with one fraction: in order for
+        recursive policies, otherwise as a fixed-coefficient FIR.
+    */
+    template <typename Interpolator, typename Sample>
+    void interpolateRun (Sample* dest, const Sample* x, int numSamples, Sample fraction,
+                         const Sample* coefficients, typename Interpolator::State& state) noexcept
+    {
+        if constexpr (Interpolator::kIsRecursive)
+        {
+            juce::ignoreUnused (coefficients);
+
+            for (int i = 0; i < numSamples; ++i)
+                dest[i] = Interpolator::interpolate (x + i, fraction, state);
+        }
+        else
+        {
+            juce::ignoreUnused (fraction, state);
+
+           #if JUCE_USE_SIMD
+            if (mUseSimd)
+                DelayKernels::firSimd<Interpolator::kTaps> (dest, x, numSamples, coefficients);
+            else
+           #endif
+                DelayKernels::firScalar<Interpolator::kTaps> (dest, x, numSamples, coefficients);
+        }
+    }
+
+    void convert (juce::uint16* dest, const float* source, int numSamples) const noexcept
+    {
+       #if JUCE_USE_SIMD
+        if (mUseSimd)
+            DelayKernels::toHalfSimd (dest, source, numSamples);
+        else
+       #endif
+            DelayKernels::toHalfScalar (dest, source, numSamples);
+    }
+
+    void convert (float* dest, const juce::uint16* source, int numSamples) const noexcept
+    {
+       #if JUCE_USE_SIMD
+        if (mUseSimd)
+            DelayKernels::fromHalfSimd (dest, source, numSamples);
+        else
+       #endif
+            DelayKernels::fromHalfScalar (dest, source, numSamples);
+    }
+
+    /** The pairs with no vector version, a sample at a time. */
+    template <typename To, typename From>
+    void convert (To* dest, const From* source, int numSamples) const noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = convertSample<To> (source[i]);
+    }
+
+    /** Doubles go to and from half floats by way of float. */
+    template <typename To>
+    static To convertSample (juce::uint16 half) noexcept    { return (To) DelayKernels::fromHalf (half); }
+
+    template <typename To, typename From>
+    static To convertSample (From value) noexcept
+    {
+        if constexpr (std::is_same_v<To, juce::uint16>)
+            return DelayKernels::toHalf ((float) value);
+        else
+            return (To) value;
+    }
+
+    /** The delay rounded up to a whole sample. The read starts that many
+        samples back and interpolates forwards by the difference, which is
+        exact in double.
+    */
+    static int getWholeDelay (double delay) noexcept
+    {
+        const int truncated = (int) delay;
+        return (double) truncated < delay ? truncated + 1 : truncated;
+    }
+
+    Interpolators::NoState& getState (Interpolators::NoState*, int, int) noexcept { return mNoState; }
+
+    Interpolators::Thiran::State& getState (Interpolators::Thiran::State*, int channel, int stream) noexcept
+    {
+        jassert (juce::isPositiveAndBelow (stream, kMaxStreams));
+        return mThiranStates[channel * kMaxStreams + stream];
+    }
+
+    const float* getPage (const float*, int channel, int page) const noexcept                   { return mMemory.getChannel (channel, page); }
+    const juce::uint16* getPage (const juce::uint16*, int channel, int page) const noexcept     { return mMemory.getCompactChannel (channel, page); }
+    const double* getPage (const double*, int channel, int page) const noexcept                 { return mMemory.getDoubleChannel (channel, page); }
+
+    float* getPageForWriting (float*, int channel, int page, int offset) noexcept               { return mMemory.getChannelForWriting (channel, page, offset); }
+    juce::uint16* getPageForWriting (juce::uint16*, int channel, int page, int offset) noexcept { return mMemory.getCompactChannelForWriting (channel, page, offset); }
+    double* getPageForWriting (double*, int channel, int page, int offset) noexcept             { return mMemory.getDoubleChannelForWriting (channel, page, offset); }
+
+    DelayMemory mMemory;
+    juce::HeapBlock<Interpolators::Thiran::State> mThiranStates;    // kMaxStreams per channel
+    Interpolators::NoState mNoState;
+    int mNumStates = 0;
+    int mLength = 0;
+    int mMask = 0;
+    int mPageSamples = 0;
+    int mPageShift = 0;
+    int mPageMask = 0;
+    int mWriteIndex = 0;
+    bool mUseSimd = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DelayLine)
+};
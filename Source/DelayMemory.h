@@ -0,0 +1,684 @@
+/*
+  ==============================================================================
+
+    DelayMemory.h
+
+    Storage for every channel of a delay line, cut into pages so that only
+    the part of the line the delay times reach takes up memory. A page holds
+    kPageSamples of every channel (or the whole line, when that is shorter),
+    laid out one channel after another (structure of arrays). Each channel
+    is followed by guard samples that mirror the start of the next page, so
+    interpolating reads can run past the end of a page without looking the
+    next one up.
+
+    Pages the write position hasn't reached yet, and pages that have fallen
+    further behind it than the retained length, are not committed: they all
+    point at one shared page of silence. A background thread, shared by every
+    line in the process, keeps a few zeroed spare pages ready for each line.
+    The audio thread links one in when the write position enters a page that
+    isn't committed, and hands the pages it retires back to be zeroed and
+    reused, or freed. The audio thread never allocates, frees or clears a
+    page, except when rendering offline: then the write position can outrun
+    the background thread, and it reuses the pages it retires itself rather
+    than drop samples.
+
+    Samples are 32-bit floats, 64-bit doubles for double-precision
+    processing, or, in the compact format, 16-bit half floats (see
+    DelayKernels::toHalf), which halves the memory and the bandwidth of long
+    lines at the cost of some precision in the wet path.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "DelayKernels.h"
+
+#include <new>
+
+//==============================================================================
+class DelayMemory  : private juce::TimeSliceClient
+{
+public:
+    /** Samples mirrored past the end of each channel. Interpolators may read
+        up to this many samples beyond the position they are asked for.
+    */
+    static constexpr int kGuardSamples = 32;
+
+    /** Alignment of each channel's first sample, in bytes. */
+    static constexpr int kAlignment = 64;
+
+    /** Samples per channel in a page: about a third of a second at 48 kHz. */
+    static constexpr int kPageSamples = 1 << 14;
+
+    /** Zeroed pages kept ready for each line. The write position takes at
+        most one per page it crosses, so two last well beyond the interval
+        at which the background thread tops them up.
+    */
+    static constexpr int kSparePages = 2;
+
+    /** How often the background thread looks after each line, in ms. */
+    static constexpr int kServiceIntervalMilliseconds = 10;
+
+    enum class Format
+    {
+        float32 = 0,    // full precision
+        float16,        // half the size: 11 bits of precision, see DelayKernels::toHalf
+        float64         // twice the size, for double-precision processing
+    };
+
+    static int getBytesPerSample (Format format) noexcept
+    {
+        return format == Format::float16 ? 2 : (format == Format::float64 ? 8 : 4);
+    }
+
+    //==============================================================================
+    DelayMemory() = default;
+
+    ~DelayMemory() override
+    {
+        release();
+    }
+
+    /** Sets the memory up for numChannels channels of length samples each,
+        all silent. length must be a power of two. Only the page table and
+        the first spare pages are allocated, so this takes the same time
+        however long the line is.
+
+        Message thread only, while the audio thread isn't using the memory.
+    */
+    void allocate (int numChannels, int length, Format format = Format::float32)
+    {
+        jassert (juce::isPowerOfTwo (length));
+
+        release();
+
+        const int bytesPerSample = getBytesPerSample (format);
+        const int samplesPerLine = kAlignment / bytesPerSample;
+
+        mNumChannels = numChannels;
+        mLength = length;
+        mFormat = format;
+        mPageSamples = juce::jmin (length, kPageSamples);
+        mNumPages = length / mPageSamples;
+        mPageShift = 0;
+
+        while ((1 << mPageShift) < mPageSamples)
+            ++mPageShift;
+
+        // pad each channel to whole cache lines plus one odd line, so that the
+        // power-of-two page lengths don't all map to the same cache sets
+        const int lines = (mPageSamples + kGuardSamples + samplesPerLine - 1) / samplesPerLine;
+        mStride = (lines | 1) * samplesPerLine;
+        mPageBytes = (size_t) numChannels * (size_t) mStride * (size_t) bytesPerSample;
+
+        mZeroPage = allocatePage();
+        mPages.allocate ((size_t) mNumPages, false);
+        std::fill (mPages.get(), mPages.get() + mNumPages, mZeroPage);
+
+        // no more pages than these can exist at once in real time (a page for
+        // each entry, the spares and what an offline render kept back), so
+        // retiring one never finds the queue full
+        mRetired.setCapacity (mNumPages + 2 * kSparePages);
+        mSpares.setCapacity (kSparePages);
+
+        while (mSpares.getNumReady() < kSparePages)
+            mSpares.push (allocatePage());
+
+        mHeadPage = 0;
+        mLivePages = juce::jmin (2, mNumPages);
+        mPagesNeeded = mNumPages;
+
+        mThread->addTimeSliceClient (this);
+    }
+
+    /** Makes every sample silent by retiring every page. Doesn't allocate or
+        touch the samples, so it is safe on the audio thread. The write
+        position goes back to 0.
+    */
+    void clear() noexcept
+    {
+        for (int page = 0; page < mNumPages; ++page)
+            retirePage (page);
+
+        // the page before the write position gets a guard as soon as the
+        // line is written, so it counts as history from the start
+        mHeadPage = 0;
+        mLivePages = juce::jmin (2, mNumPages);
+    }
+
+    /** Message thread only, while the audio thread isn't using either memory. */
+    void swapWith (DelayMemory& other)
+    {
+        // the background thread mustn't look after either one half way through
+        mThread->removeTimeSliceClient (this);
+        mThread->removeTimeSliceClient (&other);
+
+        mPages.swapWith (other.mPages);
+        std::swap (mZeroPage, other.mZeroPage);
+        mSpares.swapWith (other.mSpares);
+        mRetired.swapWith (other.mRetired);
+        std::swap (mNumChannels, other.mNumChannels);
+        std::swap (mLength, other.mLength);
+        std::swap (mStride, other.mStride);
+        std::swap (mPageSamples, other.mPageSamples);
+        std::swap (mPageShift, other.mPageShift);
+        std::swap (mNumPages, other.mNumPages);
+        std::swap (mPageBytes, other.mPageBytes);
+        std::swap (mFormat, other.mFormat);
+        std::swap (mHeadPage, other.mHeadPage);
+        std::swap (mLivePages, other.mLivePages);
+        std::swap (mPagesNeeded, other.mPagesNeeded);
+        std::swap (mRecycled, other.mRecycled);
+        std::swap (mNumRecycled, other.mNumRecycled);
+
+        const auto numAllocated = mNumAllocatedPages.load();
+        mNumAllocatedPages = other.mNumAllocatedPages.load();
+        other.mNumAllocatedPages = numAllocated;
+
+        if (mZeroPage != nullptr)
+            mThread->addTimeSliceClient (this);
+
+        if (other.mZeroPage != nullptr)
+            mThread->addTimeSliceClient (&other);
+    }
+
+    /** Fills this (freshly allocated) memory with the most recent history of
+        another one, converted to a new sample rate. ratio is the new rate
+        over the old one, so a sample that was d samples old ends up
+        d * ratio samples before the write position of this memory, which is
+        index 0. Whatever fits is kept; channels without a source are left
+        silent. The formats may differ. Only the history the source still
+        holds is copied, and only the pages it lands in are committed.
+
+        Message thread only, while the audio thread isn't using either memory.
+    */
+    void resampleFrom (const DelayMemory& source, int sourceWriteIndex, double ratio)
+    {
+        jassert (ratio > 0.0);
+
+        const int sourceMask = source.mLength - 1;
+        const int numToKeep = juce::jmin (mLength - 1, (int) ((source.getHistoryLength() - 2) * ratio));
+        const double step = 1.0 / ratio;
+
+        if (numToKeep <= 0)
+            return;
+
+        for (int age = 1; age <= numToKeep; age += mPageSamples)
+            commitPageNow ((mLength - age) >> mPageShift);
+
+        commitPageNow ((mLength - numToKeep) >> mPageShift);
+
+        for (int channel = 0; channel < juce::jmin (mNumChannels, source.mNumChannels); ++channel)
+        {
+            for (int age = 1; age <= numToKeep; ++age)
+            {
+                // the newest sample is one behind the write position; nothing
+                // newer than that has been written yet
+                const double position = (double) (sourceWriteIndex + source.mLength) - juce::jmax (1.0, age * step);
+                const int integerPart = (int) position;
+                const double fraction = position - integerPart;
+
+                const double a = source.getSample (channel, integerPart & sourceMask);
+                const double b = source.getSample (channel, (integerPart + 1) & sourceMask);
+                setSample (channel, mLength - age, a + fraction * (b - a));
+            }
+
+            // each committed page's guard mirrors the start of the next
+            for (int page = 0; page < mNumPages; ++page)
+            {
+                if (mPages[page] == mZeroPage)
+                    continue;
+
+                copyGuard (channel, page, (page + 1) & (mNumPages - 1), 0, kGuardSamples);
+            }
+        }
+
+        // the history runs back from the write position, which is at the
+        // start of page 0
+        mLivePages = juce::jmin (mNumPages, (numToKeep + mPageSamples - 1) / mPageSamples + 1);
+    }
+
+    int getNumChannels() const              { return mNumChannels; }
+    int getLength() const                   { return mLength; }
+    Format getFormat() const                { return mFormat; }
+    int getPageSamples() const              { return mPageSamples; }
+    int getPageShift() const                { return mPageShift; }
+
+    /** Bytes currently allocated for pages, including the silent page and the
+        spares. Any thread.
+    */
+    size_t getAllocatedBytes() const noexcept   { return (size_t) mNumAllocatedPages.load (std::memory_order_relaxed) * mPageBytes; }
+
+    /** How many page-sized runs of writes have been dropped because no spare
+        page was ready. Any thread.
+    */
+    int getNumDroppedWrites() const noexcept    { return mNumDroppedWrites.load (std::memory_order_relaxed); }
+
+    //==============================================================================
+    // audio thread
+
+    /** While rendering offline the audio thread keeps a few of the pages it
+        retires and clears them for reuse itself, and allocates and frees
+        pages whenever the background thread has fallen behind.
+    */
+    void setNonRealtime (bool isNonRealtime) noexcept
+    {
+        mIsNonRealtime = isNonRealtime;
+
+        // back in real time, the background thread clears them instead
+        if (! isNonRealtime)
+            while (mNumRecycled > 0 && mRetired.push (mRecycled[mNumRecycled - 1]))
+                --mNumRecycled;
+    }
+
+    /** Moves the write position to index. Pages it has passed into join the
+        history, and pages that fall out of the retained length are retired.
+    */
+    void setWritePosition (int index) noexcept
+    {
+        const int page = index >> mPageShift;
+        const int numEntered = (page - mHeadPage) & (mNumPages - 1);
+
+        mHeadPage = page;
+        mLivePages = juce::jmin (mNumPages, mLivePages + numEntered);
+        retireOldPages();
+    }
+
+    /** Sets how far behind the write position the line is still read.
+        History older than that, rounded up to whole pages, is retired: it
+        reads as silence from then on, even if the retained length grows
+        again.
+    */
+    void setRetainedLength (int numSamples) noexcept
+    {
+        mPagesNeeded = juce::jmin (mNumPages, (juce::jmax (0, numSamples) + mPageSamples - 1) / mPageSamples + 1);
+        retireOldPages();
+    }
+
+    /** How far behind the write position the memory can still hold anything
+        but silence.
+    */
+    int getHistoryLength() const noexcept   { return juce::jmin (mLength, mPagesNeeded * mPageSamples); }
+
+    /** One page of a channel, in the float32 format. Pages that aren't
+        committed read as silence.
+    */
+    const float* getChannel (int channel, int page) const noexcept                { return getChannelData<float> (channel, page, Format::float32); }
+
+    /** One page of a channel, in the float16 format. */
+    const juce::uint16* getCompactChannel (int channel, int page) const noexcept  { return getChannelData<juce::uint16> (channel, page, Format::float16); }
+
+    /** One page of a channel, in the float64 format. */
+    const double* getDoubleChannel (int channel, int page) const noexcept         { return getChannelData<double> (channel, page, Format::float64); }
+
+    /** One page of a channel to write to from offset on, in the float32
+        format. A page that isn't committed yet takes one of the spares.
+        Returns nullptr when there are none left, and the write is dropped.
+    */
+    float* getChannelForWriting (int channel, int page, int offset) noexcept
+    {
+        return commitPage (page, offset) ? getChannelData<float> (channel, page, Format::float32) : nullptr;
+    }
+
+    /** One page of a channel to write to from offset on, in the float16 format. */
+    juce::uint16* getCompactChannelForWriting (int channel, int page, int offset) noexcept
+    {
+        return commitPage (page, offset) ? getChannelData<juce::uint16> (channel, page, Format::float16) : nullptr;
+    }
+
+    /** One page of a channel to write to from offset on, in the float64 format. */
+    double* getDoubleChannelForWriting (int channel, int page, int offset) noexcept
+    {
+        return commitPage (page, offset) ? getChannelData<double> (channel, page, Format::float64) : nullptr;
+    }
+
+    /** One sample of any format, as a double. Not for inner loops. */
+    double getSample (int channel, int index) const noexcept
+    {
+        const int page = index >> mPageShift;
+        const int offset = index & (mPageSamples - 1);
+
+        switch (mFormat)
+        {
+            case Format::float16:   return DelayKernels::fromHalf (getCompactChannel (channel, page)[offset]);
+            case Format::float64:   return getDoubleChannel (channel, page)[offset];
+            case Format::float32:
+            default:                return getChannel (channel, page)[offset];
+        }
+    }
+
+    /** Refreshes the guard of the page before page after samples
+        [startIndex, startIndex + numSamples) of the page have been written.
+        Only writes near the start of a page touch the guard. Audio thread.
+    */
+    void updateGuard (int channel, int page, int startIndex, int numSamples) noexcept
+    {
+        if (startIndex >= kGuardSamples)
+            return;
+
+        // the page before may never have been written, but reads of its
+        // last samples still run into this one, so it needs a guard
+        const int previous = (page - 1) & (mNumPages - 1);
+
+        if (! commitPage (previous, mPageSamples))
+            return;
+
+        copyGuard (channel, previous, page, startIndex, juce::jmin (numSamples, kGuardSamples - startIndex));
+    }
+
+private:
+    //==============================================================================
+    /** The thread that looks after every line's pages. */
+    struct PageThread  : public juce::TimeSliceThread
+    {
+        PageThread()  : juce::TimeSliceThread ("Delay Memory Pages")    { startThread(); }
+        ~PageThread() override                                          { stopThread (1000); }
+    };
+
+    /** Wait-free queue of pages: one thread pushes, one other pops. */
+    class PageQueue
+    {
+    public:
+        void setCapacity (int capacity)
+        {
+            mPages.allocate ((size_t) capacity + 1, true);
+            mFifo.setTotalSize (capacity + 1);
+        }
+
+        bool push (char* page) noexcept
+        {
+            int start1, size1, start2, size2;
+            mFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+            if (size1 + size2 == 0)
+                return false;
+
+            mPages[size1 > 0 ? start1 : start2] = page;
+            mFifo.finishedWrite (1);
+            return true;
+        }
+
+        bool pop (char*& page) noexcept
+        {
+            int start1, size1, start2, size2;
+            mFifo.prepareToRead (1, start1, size1, start2, size2);
+
+            if (size1 + size2 == 0)
+                return false;
+
+            page = mPages[size1 > 0 ? start1 : start2];
+            mFifo.finishedRead (1);
+            return true;
+        }
+
+        int getNumReady() const noexcept    { return mFifo.getNumReady(); }
+
+        /** Neither queue may be in use. */
+        void swapWith (PageQueue& other)
+        {
+            char* page;
+            juce::Array<char*> ours, theirs;
+
+            while (pop (page))
+                ours.add (page);
+
+            while (other.pop (page))
+                theirs.add (page);
+
+            const int capacity = mFifo.getTotalSize() - 1;
+            setCapacity (other.mFifo.getTotalSize() - 1);
+            other.setCapacity (capacity);
+
+            for (auto* p : theirs)
+                push (p);
+
+            for (auto* p : ours)
+                other.push (p);
+        }
+
+    private:
+        juce::AbstractFifo mFifo { 1 };
+        juce::HeapBlock<char*> mPages;
+    };
+
+    //==============================================================================
+    // background thread: retired pages are zeroed and kept as spares, or freed
+    // once there are enough, and the spares are topped up
+    int useTimeSlice() override
+    {
+        char* page;
+
+        while (mRetired.pop (page))
+        {
+            if (mSpares.getNumReady() < kSparePages)
+            {
+                juce::zeromem (page, mPageBytes);
+                mSpares.push (page);
+            }
+            else
+            {
+                freePage (page);
+            }
+        }
+
+        while (mSpares.getNumReady() < kSparePages)
+            mSpares.push (allocatePage());
+
+        return kServiceIntervalMilliseconds;
+    }
+
+    /** A new page of silence: all-zero bits are silence in either format. */
+    char* allocatePage()
+    {
+        auto* page = static_cast<char*> (::operator new (mPageBytes, std::align_val_t (kAlignment)));
+        juce::zeromem (page, mPageBytes);
+        mNumAllocatedPages.fetch_add (1, std::memory_order_relaxed);
+        return page;
+    }
+
+    void freePage (char* page) noexcept
+    {
+        ::operator delete (page, std::align_val_t (kAlignment));
+        mNumAllocatedPages.fetch_sub (1, std::memory_order_relaxed);
+    }
+
+    /** Frees everything. Message thread only. */
+    void release()
+    {
+        if (mZeroPage == nullptr)
+            return;
+
+        mThread->removeTimeSliceClient (this);
+
+        char* page;
+
+        while (mSpares.pop (page))
+            freePage (page);
+
+        while (mRetired.pop (page))
+            freePage (page);
+
+        for (int i = 0; i < mNumPages; ++i)
+            if (mPages[i] != mZeroPage)
+                freePage (mPages[i]);
+
+        while (mNumRecycled > 0)
+            freePage (mRecycled[--mNumRecycled]);
+
+        freePage (mZeroPage);
+        mZeroPage = nullptr;
+        mPages.free();
+        mNumPages = 0;
+        mNumChannels = 0;
+        mLength = 0;
+    }
+
+    /** Gives page a spare if it isn't committed, to be written from
+        firstWritten on. Audio thread.
+    */
+    bool commitPage (int page, int firstWritten) noexcept
+    {
+        if (mPages[page] != mZeroPage)
+            return true;
+
+        char* spare;
+
+        if (mSpares.pop (spare))
+        {
+            mPages[page] = spare;
+        }
+        else if (mIsNonRealtime && mNumRecycled > 0)
+        {
+            mPages[page] = mRecycled[--mNumRecycled];
+            clearRecycledPage (mPages[page], firstWritten);
+        }
+        else if (mIsNonRealtime)
+        {
+            mPages[page] = allocatePage();
+        }
+        else
+        {
+            mNumDroppedWrites.fetch_add (1, std::memory_order_relaxed);
+        }
+
+        return mPages[page] != mZeroPage;
+    }
+
+    /** Silences what of a recycled page can be read before it is written:
+        the samples before firstWritten and the guard. Unless reads reach
+        round the whole line, which they only can when nothing is retired,
+        the rest is written before anything reads it.
+    */
+    void clearRecycledPage (char* page, int firstWritten) noexcept
+    {
+        if (mPagesNeeded >= mNumPages || firstWritten >= mPageSamples)
+        {
+            juce::zeromem (page, mPageBytes);
+            return;
+        }
+
+        const auto bytesPerSample = (size_t) getBytesPerSample (mFormat);
+
+        for (int channel = 0; channel < mNumChannels; ++channel)
+        {
+            auto* data = page + (size_t) channel * (size_t) mStride * bytesPerSample;
+            juce::zeromem (data, (size_t) firstWritten * bytesPerSample);
+            juce::zeromem (data + (size_t) mPageSamples * bytesPerSample, (size_t) kGuardSamples * bytesPerSample);
+        }
+    }
+
+    /** Gives page a new page if it isn't committed. Message thread. */
+    void commitPageNow (int page)
+    {
+        if (mPages[page] == mZeroPage)
+            mPages[page] = allocatePage();
+    }
+
+    /** Hands a page to the background thread and points it at silence. */
+    bool retirePage (int page) noexcept
+    {
+        if (mPages[page] == mZeroPage)
+            return true;
+
+        if (mIsNonRealtime && mNumRecycled < kSparePages)
+        {
+            mRecycled[mNumRecycled++] = mPages[page];
+        }
+        else if (! mRetired.push (mPages[page]))
+        {
+            if (! mIsNonRealtime)
+                return false;
+
+            freePage (mPages[page]);
+        }
+
+        mPages[page] = mZeroPage;
+        return true;
+    }
+
+    void retireOldPages() noexcept
+    {
+        // the oldest live page is mLivePages - 1 behind the write position's
+        while (mLivePages > mPagesNeeded && retirePage ((mHeadPage - mLivePages + 1) & (mNumPages - 1)))
+            --mLivePages;
+    }
+
+    void setSample (int channel, int index, double value) noexcept
+    {
+        const int page = index >> mPageShift;
+        const int offset = index & (mPageSamples - 1);
+
+        jassert (mPages[page] != mZeroPage);
+
+        switch (mFormat)
+        {
+            case Format::float16:   getChannelData<juce::uint16> (channel, page, mFormat)[offset] = DelayKernels::toHalf ((float) value); break;
+            case Format::float64:   getChannelData<double> (channel, page, mFormat)[offset] = value; break;
+            case Format::float32:
+            default:                getChannelData<float> (channel, page, mFormat)[offset] = (float) value; break;
+        }
+    }
+
+    template <typename Sample>
+    Sample* getChannelData (int channel, int page, Format format) const noexcept
+    {
+        jassert (format == mFormat);
+        juce::ignoreUnused (format);
+        return reinterpret_cast<Sample*> (mPages[page]) + (size_t) channel * (size_t) mStride;
+    }
+
+    /** Mirrors samples [startIndex, startIndex + count) of page into the guard of previous. */
+    void copyGuard (int channel, int previous, int page, int startIndex, int count) noexcept
+    {
+        switch (mFormat)
+        {
+            case Format::float16:   copyGuard (getChannelData<juce::uint16> (channel, previous, mFormat), getChannelData<juce::uint16> (channel, page, mFormat), startIndex, count); break;
+            case Format::float64:   copyGuard (getChannelData<double> (channel, previous, mFormat), getChannelData<double> (channel, page, mFormat), startIndex, count); break;
+            case Format::float32:
+            default:                copyGuard (getChannelData<float> (channel, previous, mFormat), getChannelData<float> (channel, page, mFormat), startIndex, count); break;
+        }
+    }
+
+    template <typename Sample>
+    void copyGuard (Sample* previous, const Sample* data, int startIndex, int count) noexcept
+    {
+        for (int i = 0; i < count; ++i)
+            previous[mPageSamples + startIndex + i] = data[startIndex + i];
+    }
+
+    juce::SharedResourcePointer<PageThread> mThread;
+
+    // page table: every page either has its own memory or points at mZeroPage.
+    // only the audio thread touches it once the memory is in use
+    juce::HeapBlock<char*> mPages;
+    char* mZeroPage = nullptr;
+    PageQueue mSpares;      // background thread to audio thread
+    PageQueue mRetired;     // audio thread to background thread
+
+    int mNumChannels = 0;
+    int mLength = 0;
+    int mStride = 0;
+    int mPageSamples = 0;
+    int mPageShift = 0;
+    int mNumPages = 0;
+    size_t mPageBytes = 0;
+    Format mFormat = Format::float32;
+
+    // the write position's page, how many pages back from it (including it)
+    // may hold history, and how many the retained length needs
+    int mHeadPage = 0;
+    int mLivePages = 0;
+    int mPagesNeeded = 0;
+
+    // offline only: retired pages the audio thread keeps to reuse itself
+    bool mIsNonRealtime = false;
+    char* mRecycled[kSparePages] = {};
+    int mNumRecycled = 0;
+
+    std::atomic<int> mNumAllocatedPages { 0 };
+    std::atomic<int> mNumDroppedWrites { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DelayMemory)
+};
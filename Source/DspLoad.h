@@ -0,0 +1,214 @@
+/*
+  ==============================================================================
+
+    DspLoad.h
+
+    How much of the real-time budget processBlock uses. A block's budget is
+    its length at the current sample rate. Its cost is measured on the high
+    resolution clock, and in CPU cycles where there is a cycle counter.
+
+    The audio thread is the only writer. Every statistic is a relaxed
+    atomic, so the editor, the processor's timer and the benchmark read
+    them at any time without locks. A read can mix values from two adjacent
+    blocks, which is fine for a meter.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#if JUCE_INTEL
+ #if JUCE_MSVC
+  #include <intrin.h>
+ #else
+  #include <x86intrin.h>
+ #endif
+#endif
+
+//==============================================================================
+class DspLoad
+{
+public:
+    /** Upper edges of the histogram bins, in percent of the budget. The bin
+        after the last edge counts overruns.
+    */
+    static constexpr float kHistogramEdges[] = { 0.5f, 1.0f, 2.0f, 5.0f, 10.0f, 20.0f, 35.0f, 50.0f, 75.0f, 100.0f };
+    static constexpr int kNumHistogramBins = (int) (sizeof (kHistogramEdges) / sizeof (kHistogramEdges[0])) + 1;
+
+    /** The rolling averages cover about this long. */
+    static constexpr double kAverageSeconds = 1.0;
+
+    /** One read of the statistics. */
+    struct Snapshot
+    {
+        double sampleRate = 0.0;
+        int blockSize = 0;
+        double budgetMilliseconds = 0.0;    // blockSize at sampleRate
+        juce::int64 numBlocks = 0;
+        float lastPercent = 0.0f;
+        float averagePercent = 0.0f;        // rolling, over kAverageSeconds
+        float meanPercent = 0.0f;           // over every block since the last reset
+        float worstPercent = 0.0f;
+        float cyclesPerSample = 0.0f;       // 0 without a cycle counter
+        juce::int64 histogram[kNumHistogramBins] = {};
+
+        juce::int64 getNumOverruns() const noexcept   { return histogram[kNumHistogramBins - 1]; }
+    };
+
+    //==============================================================================
+    /** True when cyclesPerSample is measured. */
+    static constexpr bool hasCycleCounter() noexcept
+    {
+       #if JUCE_INTEL
+        return true;
+       #else
+        return false;
+       #endif
+    }
+
+    static juce::uint64 readCycleCounter() noexcept
+    {
+       #if JUCE_INTEL
+        return (juce::uint64) __rdtsc();
+       #else
+        return 0;
+       #endif
+    }
+
+    //==============================================================================
+    // audio thread
+
+    /** Sets the budget up for the host's sample rate and block size, and
+        clears the statistics.
+    */
+    void prepare (double sampleRate, int blockSize) noexcept
+    {
+        mSampleRate.store (sampleRate, std::memory_order_relaxed);
+        mBlockSize.store (blockSize, std::memory_order_relaxed);
+        mTicksPerSample = (double) juce::Time::getHighResolutionTicksPerSecond() / sampleRate;
+        clear();
+    }
+
+    /** Measures the lifetime of this object as one block's cost. */
+    class ScopedMeasurement
+    {
+    public:
+        ScopedMeasurement (DspLoad& load, int numSamples) noexcept
+            : mLoad (load),
+              mNumSamples (numSamples),
+              mStartTicks (juce::Time::getHighResolutionTicks()),
+              mStartCycles (readCycleCounter())
+        {
+        }
+
+        ~ScopedMeasurement()
+        {
+            const auto cycles = readCycleCounter() - mStartCycles;
+            const auto ticks = juce::Time::getHighResolutionTicks() - mStartTicks;
+            mLoad.addBlock (ticks, cycles, mNumSamples);
+        }
+
+    private:
+        DspLoad& mLoad;
+        const int mNumSamples;
+        const juce::int64 mStartTicks;
+        const juce::uint64 mStartCycles;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedMeasurement)
+    };
+
+    //==============================================================================
+    // any thread
+
+    Snapshot getSnapshot() const noexcept
+    {
+        Snapshot snapshot;
+        snapshot.sampleRate = mSampleRate.load (std::memory_order_relaxed);
+        snapshot.blockSize = mBlockSize.load (std::memory_order_relaxed);
+        snapshot.budgetMilliseconds = snapshot.sampleRate > 0.0 ? 1000.0 * snapshot.blockSize / snapshot.sampleRate : 0.0;
+        snapshot.numBlocks = mNumBlocks.load (std::memory_order_relaxed);
+        snapshot.lastPercent = mLastPercent.load (std::memory_order_relaxed);
+        snapshot.averagePercent = mAveragePercent.load (std::memory_order_relaxed);
+        snapshot.meanPercent = snapshot.numBlocks > 0 ? (float) (mTotalPercent.load (std::memory_order_relaxed) / (double) snapshot.numBlocks) : 0.0f;
+        snapshot.worstPercent = mWorstPercent.load (std::memory_order_relaxed);
+        snapshot.cyclesPerSample = mCyclesPerSample.load (std::memory_order_relaxed);
+
+        for (int bin = 0; bin < kNumHistogramBins; ++bin)
+            snapshot.histogram[bin] = mHistogram[bin].load (std::memory_order_relaxed);
+
+        return snapshot;
+    }
+
+    /** Asks the audio thread to clear the statistics before its next block. */
+    void resetStatistics() noexcept
+    {
+        mResetRequested.store (true, std::memory_order_relaxed);
+    }
+
+private:
+    void addBlock (juce::int64 ticks, juce::uint64 cycles, int numSamples) noexcept
+    {
+        if (numSamples <= 0 || mTicksPerSample <= 0.0)
+            return;
+
+        if (mResetRequested.exchange (false, std::memory_order_relaxed))
+            clear();
+
+        const float percent = (float) (100.0 * (double) ticks / (mTicksPerSample * numSamples));
+        const float cyclesPerSample = (float) ((double) cycles / numSamples);
+        const auto numBlocks = mNumBlocks.load (std::memory_order_relaxed);
+
+        // the averages weigh each block by its length, so they cover the same
+        // time whatever the block size. the first block starts them off
+        const float weight = numBlocks == 0 ? 1.0f
+                                            : (float) juce::jmin (1.0, numSamples / (kAverageSeconds * mSampleRate.load (std::memory_order_relaxed)));
+
+        const float average = mAveragePercent.load (std::memory_order_relaxed);
+        const float averageCycles = mCyclesPerSample.load (std::memory_order_relaxed);
+
+        mLastPercent.store (percent, std::memory_order_relaxed);
+        mAveragePercent.store (average + weight * (percent - average), std::memory_order_relaxed);
+        mTotalPercent.store (mTotalPercent.load (std::memory_order_relaxed) + percent, std::memory_order_relaxed);
+        mCyclesPerSample.store (averageCycles + weight * (cyclesPerSample - averageCycles), std::memory_order_relaxed);
+
+        if (percent > mWorstPercent.load (std::memory_order_relaxed))
+            mWorstPercent.store (percent, std::memory_order_relaxed);
+
+        int bin = 0;
+
+        while (bin < kNumHistogramBins - 1 && percent >= kHistogramEdges[bin])
+            ++bin;
+
+        mHistogram[bin].store (mHistogram[bin].load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        mNumBlocks.store (numBlocks + 1, std::memory_order_relaxed);
+    }
+
+    void clear() noexcept
+    {
+        mNumBlocks.store (0, std::memory_order_relaxed);
+        mLastPercent.store (0.0f, std::memory_order_relaxed);
+        mAveragePercent.store (0.0f, std::memory_order_relaxed);
+        mTotalPercent.store (0.0, std::memory_order_relaxed);
+        mWorstPercent.store (0.0f, std::memory_order_relaxed);
+        mCyclesPerSample.store (0.0f, std::memory_order_relaxed);
+
+        for (auto& count : mHistogram)
+            count.store (0, std::memory_order_relaxed);
+    }
+
+    double mTicksPerSample = 0.0;
+    std::atomic<double> mSampleRate { 0.0 };
+    std::atomic<int> mBlockSize { 0 };
+    std::atomic<juce::int64> mNumBlocks { 0 };
+    std::atomic<float> mLastPercent { 0.0f };
+    std::atomic<float> mAveragePercent { 0.0f };
+    std::atomic<double> mTotalPercent { 0.0 };
+    std::atomic<float> mWorstPercent { 0.0f };
+    std::atomic<float> mCyclesPerSample { 0.0f };
+    std::atomic<juce::int64> mHistogram[kNumHistogramBins] {};
+    std::atomic<bool> mResetRequested { false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DspLoad)
+};
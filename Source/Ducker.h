@@ -0,0 +1,164 @@
+/*
+  ==============================================================================
+
+    Ducker.h
+
+    Turns the wet signal down while a key signal, the dry input or a
+    sidechain, is playing, so the echoes sit under a vocal and swell back
+    up in the gaps. The feedback is left alone, so the echoes keep going
+    underneath and come back at their own level.
+
+    The follower works on the processor's control grid rather than per
+    sample. Each control interval the key's peak is found with
+    FloatVectorOperations, then an attack/release one-pole steps once for
+    the whole interval, and the gain it sets is ramped across the next
+    interval like any smoothed parameter. That is two vector passes over
+    the key and a handful of scalar operations per interval, and the gain
+    lags the key by one interval, well under a millisecond.
+
+    Ducking is in decibels: every decibel the key rises above the threshold
+    turns the wet down by amount decibels, down to kRangeDecibels.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "BlockSmoother.h"
+
+//==============================================================================
+class Ducker
+{
+public:
+    /** The deepest the wet signal is ducked. */
+    static constexpr float kRangeDecibels = 40.0f;
+
+    /** Where the key comes from, in the order of the "Duck Source" parameter. */
+    enum class Source
+    {
+        input = 0,
+        sidechain
+    };
+
+    static juce::StringArray getSourceNames()
+    {
+        return { "Input", "Sidechain" };
+    }
+
+    //==============================================================================
+    /** The follower steps once every controlInterval samples. */
+    void prepare (double sampleRate, int controlInterval)
+    {
+        mSampleRate = sampleRate;
+        mInterval = juce::jmax (1, controlInterval);
+        mAttackCoefficient = getCoefficient (mAttackMilliseconds);
+        mReleaseCoefficient = getCoefficient (mReleaseMilliseconds);
+        reset();
+    }
+
+    /** Forgets the key and lets the wet through at full level. */
+    void reset() noexcept
+    {
+        mPeak = 0.0f;
+        mEnvelope = 0.0f;
+        mGain = 1.0f;
+    }
+
+    /** Takes up new settings. amount runs from 0, off, to 1. */
+    void setParameters (float amount, float thresholdDecibels, float attackMilliseconds, float releaseMilliseconds) noexcept
+    {
+        mAmount = juce::jlimit (0.0f, 1.0f, amount);
+        mThresholdDecibels = thresholdDecibels;
+
+        if (attackMilliseconds != mAttackMilliseconds)
+        {
+            mAttackMilliseconds = attackMilliseconds;
+            mAttackCoefficient = getCoefficient (attackMilliseconds);
+        }
+
+        if (releaseMilliseconds != mReleaseMilliseconds)
+        {
+            mReleaseMilliseconds = releaseMilliseconds;
+            mReleaseCoefficient = getCoefficient (releaseMilliseconds);
+        }
+    }
+
+    /** True while the key is followed. The processor has to stop at every
+        control interval then, so the gain can follow it.
+    */
+    bool isActive() const noexcept      { return mAmount > 0.0f; }
+
+    //==============================================================================
+    /** Takes in numSamples of the key for the current interval. Parts of the
+        interval may be passed more than once: only the peak is kept.
+    */
+    template <typename Sample>
+    void addKey (const Sample* const* key, int numChannels, int numSamples) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            const auto range = juce::FloatVectorOperations::findMinAndMax (key[channel], numSamples);
+            mPeak = juce::jmax (mPeak, (float) -range.getStart(), (float) range.getEnd());
+        }
+    }
+
+    /** Steps the follower on the key's peak since the last call and returns
+        the gain ramp for the interval starting now.
+    */
+    ParameterRamp advance() noexcept
+    {
+        ParameterRamp ramp;
+        ramp.start = mGain;
+
+        float target = 1.0f;
+
+        if (isActive())
+        {
+            const float coefficient = mPeak > mEnvelope ? mAttackCoefficient : mReleaseCoefficient;
+            mEnvelope += (mPeak - mEnvelope) * coefficient;
+
+            const float over = juce::Decibels::gainToDecibels (mEnvelope, -200.0f) - mThresholdDecibels;
+
+            if (over > 0.0f)
+                target = juce::Decibels::decibelsToGain (-juce::jmin (over * mAmount, kRangeDecibels));
+        }
+        else
+        {
+            mEnvelope = 0.0f;
+        }
+
+        // once the envelope falls below the threshold the target is exactly
+        // one, so the ramps go flat and the gain can be skipped
+        mPeak = 0.0f;
+        mGain = target;
+
+        ramp.increment = (mGain - ramp.start) / (float) mInterval;
+        return ramp;
+    }
+
+private:
+    /** The one-pole's step for a whole interval with a time constant of milliseconds. */
+    float getCoefficient (float milliseconds) const noexcept
+    {
+        const double samplesPerTimeConstant = mSampleRate * (double) milliseconds * 0.001;
+        return samplesPerTimeConstant > 0.0 ? (float) (1.0 - std::exp (-(double) mInterval / samplesPerTimeConstant))
+                                            : 1.0f;
+    }
+
+    double mSampleRate = 44100.0;
+    int mInterval = 32;
+
+    float mAmount = 0.0f;
+    float mThresholdDecibels = 0.0f;
+    float mAttackMilliseconds = 0.0f;
+    float mReleaseMilliseconds = 0.0f;
+    float mAttackCoefficient = 1.0f;
+    float mReleaseCoefficient = 1.0f;
+
+    float mPeak = 0.0f;
+    float mEnvelope = 0.0f;
+    float mGain = 1.0f;
+
+    JUCE_LEAK_DETECTOR (Ducker)
+};
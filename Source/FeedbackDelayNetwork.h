@@ -0,0 +1,320 @@
+/*
+  ==============================================================================
+
+    FeedbackDelayNetwork.h
+
+    The smear mode: 8 or 16 delay lines whose outputs are mixed by a
+    Hadamard matrix and fed back into all of them, so every echo spreads
+    over the other lines and the repeats blur into a wash rather than
+    arriving one at a time.
+
+    The lines' lengths follow the delay times, scaled by p / 199 for
+    distinct primes p from 101 to 199, so the longest is the delay time
+    itself. Their ratios are ratios of primes, which keeps the lines'
+    echoes from lining up for many trips round. The lengths themselves are
+    not coprime sample counts, and in general not whole samples: they glide
+    with the delay times, so the lines read with linear interpolation, and
+    rounding them to primes would make them step as they glide. Line j
+    takes its length from channel j % numChannels and feeds it, so in
+    stereo the even lines are the left's and the odd ones the right's.
+
+    Each line has a two-tap damping filter, the Karplus-Strong average, so
+    the high end dies away faster than the low end. The 1 / sqrt (N) that
+    makes the Hadamard matrix orthogonal is folded into its taps, so with
+    the feedback gain below one the network always decays.
+
+    Like the rest of the engine it works on whole chunks shorter than its
+    shortest line. The lines are read, damped, mixed and written as
+    separate passes over the chunk, each vectorised along time, so the
+    mixing matrix is two passes of 4-point transforms over whole chunks,
+    with no per-sample shuffling between lines. Running the lines as SIMD
+    lanes instead does the same arithmetic plus a gather and a scatter per
+    sample, since every line reads and writes at its own delay, and it
+    measured slower at every line count.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+#include "DelayLine.h"
+
+//==============================================================================
+class FeedbackDelayNetwork
+{
+public:
+    static constexpr int kMaxLines = 16;
+
+    /** The longest line. Delay times past it are held to it in smear mode. */
+    static constexpr double kMaxDelaySeconds = 4.0;
+
+    /** The sizes in the order of the "Smear" parameter. Off runs the two
+        lines of the ordinary delay instead.
+    */
+    static juce::StringArray getSizeNames()
+    {
+        return { "Off", "8 Lines", "16 Lines" };
+    }
+
+    static int getNumLinesForSize (int sizeIndex) noexcept
+    {
+        return sizeIndex <= 0 ? 0 : (sizeIndex == 1 ? 8 : 16);
+    }
+
+    //==============================================================================
+    /** Sizes the lines and the working memory for chunks of up to
+        maximumChunk samples. The history is carried over at resampleRatio
+        as DelayLine::prepare does. Allocates, so call it from prepareToPlay.
+    */
+    void prepare (double sampleRate, int maximumChunk, double resampleRatio, DelayMemory::Format format)
+    {
+        mMaximumDelay = std::floor (sampleRate * kMaxDelaySeconds);
+        mLines.prepare (kMaxLines, (int) mMaximumDelay + 2, resampleRatio, format);
+
+        // a line's read buffer holds one sample before the chunk too. each
+        // buffer starts on a 64-byte boundary
+        mScratchStride = (maximumChunk + 1 + 15) & ~15;
+        mScratch.allocate ((size_t) mScratchStride * 2 * kMaxLines + 8, true);
+    }
+
+    /** Silences the lines. Safe on the audio thread. */
+    void reset()
+    {
+        mLines.clear();
+    }
+
+    void setNonRealtime (bool isNonRealtime) noexcept   { mLines.setNonRealtime (isNonRealtime); }
+    void setUseSimd (bool shouldUseSimd)                { mLines.setUseSimd (shouldUseSimd); mUseSimd = shouldUseSimd; }
+
+    /** 8 or 16, or 0 when the network is off. Changing it clears the lines. */
+    void setNumLines (int numLines)
+    {
+        jassert (numLines == 0 || numLines == 8 || numLines == kMaxLines);
+
+        if (numLines != mNumLines)
+        {
+            mNumLines = numLines;
+            reset();
+        }
+    }
+
+    int getNumLines() const noexcept                { return mNumLines; }
+    int getHistoryLength() const noexcept           { return mLines.getHistoryLength(); }
+    size_t getAllocatedBytes() const                { return mLines.getAllocatedBytes(); }
+
+    /** How much of each line's highs it loses on every trip, from 0 to 1. */
+    void setDamping (float damping) noexcept
+    {
+        mDamping = 0.5 * juce::jlimit (0.0f, 1.0f, damping);
+    }
+
+    //==============================================================================
+    /** Sets the lines' lengths for one control interval from each of the
+        numChannels channels' delay ramps, in samples, as read() takes them.
+        Also hands back the history the lines no longer reach.
+    */
+    void setDelays (const double* delayStart, const double* delayIncrement, int numChannels, int controlInterval) noexcept
+    {
+        jassert (numChannels > 0 && numChannels <= CrossFeedMatrix::kMaxChannels);
+
+        mNumChannels = numChannels;
+
+        // the primes spread the ratios across the octave below the delay
+        // time. 8 lines take every other one
+        static constexpr int kPrimes[kMaxLines] = { 101, 107, 113, 127, 131, 137, 139, 149,
+                                                    151, 157, 163, 167, 173, 179, 191, 199 };
+        const int stride = kMaxLines / juce::jmax (1, mNumLines);
+        double deepest = 0.0;
+
+        for (int line = 0; line < mNumLines; ++line)
+        {
+            const int channel = line % numChannels;
+            const double ratio = kPrimes[line * stride] / 199.0;
+            const double start = juce::jmin (delayStart[channel], mMaximumDelay) * ratio;
+            const double end = juce::jmin (delayStart[channel] + delayIncrement[channel] * controlInterval, mMaximumDelay) * ratio;
+
+            mDelayStart[line] = start;
+            mDelayIncrement[line] = (end - start) / controlInterval;
+            deepest = juce::jmax (deepest, start, end);
+        }
+
+        // one sample more for the damping filter's earlier tap
+        mLines.setRetainedLength ((int) std::ceil (deepest) + 2);
+    }
+
+    /** The shortest line's delay over samples offset to offset + numSamples
+        of the interval. A chunk must be shorter than this, less the read's
+        own limits.
+    */
+    double getShortestDelay (int offset, int numSamples) const noexcept
+    {
+        double shortest = mMaximumDelay;
+
+        for (int line = 0; line < mNumLines; ++line)
+            shortest = juce::jmin (shortest,
+                                   mDelayStart[line] + mDelayIncrement[line] * (offset + 1),
+                                   mDelayStart[line] + mDelayIncrement[line] * (offset + numSamples));
+
+        return shortest;
+    }
+
+    //==============================================================================
+    /** Runs numSamples samples of the network. Each line is fed its channel
+        of inputs plus the mixed feedback at gain(n) = feedbackStart +
+        feedbackIncrement * n, sample i at n = offset + i + 1, and outputs
+        are filled with what the lines give each channel. lineInputs is set
+        to what each line was fed, which is what later echoes come from.
+    */
+    template <typename Sample>
+    void process (const Sample* const* inputs, Sample* const* outputs, const Sample** lineInputs, int numSamples,
+                  Sample feedbackStart, Sample feedbackIncrement, int offset) noexcept
+    {
+        jassert (mNumLines > 0 && numSamples < mScratchStride);
+
+        const int numLines = mNumLines;
+        Sample* const scratch = juce::snapPointerToAlignment (reinterpret_cast<Sample*> (mScratch.get()), (size_t) 64);
+        Sample* reads[kMaxLines];
+        Sample* damped[kMaxLines];
+
+        for (int line = 0; line < numLines; ++line)
+        {
+            reads[line] = scratch + (size_t) line * (size_t) mScratchStride;
+            damped[line] = reads[line] + (size_t) kMaxLines * (size_t) mScratchStride;
+        }
+
+        // each line is read from one sample before the chunk, so the damping
+        // has its earlier tap without keeping any state between chunks
+        const double normalisation = 1.0 / std::sqrt ((double) numLines);
+        const Sample taps[2] = { (Sample) (mDamping * normalisation), (Sample) ((1.0 - mDamping) * normalisation) };
+
+        for (int line = 0; line < numLines; ++line)
+        {
+            mLines.read<Interpolators::Linear> (line, reads[line], numSamples + 1,
+                                                mDelayStart[line] + 1.0, mDelayIncrement[line], offset - 1);
+
+            if (mUseSimd)
+            {
+               #if JUCE_USE_SIMD
+                DelayKernels::firSimd<2> (damped[line], reads[line], numSamples, taps);
+               #endif
+            }
+            else
+            {
+                DelayKernels::firScalar<2> (damped[line], reads[line], numSamples, taps);
+            }
+        }
+
+        // each channel hears the lines it feeds, scaled so the first trip
+        // carries as much as one echo of the ordinary delay. wider layouts
+        // than the network share its lines
+        for (int channel = 0; channel < mNumChannels; ++channel)
+        {
+            int numHeard = 0;
+
+            for (int line = channel % numLines; line < numLines; line += mNumChannels)
+                ++numHeard;
+
+            const Sample gain = (Sample) std::sqrt ((double) numLines / (double) numHeard);
+
+            for (int line = channel % numLines, i = 0; line < numLines; line += mNumChannels, ++i)
+            {
+                if (i == 0)
+                    juce::FloatVectorOperations::copyWithMultiply (outputs[channel], damped[line], gain, numSamples);
+                else
+                    juce::FloatVectorOperations::addWithMultiply (outputs[channel], damped[line], gain, numSamples);
+            }
+        }
+
+        // the Hadamard matrix as 4-point transforms over whole chunks: 16
+        // lines are 4 x 4, first within each group of four consecutive lines,
+        // then across the groups. 8 lines are 4 x 2
+        for (int first = 0; first < numLines; first += 4)
+            hadamard4 (damped[first], damped[first + 1], damped[first + 2], damped[first + 3], numSamples);
+
+        for (int line = 0; line < 4; ++line)
+        {
+            if (numLines == kMaxLines)
+                hadamard4 (damped[line], damped[line + 4], damped[line + 8], damped[line + 12], numSamples);
+            else
+                hadamard2 (damped[line], damped[line + 4], numSamples);
+        }
+
+        // the read buffers are free again, so the lines' inputs go there
+        for (int line = 0; line < numLines; ++line)
+        {
+            Sample* const dest = reads[line];
+            const Sample* const input = inputs[line % mNumChannels];
+
+            if (mUseSimd)
+            {
+               #if JUCE_USE_SIMD
+                DelayKernels::addScaledSimd<Sample> (dest, input, damped[line], numSamples, feedbackStart, feedbackIncrement, offset);
+               #endif
+            }
+            else
+            {
+                DelayKernels::addScaledScalar<Sample> (dest, input, damped[line], numSamples, feedbackStart, feedbackIncrement, offset);
+            }
+
+            mLines.write (line, dest, numSamples);
+            lineInputs[line] = dest;
+        }
+
+        mLines.advance (numSamples);
+    }
+
+    /** Moves the write position on without writing, while the engine is idle. */
+    void advance (int numSamples)       { mLines.advance (numSamples); }
+
+private:
+    template <typename Sample>
+    void hadamard2 (Sample* a, Sample* b, int numSamples) const noexcept
+    {
+        if (mUseSimd)
+        {
+           #if JUCE_USE_SIMD
+            DelayKernels::hadamard2Simd (a, b, numSamples);
+           #endif
+        }
+        else
+        {
+            DelayKernels::hadamard2Scalar (a, b, numSamples);
+        }
+    }
+
+    template <typename Sample>
+    void hadamard4 (Sample* a, Sample* b, Sample* c, Sample* d, int numSamples) const noexcept
+    {
+        if (mUseSimd)
+        {
+           #if JUCE_USE_SIMD
+            DelayKernels::hadamard4Simd (a, b, c, d, numSamples);
+           #endif
+        }
+        else
+        {
+            DelayKernels::hadamard4Scalar (a, b, c, d, numSamples);
+        }
+    }
+
+    //==============================================================================
+    DelayLine mLines;
+
+    int mNumLines = 0;
+    int mNumChannels = 1;
+    double mMaximumDelay = 0.0;
+    double mDamping = 0.0;
+    bool mUseSimd = false;
+
+    double mDelayStart[kMaxLines] = {};
+    double mDelayIncrement[kMaxLines] = {};
+
+    // per line: the read, then the damped and mixed signal, with room for
+    // double samples when the float path uses it
+    juce::HeapBlock<double> mScratch;
+    int mScratchStride = 0;
+
+    JUCE_LEAK_DETECTOR (FeedbackDelayNetwork)
+};
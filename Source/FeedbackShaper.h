@@ -0,0 +1,244 @@
+/*
+  ==============================================================================
+
+    FeedbackShaper.h
+
+    Tone shaping and saturation for what goes round the feedback loop: a
+    one-pole low cut, then a tape-style saturator, then a one-pole high cut.
+    It sits on the feedback path only, ahead of the feedback gain, so the
+    first echo is heard as it was played and every trip after it passes the
+    shaper once more. Each repeat comes back a little darker and softer
+    than the last, the way tape and bucket-brigade delays do.
+
+    The saturator runs behind juce::dsp::Oversampling, 2x with polyphase
+    IIR halfband filters, so its harmonics don't fold back down as aliases.
+    The oversampler has a few samples of latency. The processor reads the
+    feedback that much earlier than the wet signal, so the repeats keep
+    their spacing.
+
+    Every stage is skipped while it is off: the low cut at its lowest
+    setting, the high cut at its highest and the saturator and oversampler
+    while drive is zero. At the defaults nothing here runs at all.
+
+    The filters are recursive along each channel, so they stay scalar
+    loops. The saturator has no state and runs in the SIMD kernels.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+#include "DelayKernels.h"
+
+//==============================================================================
+class FeedbackShaper
+{
+public:
+    /** The low cut is off at its lowest setting, the high cut at its highest. */
+    static constexpr float kLowCutOffHz = 20.0f;
+    static constexpr float kHighCutOffHz = 20000.0f;
+
+    /** Drive at full: the saturator's input gain, 12 dB. */
+    static constexpr double kMaxDriveGain = 4.0;
+
+    //==============================================================================
+    /** Builds the oversampler for numChannels channels at the precision the
+        processor runs at, for blocks up to maximumBlockSize. Allocates, so
+        call it from prepareToPlay.
+    */
+    void prepare (double sampleRate, int numChannels, int maximumBlockSize, bool useDoublePrecision)
+    {
+        jassert (numChannels > 0 && numChannels <= CrossFeedMatrix::kMaxChannels);
+
+        mSampleRate = sampleRate;
+        mFloatOversampling.reset();
+        mDoubleOversampling.reset();
+
+        if (useDoublePrecision)
+            mLatency = createOversampling (mDoubleOversampling, numChannels, maximumBlockSize);
+        else
+            mLatency = createOversampling (mFloatOversampling, numChannels, maximumBlockSize);
+
+        mLowCutCoefficient = getCoefficient (mLowCutHz);
+        mHighCutCoefficient = getCoefficient (mHighCutHz);
+        reset();
+    }
+
+    /** Clears the filters and the oversampler. */
+    void reset() noexcept
+    {
+        juce::zeromem (mLowCutState, sizeof (mLowCutState));
+        juce::zeromem (mHighCutState, sizeof (mHighCutState));
+
+        if (mFloatOversampling != nullptr)
+            mFloatOversampling->reset();
+
+        if (mDoubleOversampling != nullptr)
+            mDoubleOversampling->reset();
+    }
+
+    /** Takes up new settings. The processor calls this at the start of each
+        control interval, so the settings only change on the control grid.
+        drive runs from 0 to 1. The oversampler is cleared as it comes back
+        on, so it doesn't replay what it held when drive last went to zero.
+    */
+    void setParameters (float lowCutHz, float highCutHz, float drive) noexcept
+    {
+        if (lowCutHz != mLowCutHz)
+        {
+            mLowCutHz = lowCutHz;
+            mLowCutCoefficient = getCoefficient (lowCutHz);
+        }
+
+        if (highCutHz != mHighCutHz)
+        {
+            mHighCutHz = highCutHz;
+            mHighCutCoefficient = getCoefficient (highCutHz);
+        }
+
+        const bool wasSaturating = isSaturating();
+
+        mDrive = juce::jlimit (0.0f, 1.0f, drive);
+        mDriveGain = 1.0 + (kMaxDriveGain - 1.0) * mDrive;
+
+        if (isSaturating() && ! wasSaturating)
+        {
+            if (mFloatOversampling != nullptr)
+                mFloatOversampling->reset();
+
+            if (mDoubleOversampling != nullptr)
+                mDoubleOversampling->reset();
+        }
+    }
+
+    bool isLowCutOn() const noexcept    { return mLowCutHz > kLowCutOffHz; }
+    bool isHighCutOn() const noexcept   { return mHighCutHz < kHighCutOffHz; }
+    bool isSaturating() const noexcept  { return mDrive > 0.0f; }
+    bool isActive() const noexcept      { return isLowCutOn() || isSaturating() || isHighCutOn(); }
+
+    /** Samples the shaper delays the loop by right now: the oversampler's
+        latency while the saturator runs, otherwise none.
+    */
+    int getLatency() const noexcept     { return isSaturating() ? mLatency : 0; }
+
+    //==============================================================================
+    /** Shapes numSamples samples of each channel in place. */
+    template <typename Sample>
+    void process (Sample* const* channels, int numChannels, int numSamples, bool useSimd) noexcept
+    {
+        if (isLowCutOn())
+            filter<true> (channels, numChannels, numSamples, mLowCutCoefficient, mLowCutState);
+
+        if (isSaturating())
+            saturate (channels, numChannels, numSamples, useSimd);
+
+        if (isHighCutOn())
+            filter<false> (channels, numChannels, numSamples, mHighCutCoefficient, mHighCutState);
+    }
+
+private:
+    //==============================================================================
+    template <typename Sample>
+    static int createOversampling (std::unique_ptr<juce::dsp::Oversampling<Sample>>& oversampling, int numChannels, int maximumBlockSize)
+    {
+        // integer latency, so the read positions can take it off exactly in
+        // jump mode as well as glide mode
+        oversampling = std::make_unique<juce::dsp::Oversampling<Sample>> ((size_t) numChannels, 1,
+                                                                          juce::dsp::Oversampling<Sample>::filterHalfBandPolyphaseIIR,
+                                                                          true, true);
+        oversampling->initProcessing ((size_t) maximumBlockSize);
+        return juce::roundToInt (oversampling->getLatencyInSamples());
+    }
+
+    juce::dsp::Oversampling<float>* getOversampling (float) const noexcept     { return mFloatOversampling.get(); }
+    juce::dsp::Oversampling<double>* getOversampling (double) const noexcept   { return mDoubleOversampling.get(); }
+
+    /** The one-pole's G for a cutoff: g / (1 + g) with g = tan (pi fc / fs),
+        the cutoff held below Nyquist.
+    */
+    double getCoefficient (float cutoffHz) const noexcept
+    {
+        const double cutoff = juce::jlimit (1.0, mSampleRate * 0.45, (double) cutoffHz);
+        const double g = std::tan (juce::MathConstants<double>::pi * cutoff / mSampleRate);
+        return g / (1.0 + g);
+    }
+
+    // the one-poles' state is kept as a double, which holds a float one
+    // exactly, so either precision can use it
+    template <bool kIsLowCut, typename Sample>
+    static void filter (Sample* const* channels, int numChannels, int numSamples, double coefficient,
+                        double* states) noexcept
+    {
+        Sample s[CrossFeedMatrix::kMaxChannels];
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            s[channel] = (Sample) states[channel];
+
+        DelayKernels::onePoleScalar<kIsLowCut> (channels, numChannels, numSamples, (Sample) coefficient, s);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            states[channel] = s[channel];
+    }
+
+    template <typename Sample>
+    void saturate (Sample* const* channels, int numChannels, int numSamples, bool useSimd) noexcept
+    {
+        const Sample amount = (Sample) mDrive;
+        const Sample gain = (Sample) mDriveGain;
+        const Sample inverseGain = (Sample) (1.0 / mDriveGain);
+
+        auto* oversampling = getOversampling (Sample());
+
+        // prepared for the other precision: a host that changes precision
+        // without preparing again gets the saturator without oversampling
+        jassert (oversampling != nullptr);
+
+        juce::dsp::AudioBlock<Sample> block (channels, (size_t) numChannels, (size_t) numSamples);
+        juce::dsp::AudioBlock<Sample> oversampled = block;
+
+        if (oversampling != nullptr)
+            oversampled = oversampling->processSamplesUp (block);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            Sample* const data = oversampled.getChannelPointer ((size_t) channel);
+            const int length = (int) oversampled.getNumSamples();
+
+            if (useSimd)
+            {
+               #if JUCE_USE_SIMD
+                DelayKernels::saturateSimd<Sample> (data, length, amount, gain, inverseGain);
+               #endif
+            }
+            else
+            {
+                DelayKernels::saturateScalar<Sample> (data, length, amount, gain, inverseGain);
+            }
+        }
+
+        if (oversampling != nullptr)
+            oversampling->processSamplesDown (block);
+    }
+
+    //==============================================================================
+    double mSampleRate = 44100.0;
+
+    float mLowCutHz = kLowCutOffHz;
+    float mHighCutHz = kHighCutOffHz;
+    float mDrive = 0.0f;
+    double mLowCutCoefficient = 0.0;
+    double mHighCutCoefficient = 0.0;
+    double mDriveGain = 1.0;
+
+    double mLowCutState[CrossFeedMatrix::kMaxChannels] = {};
+    double mHighCutState[CrossFeedMatrix::kMaxChannels] = {};
+
+    // only the one for the precision the processor was prepared at exists
+    std::unique_ptr<juce::dsp::Oversampling<float>> mFloatOversampling;
+    std::unique_ptr<juce::dsp::Oversampling<double>> mDoubleOversampling;
+    int mLatency = 0;
+
+    JUCE_LEAK_DETECTOR (FeedbackShaper)
+};
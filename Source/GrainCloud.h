@@ -0,0 +1,394 @@
+/*
+  ==============================================================================
+
+    GrainCloud.h
+
+    The reverse and granular playback modes. Instead of one read head per
+    channel, the wet signal is a stream of short windowed grains read from
+    the delay lines. In granular mode each grain plays a stretch of the
+    history forwards; in reverse mode it plays it backwards, so every echo
+    arrives back to front. The grains' output is what feeds back, so each
+    trip round the loop is grained again.
+
+    A grain starts every 1 / density seconds, jittered in time, and reads
+    from the channel's delay time at its start plus a jittered offset, so it
+    always reads at least the delay time back. A reverse grain reads its
+    stretch from the far end, two samples further back for every sample it
+    plays. Grains read whole samples, so gliding the delay time only moves
+    where new grains start and never bends their pitch.
+
+    The grains live in a fixed pool of kMaxGrains voices allocated with the
+    object. A grain that starts while every voice is busy is dropped, so
+    however high the density, a sample never costs more than kMaxGrains
+    reads and multiply-adds per channel. Each grain is rendered as whole
+    runs: its window is looked up once from a table built at startup and
+    shared by every instance, then each channel's stretch is read from the
+    line and added in under the window with FloatVectorOperations.
+
+    Grains start and end on exact sample counts and the jitter comes from a
+    seeded generator, so the output doesn't depend on how the calls are
+    split. The voices are kept in the order they started, so overlapping
+    grains are always summed in the same order too.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+#include "DelayKernels.h"
+#include "DelayLine.h"
+
+//==============================================================================
+class GrainCloud
+{
+public:
+    static constexpr int kMaxGrains = 32;
+
+    /** The modes in the order of the "Playback" parameter. Normal leaves the
+        read heads to the processor.
+    */
+    enum class Mode
+    {
+        normal = 0,
+        reverse,
+        granular
+    };
+
+    static juce::StringArray getModeNames()
+    {
+        return { "Normal", "Reverse", "Granular" };
+    }
+
+    /** The windows in the order of the "Grain Shape" parameter. */
+    enum class Shape
+    {
+        hann = 0,
+        triangle,
+        tukey           // flat in the middle half, so grains overlap less
+    };
+
+    static juce::StringArray getShapeNames()
+    {
+        return { "Hann", "Triangle", "Tukey" };
+    }
+
+    static constexpr int kNumShapes = 3;
+    static constexpr int kTableBits = 11;
+    static constexpr int kTableSize = 1 << kTableBits;
+
+    //==============================================================================
+    struct Tables
+    {
+        Tables()
+        {
+            for (int shape = 0; shape < kNumShapes; ++shape)
+            {
+                double sum = 0.0;
+
+                for (int i = 0; i <= kTableSize; ++i)
+                {
+                    const double x = (double) i / kTableSize;
+                    const double taper = juce::jmin (1.0, 4.0 * juce::jmin (x, 1.0 - x));
+                    double value = 0.0;
+
+                    switch ((Shape) shape)
+                    {
+                        case Shape::hann:       value = 0.5 - 0.5 * std::cos (juce::MathConstants<double>::twoPi * x); break;
+                        case Shape::triangle:   value = 1.0 - std::abs (1.0 - 2.0 * x); break;
+                        case Shape::tukey:      value = 0.5 - 0.5 * std::cos (juce::MathConstants<double>::pi * taper); break;
+                        default:                jassertfalse; break;
+                    }
+
+                    values[shape][i] = (float) value;
+
+                    if (i < kTableSize)
+                        sum += value;
+                }
+
+                means[shape] = (float) (sum / kTableSize);
+            }
+        }
+
+        // the last entry is the window's end, so a lookup can always blend
+        // towards the next entry
+        float values[kNumShapes][kTableSize + 1];
+
+        // how much each window passes on average, for levelling overlaps
+        float means[kNumShapes];
+    };
+
+    /** The shapes and their means, filled in the first time any cloud asks. */
+    static const Tables& getTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    //==============================================================================
+    /** Sizes the working memory for runs of up to maximumChunk samples.
+        Allocates, so call it from prepareToPlay.
+    */
+    void prepare (double sampleRate, int maximumChunk)
+    {
+        mSampleRate = sampleRate;
+        getTables();
+
+        // a window and a read, each starting on a 64-byte boundary
+        mScratchStride = (juce::jmax (1, maximumChunk) + 15) & ~15;
+        mScratch.allocate ((size_t) mScratchStride * 2 + 8, true);
+
+        reset();
+    }
+
+    /** Drops every grain and starts the jitter sequence again. */
+    void reset() noexcept
+    {
+        mNumGrains = 0;
+        mSamplesToNextGrain = 0;
+        mRandom.setSeed (kSeed);
+    }
+
+    /** Takes up new settings. The processor calls this at the start of each
+        control interval. jitter runs from 0 to 1. Switching to normal drops
+        every grain; switching out of it starts the first grain straight away.
+    */
+    void setParameters (Mode mode, float sizeMilliseconds, float densityHz, float jitter, Shape shape) noexcept
+    {
+        if ((mode == Mode::normal) != (mMode == Mode::normal))
+        {
+            mNumGrains = 0;
+            mSamplesToNextGrain = 0;
+        }
+
+        mMode = mode;
+        mShape = shape;
+        mJitter = juce::jlimit (0.0f, 1.0f, jitter);
+        mGrainLength = juce::jmax (16, juce::roundToInt (mSampleRate * sizeMilliseconds * 0.001));
+        mGrainInterval = mSampleRate / juce::jmax (0.01f, densityHz);
+
+        // overlapping windows add up to their mean times the number playing
+        // at once, which is held to one so a dense cloud is no louder than
+        // the line. sparse clouds leave gaps instead
+        const double overlap = juce::jmin ((double) kMaxGrains, mGrainLength / mGrainInterval);
+        mGain = (float) (1.0 / juce::jmax (1.0, getTables().means[(int) shape] * overlap));
+    }
+
+    bool isActive() const noexcept      { return mMode != Mode::normal; }
+    Mode getMode() const noexcept       { return mMode; }
+
+    /** How much further back than the delay time a new grain can read, in
+        samples: the jitter, and a reverse grain's run back through its stretch.
+    */
+    int getReach() const noexcept
+    {
+        const int jitter = (int) std::ceil (mJitter * (float) mGrainLength);
+        return mMode == Mode::reverse ? jitter + 2 * mGrainLength : jitter;
+    }
+
+    /** The furthest back any playing grain will still read, in samples. */
+    int getDeepestDelay() const noexcept
+    {
+        int deepest = 0;
+
+        for (int i = 0; i < mNumGrains; ++i)
+            for (int channel = 0; channel < mNumChannels; ++channel)
+                deepest = juce::jmax (deepest, getDelay (mGrains[i], channel, mGrains[i].length - 1));
+
+        return deepest;
+    }
+
+    /** The shortest delay any playing grain reads at now. A run must be
+        shorter than this as well as the delay times.
+    */
+    int getShortestDelay() const noexcept
+    {
+        int shortest = std::numeric_limits<int>::max();
+
+        for (int i = 0; i < mNumGrains; ++i)
+            for (int channel = 0; channel < mNumChannels; ++channel)
+                shortest = juce::jmin (shortest, getDelay (mGrains[i], channel, mGrains[i].age));
+
+        return shortest;
+    }
+
+    //==============================================================================
+    /** Renders numSamples of the grains into outputs, one per channel. Grains
+        that start in the run read from the channels' delay ramps, in samples
+        as DelayLine::read() takes them, at n = offset + i + 1 for sample i.
+        Reads happen before the run is written to the lines, so the run must
+        be shorter than getShortestDelay() and the ramps' shortest delay.
+    */
+    template <typename Sample>
+    void process (DelayLine& lines, Sample* const* outputs, int numChannels, int numSamples,
+                  const double* delayStart, const double* delayIncrement, int offset) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            juce::FloatVectorOperations::clear (outputs[channel], numSamples);
+
+        run (&lines, outputs, numChannels, numSamples, delayStart, delayIncrement, offset);
+    }
+
+    /** Moves the grains on without reading them, while the engine is idle,
+        so they start and end where they would have done.
+    */
+    void advance (int numSamples, const double* delayStart, const double* delayIncrement, int numChannels, int offset) noexcept
+    {
+        run<float> (nullptr, nullptr, numChannels, numSamples, delayStart, delayIncrement, offset);
+    }
+
+private:
+    struct Grain
+    {
+        int age;
+        int length;
+        juce::uint32 phaseIncrement;
+        float gain;
+        Shape shape;
+        bool isReversed;
+        int delays[CrossFeedMatrix::kMaxChannels];   // at the grain's first sample
+    };
+
+    static constexpr juce::int64 kSeed = 0x4b61646e;
+
+    // one pass through a window
+    static constexpr double kPhaseScale = 4294967296.0;
+
+    /** The delay a grain reads its sample at age from on a channel. */
+    static int getDelay (const Grain& grain, int channel, int age) noexcept
+    {
+        return grain.isReversed ? grain.delays[channel] + 2 * age : grain.delays[channel];
+    }
+
+    /** Runs the grains through numSamples, splitting where grains start, so
+        a voice that ends is free again for the next one. Renders them into
+        outputs when lines is set.
+    */
+    template <typename Sample>
+    void run (DelayLine* lines, Sample* const* outputs, int numChannels, int numSamples,
+              const double* delayStart, const double* delayIncrement, int offset) noexcept
+    {
+        mNumChannels = numChannels;
+        int position = 0;
+
+        while (position < numSamples)
+        {
+            if (mSamplesToNextGrain == 0)
+                startGrain (numChannels, delayStart, delayIncrement, offset + position);
+
+            const int length = juce::jmin (numSamples - position, mSamplesToNextGrain);
+            int numPlaying = 0;
+
+            for (int i = 0; i < mNumGrains; ++i)
+            {
+                Grain& grain = mGrains[i];
+                const int numRendered = juce::jmin (length, grain.length - grain.age);
+
+                if (lines != nullptr)
+                    renderGrain (*lines, grain, outputs, numChannels, position, numRendered);
+
+                grain.age += numRendered;
+
+                // finished grains drop out without changing the others' order
+                if (grain.age < grain.length)
+                    mGrains[numPlaying++] = grain;
+            }
+
+            mNumGrains = numPlaying;
+            mSamplesToNextGrain -= length;
+            position += length;
+        }
+    }
+
+    /** Starts a grain at n = position of the delay ramps, if a voice is
+        free, and schedules the next one.
+    */
+    void startGrain (int numChannels, const double* delayStart, const double* delayIncrement, int position) noexcept
+    {
+        // the jitter is drawn whether or not there is a voice for the grain,
+        // so the sequence doesn't depend on how many are playing
+        float offsets[CrossFeedMatrix::kMaxChannels];
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            offsets[channel] = mRandom.nextFloat() * mJitter * (float) mGrainLength;
+
+        const double spacing = mGrainInterval * (1.0 + mJitter * (mRandom.nextDouble() - 0.5));
+        mSamplesToNextGrain = juce::jmax (1, juce::roundToInt (spacing));
+
+        if (mNumGrains == kMaxGrains)
+            return;
+
+        Grain& grain = mGrains[mNumGrains++];
+        grain.age = 0;
+        grain.length = mGrainLength;
+        grain.phaseIncrement = (juce::uint32) (kPhaseScale / mGrainLength);
+        grain.gain = mGain;
+        grain.shape = mShape;
+        grain.isReversed = mMode == Mode::reverse;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            grain.delays[channel] = juce::roundToInt (delayStart[channel] + delayIncrement[channel] * (position + 1))
+                                  + (int) offsets[channel];
+    }
+
+    /** Adds numSamples of a grain into outputs from sample position on. */
+    template <typename Sample>
+    void renderGrain (DelayLine& lines, const Grain& grain, Sample* const* outputs, int numChannels,
+                      int position, int numSamples) noexcept
+    {
+        Sample* const window = juce::snapPointerToAlignment (reinterpret_cast<Sample*> (mScratch.get()), (size_t) 64);
+        Sample* const read = window + mScratchStride;
+
+        // the window is looked up once and shared by every channel. the
+        // phase never wraps, as the grain ends before it would
+        const float* const table = getTables().values[(int) grain.shape];
+        const juce::uint32 start = grain.phaseIncrement * (juce::uint32) grain.age;
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float value = DelayKernels::lookUpTable<kTableBits> (table, start + grain.phaseIncrement * (juce::uint32) i);
+            window[i] = (Sample) (value * grain.gain);
+        }
+
+        // the line's reads are relative to the start of the run. a reverse
+        // grain's stretch is read forwards from its far end and turned round
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            if (grain.isReversed)
+            {
+                const int delay = getDelay (grain, channel, grain.age) + numSamples - 1 - position;
+                lines.read<Interpolators::None> (channel, read, numSamples, (double) delay, 0.0, 0);
+                std::reverse (read, read + numSamples);
+            }
+            else
+            {
+                lines.read<Interpolators::None> (channel, read, numSamples, (double) (grain.delays[channel] - position), 0.0, 0);
+            }
+
+            juce::FloatVectorOperations::addWithMultiply (outputs[channel] + position, read, window, numSamples);
+        }
+    }
+
+    //==============================================================================
+    double mSampleRate = 44100.0;
+
+    Mode mMode = Mode::normal;
+    Shape mShape = Shape::hann;
+    float mJitter = 0.0f;
+    float mGain = 1.0f;
+    int mGrainLength = 4410;
+    double mGrainInterval = 4410.0;
+
+    Grain mGrains[kMaxGrains];
+    int mNumGrains = 0;
+    int mNumChannels = 0;
+    int mSamplesToNextGrain = 0;
+    juce::Random mRandom;
+
+    // a window and a read, laid out for the wider of the two sample types
+    juce::HeapBlock<double> mScratch;
+    int mScratchStride = 0;
+
+    JUCE_LEAK_DETECTOR (GrainCloud)
+};
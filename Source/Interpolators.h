@@ -0,0 +1,306 @@
+/*
+  ==============================================================================
+
+    Interpolators.h
+
+    Fractional-delay interpolation policies for DelayLine::read. Each policy
+    is a plain struct used as a template argument, so the kernel is inlined
+    into the read loop and chosen once per block rather than per sample.
+
+    Every policy reads kTaps consecutive samples starting kBefore samples
+    before the integer read position; fraction is the distance from that
+    integer position towards the next sample.
+
+    FIR policies also provide getCoefficients(), which the constant-delay
+    read uses to run a fixed-coefficient filter over a whole run. Recursive
+    policies (Thiran) carry State for each channel and read stream and are
+    always run in order.
+
+    Each policy is written once for float and double samples: the fraction,
+    the coefficients and the arithmetic all take the sample type.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+namespace Interpolators
+{
+    /** The policies in the order of the "Interpolation" parameter. */
+    enum class Quality
+    {
+        linear = 0,
+        cubicHermite,
+        lagrange,
+        thiran,
+        sinc
+    };
+
+    inline juce::StringArray getQualityNames()
+    {
+        return { "Linear", "Cubic Hermite", "Lagrange", "Thiran Allpass", "Sinc" };
+    }
+
+    /** State for the FIR policies, which have none. */
+    struct NoState
+    {
+        void reset() noexcept {}
+    };
+
+    //==============================================================================
+    /** No interpolation: reads the sample at the integer position. Used by
+        the jump delay-time mode, whose read heads only sit on whole samples.
+    */
+    struct None
+    {
+        static constexpr int kBefore = 0;
+        static constexpr int kTaps = 1;
+        static constexpr bool kIsRecursive = false;
+        using State = NoState;
+
+        template <typename Sample>
+        static void getCoefficients (Sample, Sample* c) noexcept
+        {
+            c[0] = Sample (1);
+        }
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample, State&) noexcept
+        {
+            return x[0];
+        }
+    };
+
+    //==============================================================================
+    struct Linear
+    {
+        static constexpr int kBefore = 0;
+        static constexpr int kTaps = 2;
+        static constexpr bool kIsRecursive = false;
+        using State = NoState;
+
+        template <typename Sample>
+        static void getCoefficients (Sample fraction, Sample* c) noexcept
+        {
+            c[0] = Sample (1) - fraction;
+            c[1] = fraction;
+        }
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample fraction, State&) noexcept
+        {
+            return x[0] + fraction * (x[1] - x[0]);
+        }
+    };
+
+    //==============================================================================
+    /** Four-point Catmull-Rom spline. */
+    struct CubicHermite
+    {
+        static constexpr int kBefore = 1;
+        static constexpr int kTaps = 4;
+        static constexpr bool kIsRecursive = false;
+        using State = NoState;
+
+        template <typename Sample>
+        static void getCoefficients (Sample f, Sample* c) noexcept
+        {
+            const Sample f2 = f * f;
+            const Sample f3 = f2 * f;
+
+            c[0] = Sample (-0.5) * f3 + f2 - Sample (0.5) * f;
+            c[1] = Sample (1.5) * f3 - Sample (2.5) * f2 + Sample (1);
+            c[2] = Sample (-1.5) * f3 + Sample (2) * f2 + Sample (0.5) * f;
+            c[3] = Sample (0.5) * f3 - Sample (0.5) * f2;
+        }
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample f, State&) noexcept
+        {
+            const Sample c1 = Sample (0.5) * (x[2] - x[0]);
+            const Sample c2 = x[0] - Sample (2.5) * x[1] + Sample (2) * x[2] - Sample (0.5) * x[3];
+            const Sample c3 = Sample (0.5) * (x[3] - x[0]) + Sample (1.5) * (x[1] - x[2]);
+            return ((c3 * f + c2) * f + c1) * f + x[1];
+        }
+    };
+
+    //==============================================================================
+    /** Third-order Lagrange polynomial through four points. */
+    struct Lagrange
+    {
+        static constexpr int kBefore = 1;
+        static constexpr int kTaps = 4;
+        static constexpr bool kIsRecursive = false;
+        using State = NoState;
+
+        template <typename Sample>
+        static void getCoefficients (Sample f, Sample* c) noexcept
+        {
+            const Sample fm1 = f - Sample (1);
+            const Sample fm2 = f - Sample (2);
+            const Sample fp1 = f + Sample (1);
+            const Sample sixth = Sample (1) / Sample (6);
+
+            c[0] = -f * fm1 * fm2 * sixth;
+            c[1] = fp1 * fm1 * fm2 * Sample (0.5);
+            c[2] = -fp1 * f * fm2 * Sample (0.5);
+            c[3] = fp1 * f * fm1 * sixth;
+        }
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample f, State&) noexcept
+        {
+            Sample c[kTaps];
+            getCoefficients (f, c);
+            return c[0] * x[0] + c[1] * x[1] + c[2] * x[2] + c[3] * x[3];
+        }
+    };
+
+    //==============================================================================
+    /** First-order Thiran allpass. Flat magnitude response, so modulated
+        delays don't lose top end, at the cost of running sample by sample.
+        The allpass delay is kept between 0.618 and 1.618 samples, where its
+        phase response is most linear.
+    */
+    struct Thiran
+    {
+        static constexpr int kBefore = 0;
+        static constexpr int kTaps = 3;
+        static constexpr bool kIsRecursive = true;
+
+        // held as a double, which keeps a float output exactly, so one state
+        // serves either sample type
+        struct State
+        {
+            double previousOutput = 0.0;
+
+            void reset() noexcept   { previousOutput = 0.0; }
+        };
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample f, State& state) noexcept
+        {
+            // allpass delay measured back from the newer of the two taps
+            const bool useLaterPair = f > Sample (0.382);
+            const Sample delay = useLaterPair ? Sample (2) - f : Sample (1) - f;
+            const Sample older = useLaterPair ? x[1] : x[0];
+            const Sample newer = useLaterPair ? x[2] : x[1];
+
+            const Sample alpha = (Sample (1) - delay) / (Sample (1) + delay);
+            const Sample output = older + alpha * (newer - (Sample) state.previousOutput);
+            state.previousOutput = output;
+            return output;
+        }
+    };
+
+    //==============================================================================
+    /** Kaiser-windowed sinc, read from a polyphase table. Each phase stores
+        its coefficients and the step to the next phase, so fractions between
+        table phases are interpolated rather than rounded. The table is
+        float, which is well inside its stopband, for either sample type.
+    */
+    struct Sinc
+    {
+        static constexpr int kBefore = 3;
+        static constexpr int kTaps = 8;
+        static constexpr int kPhases = 256;
+        static constexpr bool kIsRecursive = false;
+        using State = NoState;
+
+        struct Table
+        {
+            Table()
+            {
+                constexpr double cutoff = 0.92;
+                constexpr double beta = 7.0;
+                constexpr double halfLength = kTaps / 2;
+
+                auto besselI0 = [] (double x)
+                {
+                    double sum = 1.0, term = 1.0;
+
+                    for (int k = 1; k < 32; ++k)
+                    {
+                        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                        sum += term;
+                    }
+
+                    return sum;
+                };
+
+                const double windowNorm = besselI0 (beta);
+                double phaseTaps[kPhases + 1][kTaps];
+
+                for (int phase = 0; phase <= kPhases; ++phase)
+                {
+                    const double fraction = (double) phase / kPhases;
+                    double sum = 0.0;
+
+                    for (int tap = 0; tap < kTaps; ++tap)
+                    {
+                        const double t = (double) (tap - kBefore) - fraction;
+                        const double arg = juce::MathConstants<double>::pi * cutoff * t;
+                        const double sinc = std::abs (t) < 1.0e-9 ? 1.0 : std::sin (arg) / arg;
+                        const double r = t / halfLength;
+                        const double window = std::abs (r) >= 1.0 ? 0.0
+                                                                  : besselI0 (beta * std::sqrt (1.0 - r * r)) / windowNorm;
+                        phaseTaps[phase][tap] = sinc * window;
+                        sum += phaseTaps[phase][tap];
+                    }
+
+                    // unity gain at DC for every phase so modulation doesn't
+                    // turn into amplitude ripple
+                    for (int tap = 0; tap < kTaps; ++tap)
+                        phaseTaps[phase][tap] /= sum;
+                }
+
+                for (int phase = 0; phase < kPhases; ++phase)
+                {
+                    for (int tap = 0; tap < kTaps; ++tap)
+                    {
+                        coefficients[phase][tap] = (float) phaseTaps[phase][tap];
+                        deltas[phase][tap] = (float) (phaseTaps[phase + 1][tap] - phaseTaps[phase][tap]);
+                    }
+                }
+            }
+
+            alignas (32) float coefficients[kPhases][kTaps];
+            alignas (32) float deltas[kPhases][kTaps];
+        };
+
+        /** One table for the whole process, made by the first read that needs it. */
+        static const Table& getTable()
+        {
+            static const Table table;
+            return table;
+        }
+
+        template <typename Sample>
+        static void getCoefficients (Sample fraction, Sample* c) noexcept
+        {
+            const auto& table = getTable();
+            const Sample position = fraction * (Sample) kPhases;
+            const int phase = juce::jmin ((int) position, kPhases - 1);
+            const Sample blend = position - (Sample) phase;
+
+            for (int tap = 0; tap < kTaps; ++tap)
+                c[tap] = (Sample) table.coefficients[phase][tap] + blend * (Sample) table.deltas[phase][tap];
+        }
+
+        template <typename Sample>
+        static Sample interpolate (const Sample* x, Sample fraction, State&) noexcept
+        {
+            Sample c[kTaps];
+            getCoefficients (fraction, c);
+
+            Sample sum = 0;
+
+            for (int tap = 0; tap < kTaps; ++tap)
+                sum += c[tap] * x[tap];
+
+            return sum;
+        }
+    };
+}
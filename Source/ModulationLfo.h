@@ -0,0 +1,132 @@
+/*
+  ==============================================================================
+
+    ModulationLfo.h
+
+    The LFO that moves the read heads for chorus, flanging and tape wow and
+    flutter. Each shape is a wavetable built once and shared by every
+    instance; a run of the LFO is a table lookup and a linear blend per
+    sample, with no sin or cos on the audio thread.
+
+    The phase is a 32-bit fixed-point accumulator that wraps by itself.
+    Sample i of a run sits at phase + increment * i, which is exact, so the
+    LFO gives the same value at a sample however the runs are split.
+
+    The output is unipolar, 0 to 1: the processor adds depth times it to
+    the delay, so modulation only ever lengthens the delay and never reads
+    closer to the write position than the delay time does.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "DelayKernels.h"
+
+//==============================================================================
+class ModulationLfo
+{
+public:
+    /** The shapes in the order of the "Mod Shape" parameter. */
+    enum class Shape
+    {
+        sine = 0,
+        triangle,
+        tape            // slow wow with faster flutter on top
+    };
+
+    static juce::StringArray getShapeNames()
+    {
+        return { "Sine", "Triangle", "Tape" };
+    }
+
+    static constexpr int kNumShapes = 3;
+    static constexpr int kTableBits = 11;
+    static constexpr int kTableSize = 1 << kTableBits;
+
+    //==============================================================================
+    struct Tables
+    {
+        Tables()
+        {
+            for (int i = 0; i <= kTableSize; ++i)
+            {
+                const double x = (double) (i % kTableSize) / kTableSize;
+                const double angle = juce::MathConstants<double>::twoPi * x;
+
+                // each starts from 0 at phase 0 and stays within 0 to 1. the
+                // tape shape's flutter is a whole number of cycles per wow
+                // cycle, so it repeats with the table
+                const double wow = 0.5 - 0.5 * std::cos (angle);
+                const double flutter = 0.5 - 0.5 * std::cos (angle * 7.0);
+
+                values[(int) Shape::sine][i] = (float) wow;
+                values[(int) Shape::triangle][i] = (float) (1.0 - std::abs (1.0 - 2.0 * x));
+                values[(int) Shape::tape][i] = (float) (0.8 * wow + 0.2 * flutter);
+            }
+        }
+
+        // one guard entry past the end, equal to the first, so a lookup can
+        // always blend towards the next entry
+        float values[kNumShapes][kTableSize + 1];
+    };
+
+    /** A function-local static, so every LFO reads the same copy. */
+    static const Tables& getTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    //==============================================================================
+    void prepare (double sampleRate) noexcept
+    {
+        mSampleRate = sampleRate;
+        getTables();
+        reset();
+    }
+
+    /** Starts the LFO again from phase 0. */
+    void reset() noexcept       { mPhase = 0; }
+
+    /** Takes up new settings. The processor calls this at the start of each
+        control interval. stereoDegrees is the phase spread from the first
+        channel to the last.
+    */
+    void setParameters (float rateHz, Shape shape, float stereoDegrees) noexcept
+    {
+        mIncrement = (juce::uint32) (juce::jlimit (0.0, 0.25, rateHz / mSampleRate) * kPhaseScale);
+        mShape = shape;
+        mSpread = (juce::uint32) (juce::jlimit (0.0, 1.0, stereoDegrees / 360.0) * (kPhaseScale - 1.0));
+    }
+
+    /** Writes numSamples of the LFO for one of numChannels channels,
+        starting at the current phase. Doesn't move the phase on.
+    */
+    template <typename Value>
+    void render (Value* dest, int numSamples, int channel, int numChannels) const noexcept
+    {
+        const float* const table = getTables().values[(int) mShape];
+        const double position = numChannels > 1 ? (double) channel / (numChannels - 1) : 0.0;
+        const juce::uint32 start = mPhase + (juce::uint32) (position * (double) mSpread);
+
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] = (Value) DelayKernels::lookUpTable<kTableBits> (table, start + mIncrement * (juce::uint32) i);
+    }
+
+    /** Moves the phase on by numSamples. */
+    void advance (int numSamples) noexcept      { mPhase += mIncrement * (juce::uint32) numSamples; }
+
+private:
+    // one cycle of phase
+    static constexpr double kPhaseScale = 4294967296.0;
+
+    double mSampleRate = 44100.0;
+    juce::uint32 mPhase = 0;
+    juce::uint32 mIncrement = 0;
+    juce::uint32 mSpread = 0;
+    Shape mShape = Shape::sine;
+
+    JUCE_LEAK_DETECTOR (ModulationLfo)
+};
@@ -0,0 +1,503 @@
+/*
+  ==============================================================================
+
+    MultiTapDelay.h
+
+    A feed-forward pattern of up to kMaxTaps taps on the mono sum of the
+    input, each with its own delay, gain and pan.
+
+    Sparse patterns are run directly: one multiply-add per tap and output
+    channel. Dense ones are run as a uniformly partitioned FFT convolution
+    instead. Only partitions that hold a tap are stored and multiplied, so
+    the cost follows the number of occupied partitions rather than the
+    number of taps, and stops growing once every partition is occupied.
+    Taps shorter than one partition are always run directly, which lets
+    the convolution work only from blocks that are already complete and so
+    add no latency.
+
+    setPattern() does all the heavy lifting (FFTs, allocation-free copies
+    into preallocated slots) on the message thread and hands the result to
+    the audio thread through a try-lock, so process() never blocks. That
+    includes clearing the history left over from while no taps were
+    active, which can run to megabytes at high sample rates.
+
+    process() takes float or double signals, but the history and the
+    convolution stay in float. The taps are feed-forward, so their rounding
+    never builds up the way it does round the feedback loop.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+
+//==============================================================================
+class MultiTapDelay
+{
+public:
+    static constexpr int kMaxTaps = 256;
+
+    /** Partition length of the convolution, and the shortest tap it handles. */
+    static constexpr int kPartitionSize = 512;
+
+    /** Cost of the convolution per sample and channel, in direct taps: each
+        occupied partition is a complex multiply-add per bin, and the inverse
+        transform is a fixed overhead on top. Automatic mode switches to the
+        convolution once the taps it would replace cost more than that.
+        Checked against the benchmark's multiTapCrossover output.
+    */
+    static constexpr int kTapsPerPartition = 4;
+    static constexpr int kTransformOverheadTaps = 32;
+
+    struct Tap
+    {
+        double delaySeconds = 0.5;
+        float gain = 1.0f;
+        float pan = 0.0f;       // -1 is the first channel, 1 the last
+    };
+
+    enum class Mode
+    {
+        automatic,
+        direct,
+        convolution
+    };
+
+    //==============================================================================
+    /** Allocates everything for numChannels outputs and taps up to
+        maximumDelaySeconds long, and re-applies the current pattern.
+    */
+    void prepare (double sampleRate, int numChannels, double maximumDelaySeconds)
+    {
+        jassert (numChannels > 0 && numChannels <= CrossFeedMatrix::kMaxChannels);
+
+        mSampleRate = sampleRate;
+        mNumChannels = numChannels;
+
+        const int maximumDelay = (int) std::ceil (sampleRate * maximumDelaySeconds);
+        mHistoryLength = juce::nextPowerOfTwo (maximumDelay + kPartitionSize * 2 + 1);
+        mHistory.allocate ((size_t) mHistoryLength, true);
+
+        // the ring holds the spectrum of every past window a tap can reach
+        mNumPartitions = maximumDelay / kPartitionSize + 2;
+        mSpectra.allocate ((size_t) mNumPartitions * kSpectrumSize, true);
+
+        mWindow.allocate ((size_t) kPartitionSize * 2, true);
+        mFftBuffer.allocate ((size_t) kFftSize * 2, true);
+        mOutput.allocate ((size_t) numChannels * kPartitionSize, true);
+
+        for (auto* pattern : { &mPatterns[0], &mPatterns[1] })
+            pattern->spectra.allocate ((size_t) kMaxTaps * (size_t) numChannels * kSpectrumSize, true);
+
+        mActive = &mPatterns[0];
+        mPending = &mPatterns[1];
+        mHasPending = false;
+
+        buildPattern (*mActive, mTaps);
+        reset();
+    }
+
+    /** Forgets the input history. The pattern stays. */
+    void reset()
+    {
+        if (mHistory == nullptr)
+            return;
+
+        juce::zeromem (mHistory, (size_t) mHistoryLength * sizeof (float));
+        juce::zeromem (mSpectra, (size_t) mNumPartitions * kSpectrumSize * sizeof (float));
+        juce::zeromem (mWindow, (size_t) kPartitionSize * 2 * sizeof (float));
+        juce::zeromem (mOutput, (size_t) mNumChannels * kPartitionSize * sizeof (float));
+
+        mHistoryPosition = 0;
+        mBlockPosition = 0;
+        mSpectrumIndex = 0;
+    }
+
+    //==============================================================================
+    /** Replaces the pattern. Call from the message thread; the audio thread
+        picks it up at the start of a later process() call. Taps past
+        kMaxTaps or the prepared maximum delay are dropped.
+    */
+    void setPattern (const juce::Array<Tap>& taps)
+    {
+        mTaps = taps;
+
+        if (mHistory == nullptr)
+            return;
+
+        const juce::SpinLock::ScopedLockType lock (mPatternLock);
+
+        // the audio thread doesn't touch the history while no taps are
+        // active, and can't pick the pattern up while this holds the lock,
+        // so what it stopped recording is cleared here rather than there
+        if (! isActive())
+            reset();
+
+        buildPattern (*mPending, taps);
+        mHasPending = true;
+    }
+
+    const juce::Array<Tap>& getPattern() const  { return mTaps; }
+
+    /** How many samples of input the taps can reach back over. */
+    int getHistoryLength() const                { return mHistoryLength; }
+
+    /** How the next setPattern() runs its taps. */
+    void setMode (Mode mode)                    { mMode = mode; }
+    Mode getMode() const                        { return mMode; }
+
+    /** True when the active pattern has any taps. Audio thread only, or
+        while holding the pattern lock.
+    */
+    bool isActive() const noexcept              { return mActive != nullptr && mActive->numTaps > 0; }
+
+    /** True when the active pattern runs through the convolution. Audio thread only. */
+    bool isUsingConvolution() const noexcept    { return mActive != nullptr && mActive->numPartitions > 0; }
+
+    //==============================================================================
+    /** Adds the taps of numSamples input samples to outputs. inputs and
+        outputs both have numChannels channels, at most the prepared count.
+    */
+    template <typename Sample>
+    void process (const Sample* const* inputs, Sample* const* outputs, int numChannels, int numSamples) noexcept
+    {
+        if (mHasPending.load (std::memory_order_acquire))
+        {
+            const juce::SpinLock::ScopedTryLockType lock (mPatternLock);
+
+            if (lock.isLocked())
+            {
+                std::swap (mActive, mPending);
+                mHasPending = false;
+
+                // the rest of this partition's output has to come from the
+                // new response too
+                if (mActive->numPartitions > 0)
+                    computeOutput (*mActive);
+            }
+        }
+
+        if (! isActive())
+            return;
+
+        const Pattern& pattern = *mActive;
+        const int mask = mHistoryLength - 1;
+        numChannels = juce::jmin (numChannels, mNumChannels);
+        const Sample inputScale = Sample (1) / (Sample) numChannels;
+
+        for (int done = 0; done < numSamples;)
+        {
+            const int run = juce::jmin (numSamples - done, kPartitionSize - mBlockPosition);
+            float* const window = mWindow + kPartitionSize + mBlockPosition;
+
+            // the mono source goes into the history and the current window
+            for (int i = 0; i < run; ++i)
+            {
+                Sample sum = 0;
+
+                for (int channel = 0; channel < numChannels; ++channel)
+                    sum += inputs[channel][done + i];
+
+                window[i] = (float) (sum * inputScale);
+                mHistory[(mHistoryPosition + i) & mask] = window[i];
+            }
+
+            for (int tap = 0; tap < pattern.numDirectTaps; ++tap)
+            {
+                int index = (mHistoryPosition - pattern.delays[tap]) & mask;
+
+                for (int offset = 0; offset < run;)
+                {
+                    const int length = juce::jmin (run - offset, mHistoryLength - index);
+
+                    for (int channel = 0; channel < numChannels; ++channel)
+                        if (pattern.gains[tap][channel] != 0.0f)
+                            addWithMultiply (outputs[channel] + done + offset, mHistory + index, pattern.gains[tap][channel], length);
+
+                    offset += length;
+                    index = 0;
+                }
+            }
+
+            if (pattern.numPartitions > 0)
+                for (int channel = 0; channel < numChannels; ++channel)
+                    add (outputs[channel] + done, mOutput + channel * kPartitionSize + mBlockPosition, run);
+
+            mHistoryPosition = (mHistoryPosition + run) & mask;
+            mBlockPosition += run;
+            done += run;
+
+            if (mBlockPosition == kPartitionSize)
+            {
+                finishBlock();
+
+                if (pattern.numPartitions > 0)
+                    computeOutput (pattern);
+
+                mBlockPosition = 0;
+            }
+        }
+    }
+
+    //==============================================================================
+    /** numTaps taps spread evenly over lengthSeconds, fading out and
+        alternating from side to side as they go.
+    */
+    static juce::Array<Tap> makeEvenPattern (int numTaps, double lengthSeconds)
+    {
+        juce::Array<Tap> taps;
+        numTaps = juce::jlimit (0, kMaxTaps, numTaps);
+
+        for (int i = 0; i < numTaps; ++i)
+        {
+            const float position = (float) (i + 1) / (float) numTaps;
+
+            Tap tap;
+            tap.delaySeconds = lengthSeconds * position;
+            tap.gain = (1.0f - 0.75f * position) / std::sqrt ((float) numTaps);
+            tap.pan = (i % 2 == 0 ? -1.0f : 1.0f) * position;
+            taps.add (tap);
+        }
+
+        return taps;
+    }
+
+private:
+    static constexpr int kFftOrder = 10;
+    static constexpr int kFftSize = 1 << kFftOrder;
+    static constexpr int kNumBins = kFftSize / 2 + 1;
+    static constexpr int kSpectrumSize = kNumBins * 2;
+
+    static_assert (kFftSize == kPartitionSize * 2, "each FFT covers two partitions");
+
+    struct Pattern
+    {
+        int numTaps = 0;
+        int numDirectTaps = 0;
+        int delays[kMaxTaps];
+        float gains[kMaxTaps][CrossFeedMatrix::kMaxChannels];
+
+        // occupied partitions: which partition each one is, and its
+        // spectrum for every channel
+        int numPartitions = 0;
+        int partitions[kMaxTaps];
+        juce::HeapBlock<float> spectra;
+    };
+
+    //==============================================================================
+    // adding the float history and convolution output into either sample type
+    static void add (float* dest, const float* source, int numSamples) noexcept
+    {
+        juce::FloatVectorOperations::add (dest, source, numSamples);
+    }
+
+    static void add (double* dest, const float* source, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] += (double) source[i];
+    }
+
+    static void addWithMultiply (float* dest, const float* source, float gain, int numSamples) noexcept
+    {
+        juce::FloatVectorOperations::addWithMultiply (dest, source, gain, numSamples);
+    }
+
+    static void addWithMultiply (double* dest, const float* source, float gain, int numSamples) noexcept
+    {
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] += (double) source[i] * (double) gain;
+    }
+
+    /** Equal-power pan across the channels, spread evenly from first to last. */
+    static void getPanGains (float pan, int numChannels, float* gains) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            gains[channel] = 0.0f;
+
+        if (numChannels == 1)
+        {
+            gains[0] = 1.0f;
+            return;
+        }
+
+        const float position = (juce::jlimit (-1.0f, 1.0f, pan) + 1.0f) * 0.5f * (float) (numChannels - 1);
+        const int lower = juce::jmin ((int) position, numChannels - 2);
+        const float angle = (position - (float) lower) * juce::MathConstants<float>::halfPi;
+
+        gains[lower] = std::cos (angle);
+        gains[lower + 1] = std::sin (angle);
+    }
+
+    void buildPattern (Pattern& pattern, const juce::Array<Tap>& taps)
+    {
+        const int maximumDelay = (mNumPartitions - 1) * kPartitionSize - 1;
+        const int numTaps = juce::jmin (taps.size(), kMaxTaps);
+
+        int delays[kMaxTaps];
+        float gains[kMaxTaps][CrossFeedMatrix::kMaxChannels];
+        int numValid = 0;
+
+        for (int i = 0; i < numTaps; ++i)
+        {
+            const auto& tap = taps.getReference (i);
+            const int delay = (int) std::lround (tap.delaySeconds * mSampleRate);
+
+            if (delay < 0 || delay > maximumDelay)
+                continue;
+
+            delays[numValid] = delay;
+            getPanGains (tap.pan, mNumChannels, gains[numValid]);
+
+            for (int channel = 0; channel < mNumChannels; ++channel)
+                gains[numValid][channel] *= tap.gain;
+
+            ++numValid;
+        }
+
+        // partitions holding at least one tap the convolution could take
+        pattern.numPartitions = 0;
+        int numLongTaps = 0;
+
+        for (int i = 0; i < numValid; ++i)
+        {
+            const int partition = delays[i] / kPartitionSize;
+
+            if (partition == 0)
+                continue;
+
+            ++numLongTaps;
+            bool isNew = true;
+
+            for (int k = 0; k < pattern.numPartitions; ++k)
+                isNew = isNew && pattern.partitions[k] != partition;
+
+            if (isNew)
+                pattern.partitions[pattern.numPartitions++] = partition;
+        }
+
+        const bool useConvolution = numLongTaps > 0
+                                     && (mMode == Mode::convolution
+                                          || (mMode == Mode::automatic
+                                               && numLongTaps > pattern.numPartitions * kTapsPerPartition + kTransformOverheadTaps));
+
+        if (! useConvolution)
+            pattern.numPartitions = 0;
+
+        // direct taps go first; with the convolution that is only the ones
+        // shorter than a partition
+        pattern.numTaps = numValid;
+        pattern.numDirectTaps = 0;
+
+        for (int i = 0; i < numValid; ++i)
+        {
+            if (useConvolution && delays[i] >= kPartitionSize)
+                continue;
+
+            pattern.delays[pattern.numDirectTaps] = delays[i];
+            std::copy (gains[i], gains[i] + mNumChannels, pattern.gains[pattern.numDirectTaps]);
+            ++pattern.numDirectTaps;
+        }
+
+        if (! useConvolution)
+            return;
+
+        // one impulse response per partition and channel, padded to the FFT size
+        juce::dsp::FFT fft (kFftOrder);
+        juce::HeapBlock<float> buffer ((size_t) kFftSize * 2);
+
+        for (int k = 0; k < pattern.numPartitions; ++k)
+        {
+            for (int channel = 0; channel < mNumChannels; ++channel)
+            {
+                juce::zeromem (buffer, (size_t) kFftSize * 2 * sizeof (float));
+
+                for (int i = 0; i < numValid; ++i)
+                    if (delays[i] / kPartitionSize == pattern.partitions[k])
+                        buffer[delays[i] % kPartitionSize] += gains[i][channel];
+
+                fft.performRealOnlyForwardTransform (buffer, true);
+                std::copy (buffer.get(), buffer.get() + kSpectrumSize, getSpectrum (pattern, k, channel));
+            }
+        }
+    }
+
+    float* getSpectrum (const Pattern& pattern, int partition, int channel) const noexcept
+    {
+        return pattern.spectra + ((size_t) partition * (size_t) mNumChannels + (size_t) channel) * kSpectrumSize;
+    }
+
+    /** Called once a partition of input is complete: adds the spectrum of
+        the latest window to the ring.
+    */
+    void finishBlock() noexcept
+    {
+        std::copy (mWindow.get(), mWindow.get() + kFftSize, mFftBuffer.get());
+        mFft.performRealOnlyForwardTransform (mFftBuffer, true);
+
+        mSpectrumIndex = (mSpectrumIndex + 1) % mNumPartitions;
+        std::copy (mFftBuffer.get(), mFftBuffer.get() + kSpectrumSize, mSpectra + (size_t) mSpectrumIndex * kSpectrumSize);
+
+        // the newest half of the window becomes the older half of the next
+        std::copy (mWindow.get() + kPartitionSize, mWindow.get() + kFftSize, mWindow.get());
+    }
+
+    /** Works out the convolution output for the current partition. */
+    void computeOutput (const Pattern& pattern) noexcept
+    {
+        for (int channel = 0; channel < mNumChannels; ++channel)
+        {
+            float* const sum = mFftBuffer;
+            juce::zeromem (sum, (size_t) kSpectrumSize * sizeof (float));
+
+            // partition p of the response meets the window completed p - 1
+            // blocks ago, so every partition used here only needs input
+            // that has already arrived
+            for (int k = 0; k < pattern.numPartitions; ++k)
+            {
+                const int age = pattern.partitions[k] - 1;
+                const float* const x = mSpectra + (size_t) ((mSpectrumIndex - age + mNumPartitions) % mNumPartitions) * kSpectrumSize;
+                const float* const h = getSpectrum (pattern, k, channel);
+
+                for (int bin = 0; bin < kSpectrumSize; bin += 2)
+                {
+                    sum[bin]     += x[bin] * h[bin]     - x[bin + 1] * h[bin + 1];
+                    sum[bin + 1] += x[bin] * h[bin + 1] + x[bin + 1] * h[bin];
+                }
+            }
+
+            // overlap-save: the second half of the circular result is the
+            // linear convolution
+            mFft.performRealOnlyInverseTransform (sum);
+            std::copy (sum + kPartitionSize, sum + kFftSize, mOutput + channel * kPartitionSize);
+        }
+    }
+
+    //==============================================================================
+    Pattern mPatterns[2];
+    Pattern* mActive = nullptr;
+    Pattern* mPending = nullptr;
+    std::atomic<bool> mHasPending { false };
+    juce::SpinLock mPatternLock;
+
+    juce::Array<Tap> mTaps;
+    Mode mMode = Mode::automatic;
+
+    juce::dsp::FFT mFft { kFftOrder };
+    juce::HeapBlock<float> mHistory;
+    juce::HeapBlock<float> mSpectra;
+    juce::HeapBlock<float> mWindow;
+    juce::HeapBlock<float> mFftBuffer;
+    juce::HeapBlock<float> mOutput;
+
+    double mSampleRate = 44100.0;
+    int mNumChannels = 0;
+    int mHistoryLength = 0;
+    int mHistoryPosition = 0;
+    int mNumPartitions = 0;
+    int mBlockPosition = 0;
+    int mSpectrumIndex = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MultiTapDelay)
+};
@@ -0,0 +1,359 @@
+/*
+  ==============================================================================
+
+    PitchShifter.h
+
+    The shimmer's pitch shifter: a short delay line read by two heads whose
+    delays sweep at a steady rate, so what they read plays back faster or
+    slower than it was written. Each head sweeps across a window of
+    kWindowMilliseconds and jumps back to the other end when it gets there;
+    the heads sit half a window apart and are crossfaded with a sin^2
+    window from a table built at startup, which is silent where a head
+    jumps and sums to exactly one across the two.
+
+    Offline, where time is cheaper than in a live set, each head picks
+    where it lands after a jump: it searches kSearchMilliseconds of the
+    line for the lag that best matches what the other head is playing, so
+    the crossfade between them adds up instead of beating. It also reads
+    with cubic Hermite rather than linear interpolation. In real time the
+    heads always land in the middle of the search, so both modes sit the
+    same distance back on average and offline renders keep the timing
+    heard while playing.
+
+    Heads' positions come from a 32-bit fixed-point phase that wraps by
+    itself, as the LFO's does, and runs are split where a head jumps, so
+    the shifter gives the same output however they are split. Each run
+    writes the input first and then reads every head's run with
+    DelayLine::readModulated, so the heads can read right up to
+    kMinimumDelay behind what was just written. On average the heads sit
+    getLatency() samples back.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+#include "DelayKernels.h"
+#include "DelayLine.h"
+
+//==============================================================================
+class PitchShifter
+{
+public:
+    static constexpr double kWindowMilliseconds = 40.0;
+
+    /** How far offline heads look for a better place to land after a jump,
+        and how much of the line they compare to find it.
+    */
+    static constexpr double kSearchMilliseconds = 8.0;
+    static constexpr double kMatchMilliseconds = 5.0;
+
+    /** The nearest a head reads to the write position. */
+    static constexpr int kMinimumDelay = 4;
+
+    static constexpr int kNumHeads = 2;
+    static constexpr int kTableBits = 11;
+    static constexpr int kTableSize = 1 << kTableBits;
+
+    //==============================================================================
+    struct Tables
+    {
+        Tables()
+        {
+            for (int i = 0; i <= kTableSize; ++i)
+            {
+                const double s = std::sin (juce::MathConstants<double>::pi * (double) i / kTableSize);
+                window[i] = (float) (s * s);
+            }
+        }
+
+        // the last entry is the window's end, so a lookup can always blend
+        // towards the next entry
+        float window[kTableSize + 1];
+    };
+
+    /** Computed lazily. The window never changes, so all shifters share it. */
+    static const Tables& getTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    //==============================================================================
+    /** Sizes the line for numChannels channels and runs of up to
+        maximumChunk samples. Allocates, so call it from prepareToPlay.
+    */
+    void prepare (double sampleRate, int numChannels, int maximumChunk, DelayMemory::Format format)
+    {
+        jassert (numChannels > 0 && numChannels <= CrossFeedMatrix::kMaxChannels);
+
+        mWindowSamples = std::ceil (sampleRate * kWindowMilliseconds * 0.001);
+        mSearchSamples = (int) std::ceil (sampleRate * kSearchMilliseconds * 0.001);
+        mMatchSamples = (int) std::ceil (sampleRate * kMatchMilliseconds * 0.001);
+
+        const int deepest = kMinimumDelay + (int) mWindowSamples + mSearchSamples + mMatchSamples;
+        mLine.prepare (numChannels, maximumChunk + deepest + 4, 1.0, format);
+
+        // the heads' delays for a run, one channel's delays, a window and a
+        // read, each starting on a 64-byte boundary, then the two stretches
+        // of line the search compares
+        mScratchStride = (juce::jmax (1, maximumChunk) + 15) & ~15;
+        mMatchStride = (mMatchSamples * 2 + mSearchSamples + 15) & ~15;
+        mScratch.allocate ((size_t) (mScratchStride * 4 + mMatchStride) + 8, true);
+
+        updateIncrement();
+        reset();
+    }
+
+    /** Silences the line and starts the heads from the top of the window. */
+    void reset()
+    {
+        mLine.clear();
+        mPhase = 0;
+
+        for (auto& offsets : mOffsets)
+            std::fill (std::begin (offsets), std::end (offsets), mSearchSamples / 2);
+    }
+
+    /** Fixed landing points and linear reads in real time; searched landing
+        points and cubic reads offline.
+    */
+    void setNonRealtime (bool isNonRealtime) noexcept
+    {
+        mLine.setNonRealtime (isNonRealtime);
+        mIsHighQuality = isNonRealtime;
+    }
+
+    void setUseSimd (bool shouldUseSimd)        { mLine.setUseSimd (shouldUseSimd); }
+
+    /** The interval the output is shifted by. Picked up without a click: it
+        only changes how fast the heads sweep.
+    */
+    void setSemitones (int semitones) noexcept
+    {
+        if (semitones != mSemitones)
+        {
+            mSemitones = semitones;
+            updateIncrement();
+        }
+    }
+
+    /** Where the heads read on average, in samples. Every trip round a
+        shifted feedback loop is this much longer than the delay time.
+    */
+    int getLatency() const noexcept     { return kMinimumDelay + (int) (mWindowSamples * 0.5) + mSearchSamples / 2; }
+
+    //==============================================================================
+    /** Shifts numSamples of each of numChannels inputs into outputs. */
+    template <typename Sample>
+    void process (const Sample* const* inputs, Sample* const* outputs, int numChannels, int numSamples) noexcept
+    {
+        jassert (numSamples <= mScratchStride);
+
+        if (! mIsHighQuality)
+        {
+            processRun (inputs, outputs, numChannels, 0, numSamples);
+            return;
+        }
+
+        // a head only moves its landing point as it jumps, where its window
+        // is silent, so runs are split there
+        for (int done = 0; done < numSamples;)
+        {
+            int toJump[kNumHeads];
+            int length = numSamples - done;
+
+            for (int head = 0; head < kNumHeads; ++head)
+            {
+                toJump[head] = getSamplesToJump (head);
+                length = juce::jmin (length, toJump[head]);
+            }
+
+            processRun (inputs, outputs, numChannels, done, length);
+            done += length;
+
+            for (int head = 0; head < kNumHeads; ++head)
+                if (toJump[head] == length)
+                    land<Sample> (head, numChannels);
+        }
+    }
+
+    /** Moves the heads and the write position on without writing, while
+        the engine is idle.
+    */
+    void advance (int numSamples) noexcept
+    {
+        mPhase += mIncrement * (juce::uint32) numSamples;
+        mLine.advance (numSamples);
+    }
+
+private:
+    // one sweep across the window
+    static constexpr double kPhaseScale = 4294967296.0;
+
+    juce::uint32 getPhase (int head) const noexcept
+    {
+        return mPhase + (juce::uint32) head * (juce::uint32) (kPhaseScale / kNumHeads);
+    }
+
+    double getDelay (juce::uint32 phase) const noexcept
+    {
+        return kMinimumDelay + mWindowSamples * ((double) phase / kPhaseScale);
+    }
+
+    /** Samples until head's phase wraps round, so that the sample after the
+        run is the first one past the jump.
+    */
+    int getSamplesToJump (int head) const noexcept
+    {
+        const auto increment = (juce::int64) (juce::int32) mIncrement;
+        const auto phase = (juce::int64) getPhase (head);
+        juce::int64 samples = std::numeric_limits<int>::max();
+
+        if (increment < 0)
+            samples = phase / -increment + 1;
+        else if (increment > 0)
+            samples = ((juce::int64 (1) << 32) - phase + increment - 1) / increment;
+
+        return (int) juce::jmin (samples, (juce::int64) std::numeric_limits<int>::max());
+    }
+
+    template <typename Sample>
+    void processRun (const Sample* const* inputs, Sample* const* outputs, int numChannels, int offset, int numSamples) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            mLine.write (channel, inputs[channel] + offset, numSamples);
+            juce::FloatVectorOperations::clear (outputs[channel] + offset, numSamples);
+        }
+
+        double* const delays = juce::snapPointerToAlignment (mScratch.get(), (size_t) 64);
+        double* const channelDelays = delays + mScratchStride;
+        Sample* const window = reinterpret_cast<Sample*> (channelDelays + mScratchStride);
+        Sample* const read = window + mScratchStride;
+        const float* const table = getTables().window;
+
+        for (int head = 0; head < kNumHeads; ++head)
+        {
+            const juce::uint32 start = getPhase (head);
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                const juce::uint32 phase = start + mIncrement * (juce::uint32) i;
+
+                delays[i] = getDelay (phase);
+                window[i] = (Sample) DelayKernels::lookUpTable<kTableBits> (table, phase);
+            }
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                juce::FloatVectorOperations::add (channelDelays, delays, (double) mOffsets[head][channel], numSamples);
+
+                if (mIsHighQuality)
+                    mLine.readModulated<Interpolators::CubicHermite> (channel, read, numSamples, channelDelays);
+                else
+                    mLine.readModulated<Interpolators::Linear> (channel, read, numSamples, channelDelays);
+
+                juce::FloatVectorOperations::addWithMultiply (outputs[channel] + offset, read, window, numSamples);
+            }
+        }
+
+        advance (numSamples);
+    }
+
+    /** Picks where head lands after the jump it has just made, for every
+        channel: the lag whose stretch of line best matches the stretch the
+        other head has just played, so the two line up as they crossfade.
+    */
+    template <typename Sample>
+    void land (int head, int numChannels) noexcept
+    {
+        const int other = (head + 1) % kNumHeads;
+        const int base = juce::roundToInt (getDelay (getPhase (head)));
+        const int otherBase = juce::roundToInt (getDelay (getPhase (other)));
+
+        Sample* const played = reinterpret_cast<Sample*> (juce::snapPointerToAlignment (mScratch.get(), (size_t) 64)
+                                                          + mScratchStride * 4);
+        Sample* const candidates = played + mMatchSamples;
+        const int numCandidates = mMatchSamples + mSearchSamples;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            // both stretches run oldest first and end where their head reads now
+            const int otherDelay = otherBase + mOffsets[other][channel];
+            mLine.read<Interpolators::None> (channel, played, mMatchSamples, (double) (otherDelay + mMatchSamples - 1), 0.0, 0);
+            mLine.read<Interpolators::None> (channel, candidates, numCandidates, (double) (base + numCandidates - 1), 0.0, 0);
+
+            // candidate k lands at a lag of mSearchSamples - k; scored by
+            // correlation over the candidate's level, so loud stretches
+            // don't win by being loud
+            double energy = 0.0;
+
+            for (int i = 0; i < mMatchSamples; ++i)
+                energy += (double) candidates[i] * (double) candidates[i];
+
+            double bestScore = 0.0;
+            int best = mSearchSamples / 2;
+
+            for (int k = 0; k <= mSearchSamples; ++k)
+            {
+                if (k > 0)
+                {
+                    const double leaving = (double) candidates[k - 1];
+                    const double arriving = (double) candidates[k + mMatchSamples - 1];
+                    energy = juce::jmax (0.0, energy - leaving * leaving + arriving * arriving);
+                }
+
+                Sample correlation = 0;
+
+                for (int i = 0; i < mMatchSamples; ++i)
+                    correlation += played[i] * candidates[k + i];
+
+                if (correlation > 0 && energy > 1.0e-12)
+                {
+                    const double score = (double) correlation * (double) correlation / energy;
+
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        best = k;
+                    }
+                }
+            }
+
+            mOffsets[head][channel] = mSearchSamples - best;
+        }
+    }
+
+    void updateIncrement() noexcept
+    {
+        // the delay changes by 1 - ratio samples every sample, so the phase
+        // crosses the window in windowSamples / |1 - ratio| samples
+        const double ratio = std::pow (2.0, mSemitones / 12.0);
+        const double increment = (1.0 - ratio) / juce::jmax (1.0, mWindowSamples) * kPhaseScale;
+        mIncrement = (juce::uint32) (juce::int32) std::round (increment);
+    }
+
+    DelayLine mLine;
+
+    double mWindowSamples = 0.0;
+    int mSearchSamples = 0;
+    int mMatchSamples = 0;
+    int mSemitones = 12;
+    juce::uint32 mPhase = 0;
+    juce::uint32 mIncrement = 0;
+    bool mIsHighQuality = false;
+
+    // where each head lands past its sweep, per channel, in samples
+    int mOffsets[kNumHeads][CrossFeedMatrix::kMaxChannels] = {};
+
+    // the heads' delays, window and read, then the match search. the delays
+    // are doubles anyway, and the other parts reuse the same units
+    juce::HeapBlock<double> mScratch;
+    int mScratchStride = 0;
+    int mMatchStride = 0;
+
+    JUCE_LEAK_DETECTOR (PitchShifter)
+};
@@ -9,17 +9,46 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+// the editor never redraws telemetry faster than this
+static const int kTelemetryFrameRate = 30;
+
+// meters and scope show -60 to 0 dBFS. meters drop by kMeterFallDecibels
+// per frame when nothing louder arrives
+static const float kDisplayFloorDecibels = -60.0f;
+static const float kMeterFallDecibels = 1.5f;
+
+// the load readout is text, so it is only rebuilt every few frames
+static const int kLoadUpdateFrames = 10;
+
+// position of a level between the display floor (0) and full scale (1)
+static float getDisplayProportion(float gain)
+{
+    const float decibels = juce::Decibels::gainToDecibels(gain, kDisplayFloorDecibels);
+    return juce::jlimit(0.0f, 1.0f, 1.0f - decibels / kDisplayFloorDecibels);
+}
+
+// the knobs find their parameters by ID, so they stay bound to the right
+// ones however many the processor adds in front of them
+static juce::AudioParameterFloat* findFloatParameter(juce::AudioProcessor& processor, const juce::String& parameterID)
+{
+    for (auto* parameter : processor.getParameters())
+        if (auto* floatParameter = dynamic_cast<juce::AudioParameterFloat*>(parameter))
+            if (floatParameter->paramID == parameterID)
+                return floatParameter;
+    
+    jassertfalse;
+    return nullptr;
+}
+
 //==============================================================================
 KadenzeDelayAudioProcessorEditor::KadenzeDelayAudioProcessorEditor (KadenzeDelayAudioProcessor& p)
     : AudioProcessorEditor (&p), audioProcessor (p)
 {
     // Make sure that before the constructor has finished, you've set the
     // editor's size to whatever you need it to be.
-    setSize (400, 300);
-    
-    auto& params = processor.getParameters();
+    setSize (400, 320);
     
-    juce::AudioParameterFloat* dryWetParameter = (juce::AudioParameterFloat*)params.getUnchecked(0);
+    juce::AudioParameterFloat* dryWetParameter = findFloatParameter(audioProcessor, "drywet");
     
     mDryWetSlider.setBounds(0, 0, 100, 100);
     mDryWetSlider.setSliderStyle(juce::Slider::SliderStyle::RotaryVerticalDrag);
@@ -33,7 +62,7 @@ KadenzeDelayAudioProcessorEditor::KadenzeDelayAudioProcessorEditor (KadenzeDelay
     mDryWetSlider.onDragStart = [dryWetParameter] { dryWetParameter->beginChangeGesture(); };
     mDryWetSlider.onDragEnd = [dryWetParameter] { dryWetParameter->endChangeGesture(); };
     
-    juce::AudioParameterFloat* feedbackParameter = (juce::AudioParameterFloat*)params.getUnchecked(0);
+    juce::AudioParameterFloat* feedbackParameter = findFloatParameter(audioProcessor, "feedback");
     
     mFeedbackSlider.setBounds(100, 0, 100, 100);
     mFeedbackSlider.setSliderStyle(juce::Slider::SliderStyle::RotaryVerticalDrag);
@@ -46,22 +75,49 @@ KadenzeDelayAudioProcessorEditor::KadenzeDelayAudioProcessorEditor (KadenzeDelay
     mFeedbackSlider.onDragStart = [feedbackParameter] { feedbackParameter->beginChangeGesture(); };
     mFeedbackSlider.onDragEnd = [feedbackParameter] { feedbackParameter->endChangeGesture(); };
     
-    juce::AudioParameterFloat* delayTimeParameter = (juce::AudioParameterFloat*)params.getUnchecked(0);
+    juce::AudioParameterFloat* delayTimeParameter = findFloatParameter(audioProcessor, "delayTimeLeft");
+    const auto& delayTimeRange = delayTimeParameter->range;
     
     mDelayTimeSlider.setBounds(200, 0, 100, 100);
     mDelayTimeSlider.setSliderStyle(juce::Slider::SliderStyle::RotaryVerticalDrag);
     mDelayTimeSlider.setTextBoxStyle(juce::Slider::TextEntryBoxPosition::NoTextBox, true, 0, 0);
-    mDelayTimeSlider.setRange(delayTimeParameter->range.start, delayTimeParameter->range.end);
+    
+    // the parameter's own range, skewed so a second sits mid-travel
+    mDelayTimeSlider.setNormalisableRange({ delayTimeRange.start, delayTimeRange.end, delayTimeRange.interval,
+                                            delayTimeRange.skew, delayTimeRange.symmetricSkew });
     mDelayTimeSlider.setValue(*delayTimeParameter);
     addAndMakeVisible(mDelayTimeSlider);
     
     mDelayTimeSlider.onValueChange = [this, delayTimeParameter] { *delayTimeParameter = mDelayTimeSlider.getValue(); };
     mDelayTimeSlider.onDragStart = [delayTimeParameter] { delayTimeParameter->beginChangeGesture(); };
     mDelayTimeSlider.onDragEnd = [delayTimeParameter] { delayTimeParameter->endChangeGesture(); };
+    
+    juce::zeromem(mScopePeaks, sizeof(mScopePeaks));
+    mScopeWriteBin = 0;
+    
+    mMeterArea.setBounds(10, 110, 110, 180);
+    mScopeArea.setBounds(130, 110, 260, 180);
+    
+    // the images are sized once here; the timer only draws into them
+    mMeterBackground = juce::Image(juce::Image::ARGB, mMeterArea.getWidth(), mMeterArea.getHeight(), true);
+    mScopeImage = juce::Image(juce::Image::RGB, mScopeArea.getWidth(), mScopeArea.getHeight(), true);
+    renderMeterBackground();
+    renderScope();
+    
+    mLoadLabel.setBounds(10, 295, 380, 20);
+    mLoadLabel.setFont(12.0f);
+    addAndMakeVisible(mLoadLabel);
+    mLoadUpdateCountdown = 0;
+    
+    // the processor only collects telemetry while an editor is showing it
+    audioProcessor.getTelemetry().setEnabled(true);
+    startTimerHz(kTelemetryFrameRate);
 }
 
 KadenzeDelayAudioProcessorEditor::~KadenzeDelayAudioProcessorEditor()
 {
+    stopTimer();
+    audioProcessor.getTelemetry().setEnabled(false);
 }
 
 //==============================================================================
@@ -69,10 +125,26 @@ void KadenzeDelayAudioProcessorEditor::paint (juce::Graphics& g)
 {
     // (Our component is opaque, so we must completely fill the background with a solid colour)
     g.fillAll (getLookAndFeel().findColour (juce::ResizableWindow::backgroundColourId));
-
-    g.setColour (juce::Colours::white);
-    g.setFont (15.0f);
-    g.drawFittedText ("Hello World!", getLocalBounds(), juce::Justification::centred, 1);
+    
+    g.drawImageAt(mMeterBackground, mMeterArea.getX(), mMeterArea.getY());
+    g.drawImageAt(mScopeImage, mScopeArea.getX(), mScopeArea.getY());
+    
+    // input, wet and feedback: a bar for the RMS and a line for the peak
+    const int meterWidth = mMeterArea.getWidth() / 3;
+    const int meterHeight = mMeterArea.getHeight() - 20;
+    
+    for (int meter = 0; meter < 3; ++meter) {
+        const int x = mMeterArea.getX() + meter * meterWidth + 8;
+        const int bottom = mMeterArea.getY() + meterHeight;
+        const int rmsHeight = juce::roundToInt(getDisplayProportion(mMeterLevels[meter].rms) * meterHeight);
+        const int peakY = bottom - juce::roundToInt(getDisplayProportion(mMeterLevels[meter].peak) * meterHeight);
+        
+        g.setColour(juce::Colours::limegreen);
+        g.fillRect(x, bottom - rmsHeight, meterWidth - 16, rmsHeight);
+        
+        g.setColour(mMeterLevels[meter].peak >= 1.0f ? juce::Colours::red : juce::Colours::white);
+        g.fillRect(x, peakY, meterWidth - 16, 2);
+    }
 }
 
 void KadenzeDelayAudioProcessorEditor::resized()
@@ -80,3 +152,120 @@ void KadenzeDelayAudioProcessorEditor::resized()
     // This is generally where you'll want to lay out the positions of any
     // subcomponents in your editor..
 }
+
+void KadenzeDelayAudioProcessorEditor::timerCallback()
+{
+    auto& telemetry = audioProcessor.getTelemetry();
+    
+    // meters jump up to the loudest frame since the last tick and fall back
+    // slowly, so short peaks between ticks still show
+    const float fall = juce::Decibels::decibelsToGain(-kMeterFallDecibels);
+    bool metersChanged = false;
+    
+    for (auto& level : mMeterLevels) {
+        const float peak = level.peak;
+        const float rms = level.rms;
+        level.peak *= fall;
+        level.rms *= fall;
+        metersChanged = metersChanged || peak != level.peak || rms != level.rms;
+    }
+    
+    Telemetry::Frame frame;
+    
+    while (telemetry.popFrame(frame)) {
+        const Telemetry::Level levels[3] = { frame.input, frame.wet, frame.feedback };
+        
+        for (int meter = 0; meter < 3; ++meter) {
+            mMeterLevels[meter].peak = juce::jmax(mMeterLevels[meter].peak, levels[meter].peak);
+            mMeterLevels[meter].rms = juce::jmax(mMeterLevels[meter].rms, levels[meter].rms);
+        }
+        
+        mScopeWriteBin = frame.scopeWriteBin;
+        metersChanged = true;
+    }
+    
+    Telemetry::ScopeBin bin;
+    bool scopeChanged = false;
+    
+    while (telemetry.popScopeBin(bin)) {
+        mScopePeaks[bin.index] = bin.peak;
+        scopeChanged = true;
+    }
+    
+    if (scopeChanged) {
+        renderScope();
+        repaint(mScopeArea);
+    }
+    
+    if (metersChanged)
+        repaint(mMeterArea);
+    
+    if (--mLoadUpdateCountdown <= 0) {
+        mLoadUpdateCountdown = kLoadUpdateFrames;
+        
+        const auto load = audioProcessor.getDspLoad().getSnapshot();
+        
+        juce::String text;
+        text << "DSP " << juce::String(load.averagePercent, 1) << "% avg, "
+             << juce::String(load.worstPercent, 1) << "% worst, "
+             << load.getNumOverruns() << " overruns of "
+             << juce::String(load.budgetMilliseconds, 2) << " ms";
+        
+        mLoadLabel.setText(text, juce::dontSendNotification);
+    }
+}
+
+void KadenzeDelayAudioProcessorEditor::renderScope()
+{
+    juce::Graphics g(mScopeImage);
+    g.fillAll(juce::Colours::black);
+    
+    // newest on the left, oldest on the right, one column per few bins
+    const int width = mScopeImage.getWidth();
+    const int height = mScopeImage.getHeight();
+    const int centre = height / 2;
+    
+    g.setColour(juce::Colours::skyblue);
+    
+    for (int x = 0; x < width; ++x) {
+        const int firstAge = x * Telemetry::kScopeSize / width;
+        const int lastAge = juce::jmax(firstAge + 1, (x + 1) * Telemetry::kScopeSize / width);
+        float peak = 0.0f;
+        
+        for (int age = firstAge; age < lastAge; ++age)
+            peak = juce::jmax(peak, mScopePeaks[(mScopeWriteBin - age + Telemetry::kScopeSize) % Telemetry::kScopeSize]);
+        
+        const int halfHeight = juce::roundToInt(getDisplayProportion(peak) * (float) centre);
+        
+        if (halfHeight > 0)
+            g.fillRect(x, centre - halfHeight, 1, 2 * halfHeight);
+    }
+}
+
+void KadenzeDelayAudioProcessorEditor::renderMeterBackground()
+{
+    juce::Graphics g(mMeterBackground);
+    
+    const int meterWidth = mMeterBackground.getWidth() / 3;
+    const int meterHeight = mMeterBackground.getHeight() - 20;
+    const char* const names[] = { "In", "Wet", "Fb" };
+    
+    for (int meter = 0; meter < 3; ++meter) {
+        const int x = meter * meterWidth;
+        
+        g.setColour(juce::Colours::black);
+        g.fillRect(x + 8, 0, meterWidth - 16, meterHeight);
+        
+        g.setColour(juce::Colours::white);
+        g.setFont(12.0f);
+        g.drawText(names[meter], x, meterHeight, meterWidth, 20, juce::Justification::centred);
+    }
+    
+    // a tick every 12 dB
+    g.setColour(juce::Colours::grey);
+    
+    for (float decibels = 0.0f; decibels > kDisplayFloorDecibels; decibels -= 12.0f) {
+        const int y = juce::roundToInt((decibels / kDisplayFloorDecibels) * meterHeight);
+        g.fillRect(0, y, 4, 1);
+    }
+}
@@ -14,7 +14,8 @@
 //==============================================================================
 /**
 */
-class KadenzeDelayAudioProcessorEditor  : public juce::AudioProcessorEditor
+class KadenzeDelayAudioProcessorEditor  : public juce::AudioProcessorEditor,
+                                          private juce::Timer
 {
 public:
     KadenzeDelayAudioProcessorEditor (KadenzeDelayAudioProcessor&);
@@ -25,6 +26,14 @@ public:
     void resized() override;
 
 private:
+    void timerCallback() override;
+    
+    /** Redraws the cached scope image from mScopePeaks. */
+    void renderScope();
+    
+    /** Redraws the cached meter labels and scale. */
+    void renderMeterBackground();
+    
     // This reference is provided as a quick way for your editor to
     // access the processor object that created it.
     KadenzeDelayAudioProcessor& audioProcessor;
@@ -32,6 +41,22 @@ private:
     juce::Slider mDryWetSlider;
     juce::Slider mFeedbackSlider;
     juce::Slider mDelayTimeSlider;
+    
+    // telemetry as last drawn: meter levels fall back between frames, the
+    // scope keeps one peak per bin of the delay memory
+    Telemetry::Level mMeterLevels[3];
+    float mScopePeaks[Telemetry::kScopeSize];
+    int mScopeWriteBin;
+    
+    // drawn only when something changes, so paint just blits them
+    juce::Image mScopeImage;
+    juce::Image mMeterBackground;
+    juce::Rectangle<int> mMeterArea;
+    juce::Rectangle<int> mScopeArea;
+    
+    // processBlock's share of the real-time budget, from DspLoad
+    juce::Label mLoadLabel;
+    int mLoadUpdateCountdown;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (KadenzeDelayAudioProcessorEditor)
 };
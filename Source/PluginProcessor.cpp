@@ -9,6 +9,108 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 
+// parameters are picked up and the smoothers step every kControlInterval
+// samples, on a grid counted from prepareToPlay rather than from the start
+// of each host block, so the output doesn't depend on the block size
+static const int kControlInterval = 32;
+
+// glide times for the parameter smoothing. the delay time default matches
+// the old per-sample 0.001 one-pole when running at 44.1kHz
+static const float kGainGlideMilliseconds = 5.0f;
+static const float kDefaultDelayGlideMilliseconds = 22.7f;
+
+// how long the old read head takes to fade out when the delay time jumps
+static const double kJumpFadeMilliseconds = 30.0;
+
+// the lines keep at least this much history whatever the delay times, so
+// that moving to a longer time within it finds the echoes already there.
+// the scope shows this much of the line too
+static const double kMinimumHistorySeconds = 2.0;
+
+// the deepest the modulation reaches past the delay time
+static const float kMaxModulationDepthMilliseconds = 10.0f;
+
+// the longest even tap pattern; the tap history is sized for it
+static const double kMaxTapLengthSeconds = 2.0;
+
+// the longest grain in the reverse and granular modes
+static const float kMaxGrainMilliseconds = 500.0f;
+
+// the closest the shimmer's feedback read is brought to the write head.
+// short delays give up the rest of the shifter's latency instead of
+// chopping the run into tiny chunks
+static const int kShortestShimmerReadSamples = 64;
+
+// the delay time knobs put 1 s in the middle of their travel, so the short
+// times stay easy to set with minutes at the top of the range
+static juce::NormalisableRange<float> makeDelayTimeRange()
+{
+    juce::NormalisableRange<float> range(0.01f, (float) KadenzeDelayAudioProcessor::kMaxDelaySeconds);
+    range.setSkewForCentre(1.0f);
+    return range;
+}
+
+// the feedback filters' knobs put the geometric middle of their range in
+// the middle of their travel, so each octave takes about the same turn
+static juce::NormalisableRange<float> makeCutoffRange(float lowest, float highest)
+{
+    juce::NormalisableRange<float> range(lowest, highest);
+    range.setSkewForCentre(std::sqrt(lowest * highest));
+    return range;
+}
+
+// -120 dBFS. once nothing louder than this is left in the delay memory or
+// arriving at the input, the processor goes idle
+static const float kSilenceThreshold = 1.0e-6f;
+
+// saved state starts with the magic number and a version. later versions
+// only ever add to the end, so an older build restores what it knows of a
+// newer state and leaves the rest at its defaults
+static const int kStateMagic = 0x4b446c79;
+static const int kStateVersion = 1;
+
+// index of the first sample on any channel above the silence threshold, or
+// numSamples if there is none
+template <typename SampleType>
+static int findFirstAudibleSample(const SampleType* const* channels, int numChannels, int numSamples)
+{
+    int first = numSamples;
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const SampleType* const data = channels[channel];
+        
+        for (int i = 0; i < first; ++i) {
+            if (std::abs(data[i]) > kSilenceThreshold) {
+                first = i;
+                break;
+            }
+        }
+    }
+    
+    return first;
+}
+
+// index of the last sample on any channel above the silence threshold, or
+// -1 if there is none
+template <typename SampleType>
+static int findLastAudibleSample(const SampleType* const* channels, int numChannels, int numSamples)
+{
+    int last = -1;
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const SampleType* const data = channels[channel];
+        
+        for (int i = numSamples - 1; i > last; --i) {
+            if (std::abs(data[i]) > kSilenceThreshold) {
+                last = i;
+                break;
+            }
+        }
+    }
+    
+    return last;
+}
+
 //==============================================================================
 KadenzeDelayAudioProcessor::KadenzeDelayAudioProcessor()
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -16,6 +118,7 @@ KadenzeDelayAudioProcessor::KadenzeDelayAudioProcessor()
                      #if ! JucePlugin_IsMidiEffect
                       #if ! JucePlugin_IsSynth
                        .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
+                       .withInput  ("Sidechain", juce::AudioChannelSet::stereo(), false)
                       #endif
                        .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                      #endif
@@ -37,47 +140,258 @@ KadenzeDelayAudioProcessor::KadenzeDelayAudioProcessor()
     
     addParameter(mDelayTimeLeftParameter = new juce::AudioParameterFloat("delayTimeLeft",
                                                                      "Delay Time Left",
-                                                                     0.01,
-                                                                     MAX_DELAY_TIME,
-                                                                     0.5));
+                                                                     makeDelayTimeRange(),
+                                                                     0.5f));
     addParameter(mDelayTimeRightParameter = new juce::AudioParameterFloat("delayTimeRight",
                                                                      "Delay Time Right",
-                                                                     0.01,
-                                                                     MAX_DELAY_TIME,
+                                                                     makeDelayTimeRange(),
+                                                                     1.0f));
+    
+    addParameter(mInterpolationParameter = new juce::AudioParameterChoice("interpolation",
+                                                                          "Interpolation",
+                                                                          Interpolators::getQualityNames(),
+                                                                          (int) Interpolators::Quality::linear));
+    
+    addParameter(mCrossFeedParameter = new juce::AudioParameterChoice("crossFeed",
+                                                                      "Cross Feed",
+                                                                      CrossFeedMatrix::getPresetNames(),
+                                                                      (int) CrossFeedMatrix::Preset::pingPong));
+    
+    addParameter(mTapCountParameter = new juce::AudioParameterInt("tapCount",
+                                                                  "Taps",
+                                                                  0,
+                                                                  MultiTapDelay::kMaxTaps,
+                                                                  0));
+    
+    addParameter(mTapLengthParameter = new juce::AudioParameterFloat("tapLength",
+                                                                     "Tap Length",
+                                                                     0.05,
+                                                                     kMaxTapLengthSeconds,
                                                                      1.0));
-
     
+    addParameter(mGlideParameter = new juce::AudioParameterFloat("glide",
+                                                                 "Glide",
+                                                                 juce::NormalisableRange<float>(0.0f, 1000.0f, 0.0f, 0.3f),
+                                                                 kDefaultDelayGlideMilliseconds));
     
-    mDelayTimeLeftSmoothed = 0;
-    mDelayTimeRightSmoothed = 0;
+    // glide sweeps the read heads, which bends the pitch. jump moves them
+    // straight to the new time and crossfades, so they can stay on whole
+    // samples and skip interpolation
+    addParameter(mTimeModeParameter = new juce::AudioParameterChoice("timeMode",
+                                                                     "Time Mode",
+                                                                     juce::StringArray { "Glide", "Jump" },
+                                                                     0));
     
-    mCircularBufferLeft = nullptr;
-    mCircularBufferRight = nullptr;
-    mCircularBufferWriteHeadLeft = 0;
-    mCircularBufferWriteHeadRight = 0;
-
-    mCircularBufferLength = 0;
-    mDelayTimeLeftInSamples = 0;
-    mDelayTimeRightInSamples = 0;
-
-    mDelayReadHeadLeft = 0;
-    mDelayReadHeadRight = 0;
+    // synced times are note values at the host tempo. the defaults match the
+    // free times at 120 bpm
+    addParameter(mTempoSyncParameter = new juce::AudioParameterBool("tempoSync",
+                                                                    "Tempo Sync",
+                                                                    false));
+    
+    addParameter(mNoteLeftParameter = new juce::AudioParameterChoice("noteLeft",
+                                                                     "Note Left",
+                                                                     TempoSync::getDivisionNames(),
+                                                                     TempoSync::getDivisionIndex("1/4")));
+    
+    addParameter(mNoteRightParameter = new juce::AudioParameterChoice("noteRight",
+                                                                      "Note Right",
+                                                                      TempoSync::getDivisionNames(),
+                                                                      TempoSync::getDivisionIndex("1/2")));
+    
+    // the share of each pair of synced times the left one takes: 50% is
+    // straight, 66.7% a triplet shuffle
+    addParameter(mSwingParameter = new juce::AudioParameterFloat("swing",
+                                                                 "Swing",
+                                                                 50.0f,
+                                                                 75.0f,
+                                                                 50.0f));
+    
+    // a read-only meter so hosts can show what each instance costs. it holds
+    // the rolling average, in percent of the real-time budget, and is set
+    // from the timer, never from processBlock
+    addParameter(mDspLoadParameter = new juce::AudioParameterFloat("dspLoad",
+                                                                   "DSP Load",
+                                                                   juce::NormalisableRange<float>(0.0f, 100.0f),
+                                                                   0.0f,
+                                                                   juce::AudioParameterFloatAttributes()
+                                                                       .withCategory(juce::AudioProcessorParameter::otherMeter)
+                                                                       .withAutomatable(false)
+                                                                       .withLabel("%")));
+    
+    // tone and drive in the feedback loop. each stage is bypassed at its end
+    // of the range, so at the defaults the loop is a plain multiply
+    addParameter(mLowCutParameter = new juce::AudioParameterFloat("lowCut",
+                                                                  "Low Cut",
+                                                                  makeCutoffRange(FeedbackShaper::kLowCutOffHz, 2000.0f),
+                                                                  FeedbackShaper::kLowCutOffHz));
+    
+    addParameter(mHighCutParameter = new juce::AudioParameterFloat("highCut",
+                                                                   "High Cut",
+                                                                   makeCutoffRange(1000.0f, FeedbackShaper::kHighCutOffHz),
+                                                                   FeedbackShaper::kHighCutOffHz));
+    
+    addParameter(mDriveParameter = new juce::AudioParameterFloat("drive",
+                                                                 "Drive",
+                                                                 0.0f,
+                                                                 100.0f,
+                                                                 0.0f));
+    
+    // modulation moves the read heads for chorus, flanging and wow. the LFO
+    // only ever lengthens the delay, by up to the depth. jump mode keeps its
+    // heads on whole samples, so it isn't modulated
+    addParameter(mModulationRateParameter = new juce::AudioParameterFloat("modRate",
+                                                                          "Mod Rate",
+                                                                          juce::NormalisableRange<float>(0.05f, 10.0f, 0.0f, 0.4f),
+                                                                          0.5f));
+    
+    addParameter(mModulationDepthParameter = new juce::AudioParameterFloat("modDepth",
+                                                                           "Mod Depth",
+                                                                           0.0f,
+                                                                           kMaxModulationDepthMilliseconds,
+                                                                           0.0f));
+    
+    addParameter(mModulationShapeParameter = new juce::AudioParameterChoice("modShape",
+                                                                            "Mod Shape",
+                                                                            ModulationLfo::getShapeNames(),
+                                                                            (int) ModulationLfo::Shape::sine));
+    
+    // the LFO phase difference between the first channel and the last
+    addParameter(mModulationStereoParameter = new juce::AudioParameterFloat("modStereo",
+                                                                            "Mod Stereo",
+                                                                            0.0f,
+                                                                            180.0f,
+                                                                            90.0f));
+    
+    // the smear network runs in place of the two lines, with 8 or 16 lines
+    // sized from the delay times. damping darkens each trip round it
+    addParameter(mSmearParameter = new juce::AudioParameterChoice("smear",
+                                                                  "Smear",
+                                                                  FeedbackDelayNetwork::getSizeNames(),
+                                                                  0));
     
-    mFeedbackLeft = 0;
-    mFeedbackRight = 0;
+    addParameter(mDampingParameter = new juce::AudioParameterFloat("damping",
+                                                                   "Damping",
+                                                                   0.0f,
+                                                                   100.0f,
+                                                                   30.0f));
+    
+    // ducking turns the wet signal down while the key plays: every dB the
+    // key is over the threshold takes the amount in dB off the wet. the key
+    // is the input, or the sidechain bus when it is chosen and connected
+    addParameter(mDuckParameter = new juce::AudioParameterFloat("duck",
+                                                                "Ducking",
+                                                                0.0f,
+                                                                100.0f,
+                                                                0.0f));
+    
+    addParameter(mDuckThresholdParameter = new juce::AudioParameterFloat("duckThreshold",
+                                                                         "Duck Threshold",
+                                                                         -60.0f,
+                                                                         0.0f,
+                                                                         -30.0f));
+    
+    addParameter(mDuckAttackParameter = new juce::AudioParameterFloat("duckAttack",
+                                                                      "Duck Attack",
+                                                                      juce::NormalisableRange<float>(1.0f, 100.0f, 0.0f, 0.5f),
+                                                                      10.0f));
+    
+    addParameter(mDuckReleaseParameter = new juce::AudioParameterFloat("duckRelease",
+                                                                       "Duck Release",
+                                                                       juce::NormalisableRange<float>(10.0f, 2000.0f, 0.0f, 0.4f),
+                                                                       250.0f));
+    
+    addParameter(mDuckSourceParameter = new juce::AudioParameterChoice("duckSource",
+                                                                       "Duck Source",
+                                                                       Ducker::getSourceNames(),
+                                                                       (int) Ducker::Source::input));
+    
+    // reverse and granular playback read the lines as a stream of windowed
+    // grains in place of the read heads. density is in grains per second and
+    // jitter scatters their timing and how far back they read. the network
+    // has lines of its own, so with smear on playback is normal
+    addParameter(mPlaybackParameter = new juce::AudioParameterChoice("playback",
+                                                                     "Playback",
+                                                                     GrainCloud::getModeNames(),
+                                                                     (int) GrainCloud::Mode::normal));
+    
+    addParameter(mGrainSizeParameter = new juce::AudioParameterFloat("grainSize",
+                                                                     "Grain Size",
+                                                                     juce::NormalisableRange<float>(10.0f, kMaxGrainMilliseconds, 0.0f, 0.5f),
+                                                                     150.0f));
+    
+    addParameter(mGrainDensityParameter = new juce::AudioParameterFloat("grainDensity",
+                                                                        "Grain Density",
+                                                                        juce::NormalisableRange<float>(1.0f, 100.0f, 0.0f, 0.4f),
+                                                                        12.0f));
+    
+    addParameter(mGrainJitterParameter = new juce::AudioParameterFloat("grainJitter",
+                                                                       "Grain Jitter",
+                                                                       0.0f,
+                                                                       100.0f,
+                                                                       20.0f));
+    
+    addParameter(mGrainShapeParameter = new juce::AudioParameterChoice("grainShape",
+                                                                       "Grain Shape",
+                                                                       GrainCloud::getShapeNames(),
+                                                                       (int) GrainCloud::Shape::hann));
+    
+    // shimmer pitch-shifts what goes back round the loop, not what is heard,
+    // so the first echo is at pitch and each repeat climbs or falls by the
+    // interval from the last. the amount blends the shifted feedback in. the
+    // shifter's window lags by about 25 ms, which the feedback read takes
+    // back where the delay is long enough. the smear network keeps its own
+    // feedback, so it doesn't shimmer
+    addParameter(mShimmerParameter = new juce::AudioParameterFloat("shimmer",
+                                                                   "Shimmer",
+                                                                   0.0f,
+                                                                   100.0f,
+                                                                   0.0f));
+    
+    addParameter(mShimmerPitchParameter = new juce::AudioParameterInt("shimmerPitch",
+                                                                      "Shimmer Pitch",
+                                                                      -12,
+                                                                      12,
+                                                                      12));
+    
+    
+    mSampleRate = 44100.0;
+    mScratchSize = 0;
+    mScratchChannels = 0;
+    mIdleAfterSamples = 0;
+    mSilentSamples = 0;
+    mIsIdle = false;
+    mControlInterval = kControlInterval;
+    mMemoryFormat = DelayMemory::Format::float32;
+    mMaximumDelayTime = kMaxDelaySeconds;
+    mDelayTimeLimit = kMaxDelaySeconds;
+    mControlPosition = 0;
+    mSegment = {};
+    mJumpFadeLength = 1;
+    mJumpFadePosition = 1;
+    mHostBpm = 120.0;
+    
+    setSimdEnabled(DelayKernels::isSimdAvailable());
+    
+    juce::zeromem(mFeedback, sizeof(mFeedback));
+    juce::zeromem(mJumpFrom, sizeof(mJumpFrom));
+    juce::zeromem(mJumpTo, sizeof(mJumpTo));
+    juce::zeromem(mIsStreamRunning, sizeof(mIsStreamRunning));
+    
+    mLastTapCount = 0;
+    mLastTapLength = *mTapLengthParameter;
+    mHasCustomTaps = false;
+    mHasRestoredTaps = false;
+    mCurrentProgram = 0;
+    mIsProgramRestored = false;
+    mPresetMorphTime = PresetBank::kDefaultMorphSeconds;
+    
+    // the tap pattern is rebuilt and the load meter updated here on the
+    // message thread, never in processBlock
+    startTimerHz(10);
 }
 
 KadenzeDelayAudioProcessor::~KadenzeDelayAudioProcessor()
 {
-    if (mCircularBufferLeft != nullptr){
-        delete [] mCircularBufferLeft;
-        mCircularBufferLeft = nullptr;
-    }
-    
-    if (mCircularBufferRight != nullptr){
-        delete [] mCircularBufferRight;
-        mCircularBufferRight = nullptr;
-    }
 }
 
 //==============================================================================
@@ -115,65 +429,239 @@ bool KadenzeDelayAudioProcessor::isMidiEffect() const
 
 double KadenzeDelayAudioProcessor::getTailLengthSeconds() const
 {
-    return 0.0;
+    // every trip round the line scales the echo by the feedback gain, so the
+    // tail takes log(threshold) / log(feedback) trips of the longest delay
+    // to fall below -120 dBFS
+    float delayTimeLeft, delayTimeRight;
+    getDelayTimeTargets(mHostBpm, false, delayTimeLeft, delayTimeRight);
+    
+    const double longestDelay = juce::jmax(delayTimeLeft, delayTimeRight);
+    const double feedback = juce::jlimit(1.0e-3, 0.999, (double) *mFeedbackParameter);
+    const double roundTrips = std::ceil(std::log((double) kSilenceThreshold) / std::log(feedback));
+    
+    double tail = longestDelay * (roundTrips + 1.0);
+    
+    // the shifter's latency isn't always taken back, so count it on every
+    // trip
+    if (*mShimmerParameter > 0.0f && mSampleRate > 0.0)
+        tail += roundTrips * mShifter.getLatency() / mSampleRate;
+    
+    // the taps are feed-forward, so they only add their own length
+    if (*mTapCountParameter > 0)
+        tail = juce::jmax(tail, (double) *mTapLengthParameter);
+    
+    // grains read past the delay time by their jitter and, in reverse, by
+    // twice their length
+    if (mPlaybackParameter->getIndex() != (int) GrainCloud::Mode::normal)
+        tail += (*mGrainJitterParameter * 0.01 + 2.0) * *mGrainSizeParameter * 0.001;
+    
+    return tail;
 }
 
 int KadenzeDelayAudioProcessor::getNumPrograms()
 {
-    return 1;   // NB: some hosts don't cope very well if you tell them there are 0 programs,
-                // so this should be at least 1, even if you're not really implementing programs.
+    return PresetBank::getFactoryPresets().size();
 }
 
 int KadenzeDelayAudioProcessor::getCurrentProgram()
 {
-    return 0;
+    return mCurrentProgram;
 }
 
 void KadenzeDelayAudioProcessor::setCurrentProgram (int index)
 {
+    const auto& presets = PresetBank::getFactoryPresets();
+    
+    if (! juce::isPositiveAndBelow(index, presets.size()))
+        return;
+    
+    // some hosts set the current program again after restoring a session,
+    // which mustn't wipe what was restored. any other call loads the
+    // program afresh, even the one already selected
+    const bool isRestoredProgram = mIsProgramRestored && index == mCurrentProgram;
+    mIsProgramRestored = false;
+    
+    if (isRestoredProgram)
+        return;
+    
+    mCurrentProgram = index;
+    
+    const auto& parameters = getParameters();
+    jassert(parameters.size() <= PresetBank::kMaxParameters);
+    float values[PresetBank::kMaxParameters];
+    
+    for (int i = 0; i < parameters.size(); ++i)
+        values[i] = parameters[i]->getDefaultValue();
+    
+    for (const auto& setting : presets.getReference(index).settings) {
+        const int parameter = findParameter(setting.parameterID, 0);
+        
+        if (auto* ranged = parameter >= 0 ? dynamic_cast<juce::RangedAudioParameter*>(parameters[parameter]) : nullptr)
+            values[parameter] = ranged->convertTo0to1(setting.value);
+    }
+    
+    applyParameterSet(values, mPresetMorphTime);
 }
 
 const juce::String KadenzeDelayAudioProcessor::getProgramName (int index)
 {
-    return {};
+    const auto& presets = PresetBank::getFactoryPresets();
+    return juce::isPositiveAndBelow(index, presets.size()) ? presets.getReference(index).name : juce::String();
 }
 
 void KadenzeDelayAudioProcessor::changeProgramName (int index, const juce::String& newName)
 {
 }
 
+void KadenzeDelayAudioProcessor::applyParameterSet (const float* values, double morphSeconds)
+{
+    const auto& parameters = getParameters();
+    mPresets.publish(parameters, values, morphSeconds);
+    
+    // the audio thread reads the published values until setApplied, so the
+    // parameters can be set one at a time. unchanged ones are left alone,
+    // which spares the host a notification for each
+    for (int i = 0; i < parameters.size(); ++i) {
+        auto* parameter = parameters[i];
+        
+        if (parameter != mDspLoadParameter && parameter->getValue() != values[i])
+            parameter->setValueNotifyingHost(values[i]);
+    }
+    
+    mPresets.setApplied();
+}
+
+int KadenzeDelayAudioProcessor::findParameter (const juce::String& parameterID, int hint) const
+{
+    const auto& parameters = getParameters();
+    
+    for (int i = 0; i < parameters.size(); ++i) {
+        const int index = (hint + i) % parameters.size();
+        
+        if (auto* withID = dynamic_cast<juce::AudioProcessorParameterWithID*>(parameters[index]))
+            if (withID->paramID == parameterID)
+                return index;
+    }
+    
+    return -1;
+}
+
 //==============================================================================
 void KadenzeDelayAudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
-    mDelayTimeLeftInSamples = sampleRate * *mDelayTimeLeftParameter;
-    mDelayTimeRightInSamples = sampleRate * *mDelayTimeRightParameter;
+    // hosts can re-prepare at a new rate without reloading the plugin. the
+    // line is resized here, off the audio thread, and keeps its tail: the
+    // history is resampled so echoes already in flight keep their timing
+    const double resampleRatio = mCircularBuffer.getLength() > 0 ? sampleRate / mSampleRate : 1.0;
+    mSampleRate = sampleRate;
     
-    mCircularBufferLength = sampleRate * MAX_DELAY_TIME;
+    // one line per processed channel. the sidechain only keys the ducking,
+    // so it doesn't get lines of its own
+    const int numChannels = juce::jlimit(1, (int) CrossFeedMatrix::kMaxChannels,
+                                         juce::jmax(getMainBusNumInputChannels(), getMainBusNumOutputChannels()));
     
-    if (mCircularBufferLeft == nullptr){
-        mCircularBufferLeft = new float[mCircularBufferLength];
-    }
+    // the lines round this up to a power of two so positions wrap with a mask.
+    // they are paged, so a long maximum only costs a longer page table here.
+    // at double precision full-precision memory holds doubles, so nothing in
+    // the feedback loop is rounded to float
+    mDelayTimeLimit = mMaximumDelayTime;
+    const int circularBufferLength = (int) std::ceil(sampleRate * mDelayTimeLimit) + 1;
+    const auto memoryFormat = mMemoryFormat == DelayMemory::Format::float32 && isUsingDoublePrecision() ? DelayMemory::Format::float64
+                                                                                                        : mMemoryFormat;
+    mCircularBuffer.prepare(numChannels, circularBufferLength, resampleRatio, memoryFormat);
+    mMultiTap.prepare(sampleRate, numChannels, kMaxTapLengthSeconds);
+    
+    // the engine may only go idle once every sample that can still be read
+    // has been overwritten with silence. the first control interval narrows
+    // this to the history the delay times keep
+    mIdleAfterSamples = juce::jmax(mCircularBuffer.getHistoryLength(), mMultiTap.getHistoryLength());
+    mTelemetry.prepare(juce::jmin(mCircularBuffer.getLength(),
+                                  juce::nextPowerOfTwo((int) std::ceil(sampleRate * kMinimumHistorySeconds))));
+    mDspLoad.prepare(sampleRate, samplesPerBlock);
+    mSilentSamples = 0;
+    mIsIdle = false;
+    
+    // build the shared sinc table here rather than on the audio thread
+    Interpolators::Sinc::getTable();
     
-    juce::zeromem(mCircularBufferLeft, mCircularBufferLength * sizeof(float));
+    // wet, feedback, cross-feed and looped scratch for every channel, one
+    // host block long. each part starts on a 64-byte boundary. processDelay
+    // splits larger runs into chunks, so it never needs more than this
+    const int scratchSize = (juce::jmax(1, samplesPerBlock) + 15) & ~15;
     
-    if (mCircularBufferRight == nullptr){
-        mCircularBufferRight = new float[mCircularBufferLength];
+    if (scratchSize != mScratchSize || numChannels != mScratchChannels) {
+        mScratchSize = scratchSize;
+        mScratchChannels = numChannels;
+        mScratch.allocate((size_t) mScratchSize * (size_t) numChannels * 4 + 8, true);
+        mModulatedDelays.allocate((size_t) mScratchSize, true);
     }
     
-    juce::zeromem(mCircularBufferRight, mCircularBufferLength * sizeof(float));
+    // the shaper's oversampler works on the same chunks as the scratch
+    mFeedbackShaper.prepare(sampleRate, numChannels, mScratchSize, isUsingDoublePrecision());
+    mModulation.prepare(sampleRate);
+    mNetwork.prepare(sampleRate, mScratchSize, resampleRatio, memoryFormat);
+    mDucker.prepare(sampleRate, mControlInterval);
+    mGrains.prepare(sampleRate, mScratchSize);
+    
+    // the shifter's line is only a window long, so it always keeps full
+    // precision
+    mShifter.prepare(sampleRate, numChannels, mScratchSize,
+                     isUsingDoublePrecision() ? DelayMemory::Format::float64 : DelayMemory::Format::float32);
+    
+    // the smoothers step once per control interval, which starts again here.
+    // jump mode's heads are in samples, so they are placed again too
+    mControlPosition = 0;
+    mSegment.isJump = false;
+    mSegment.isShimmering = false;
+    mJumpFadeLength = juce::jmax(1, juce::roundToInt(sampleRate * kJumpFadeMilliseconds * 0.001));
+    
+    mDryWetSmoother.prepare(sampleRate, mControlInterval);
+    mFeedbackSmoother.prepare(sampleRate, mControlInterval);
+    mDelayTimeLeftSmoother.prepare(sampleRate, mControlInterval);
+    mDelayTimeRightSmoother.prepare(sampleRate, mControlInterval);
+    mDriveSmoother.prepare(sampleRate, mControlInterval);
+    mModulationDepthSmoother.prepare(sampleRate, mControlInterval);
+    mShimmerSmoother.prepare(sampleRate, mControlInterval);
     
-    mCircularBufferWriteHeadLeft = 0;
-    mCircularBufferWriteHeadRight = 0;
+    mDryWetSmoother.setGlideTime(kGainGlideMilliseconds);
+    mFeedbackSmoother.setGlideTime(kGainGlideMilliseconds);
+    mDriveSmoother.setGlideTime(kGainGlideMilliseconds);
+    mModulationDepthSmoother.setGlideTime(kGainGlideMilliseconds);
+    mShimmerSmoother.setGlideTime(kGainGlideMilliseconds);
+    mDelayTimeLeftSmoother.setGlideTime(*mGlideParameter);
+    mDelayTimeRightSmoother.setGlideTime(*mGlideParameter);
     
-    mDelayTimeLeftSmoothed = *mDelayTimeLeftParameter;
-    mDelayTimeRightSmoothed = *mDelayTimeRightParameter;
+    mDryWetSmoother.setCurrentValue(*mDryWetParameter);
+    mFeedbackSmoother.setCurrentValue(*mFeedbackParameter);
+    mDriveSmoother.setCurrentValue(*mDriveParameter * 0.01f);
+    mModulationDepthSmoother.setCurrentValue(*mModulationDepthParameter);
+    mShimmerSmoother.setCurrentValue(*mShimmerParameter * 0.01f);
+    mDelayTimeLeftSmoother.setCurrentValue(juce::jmin(mDelayTimeLeftParameter->get(), (float) mDelayTimeLimit));
+    mDelayTimeRightSmoother.setCurrentValue(juce::jmin(mDelayTimeRightParameter->get(), (float) mDelayTimeLimit));
 
 }
 
 void KadenzeDelayAudioProcessor::releaseResources()
 {
-    // When playback stops, you can use this as an opportunity to free up any
-    // spare memory, etc.
+    // the delay memory is kept so the next prepareToPlay can carry the tail
+    // over, and so re-preparing at the same size doesn't allocate at all
+}
+
+void KadenzeDelayAudioProcessor::reset()
+{
+    mCircularBuffer.clear();
+    mMultiTap.reset();
+    mFeedbackShaper.reset();
+    mModulation.reset();
+    mNetwork.reset();
+    mDucker.reset();
+    mGrains.reset();
+    mShifter.reset();
+    juce::zeromem(mFeedback, sizeof(mFeedback));
+    mControlPosition = 0;
+    
+    // the memory is empty now, so there is nothing to wait for
+    mIsIdle = true;
 }
 
 #ifndef JucePlugin_PreferredChannelConfigurations
@@ -183,12 +671,11 @@ bool KadenzeDelayAudioProcessor::isBusesLayoutSupported (const BusesLayout& layo
     juce::ignoreUnused (layouts);
     return true;
   #else
-    // This is the place where you check if the layout is supported.
-    // In this template code we only support mono or stereo.
-    // Some plugin hosts, such as certain GarageBand versions, will only
-    // load plugins that support stereo bus layouts.
-    if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::mono()
-     && layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
+    // any layout up to the engine's channel limit, from mono through
+    // surround and ambisonic formats
+    const auto& outputSet = layouts.getMainOutputChannelSet();
+    
+    if (outputSet.isDisabled() || outputSet.size() > CrossFeedMatrix::kMaxChannels)
         return false;
 
     // This checks if the input layout matches the output layout
@@ -203,8 +690,26 @@ bool KadenzeDelayAudioProcessor::isBusesLayoutSupported (const BusesLayout& layo
 #endif
 
 void KadenzeDelayAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processSamples(buffer);
+}
+
+void KadenzeDelayAudioProcessor::processBlock (juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processSamples(buffer);
+}
+
+bool KadenzeDelayAudioProcessor::supportsDoublePrecisionProcessing() const
+{
+    return true;
+}
+
+template <typename SampleType>
+void KadenzeDelayAudioProcessor::processSamples (juce::AudioBuffer<SampleType>& buffer)
 {
     juce::ScopedNoDenormals noDenormals;
+    DspLoad::ScopedMeasurement loadMeasurement(mDspLoad, buffer.getNumSamples());
+    
     auto totalNumInputChannels  = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
 
@@ -212,85 +717,997 @@ void KadenzeDelayAudioProcessor::processBlock (juce::AudioBuffer<float>& buffer,
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear (i, 0, buffer.getNumSamples());
     
-    // get pointers to the left and right channels of the audio buffer
-    float* leftChannel = buffer.getWritePointer(0);
-    float* rightChannel = buffer.getWritePointer(1);
+    const int numSamples = buffer.getNumSamples();
+    
+    // only channels that carry input and have a delay line are processed,
+    // so a mono layout never touches a second channel, and the sidechain's
+    // channels after the main input's are left alone
+    const int numChannels = juce::jmin(getMainBusNumInputChannels(), buffer.getNumChannels(), mCircularBuffer.getNumChannels());
+    
+    if (numChannels <= 0)
+        return;
+    
+    // offline renders can outrun the thread that prepares the delay pages
+    mCircularBuffer.setNonRealtime(isNonRealtime());
+    mNetwork.setNonRealtime(isNonRealtime());
+    
+    // offline renders run the higher quality shifter
+    mShifter.setNonRealtime(isNonRealtime());
+    
+    // the tempo is read once per block, like every parameter, and turned
+    // into seconds with the targets. from then on synced times take exactly
+    // the same path as free ones
+    if (auto* playHead = getPlayHead())
+        if (auto position = playHead->getPosition())
+            if (auto bpm = position->getBpm())
+                if (*bpm > 0.0)
+                    mHostBpm = *bpm;
+    
+    // snapshot every parameter once per block. each one is an atomic load;
+    // every control interval that starts in this block glides towards these.
+    // a preset published while they were read may have changed some of
+    // them already, so it is only picked up afterwards, and then the
+    // snapshot is taken again from the preset
+    ParameterTargets targets;
+    readParameterTargets(targets);
+    
+    if (mPresets.pull(mSampleRate))
+        readParameterTargets(targets);
+    
+    mPresets.advance(numSamples);
+    
+    mDelayTimeLeftSmoother.setGlideTime(targets.glide);
+    mDelayTimeRightSmoother.setGlideTime(targets.glide);
+    
+    // the matrix is rebuilt only when the preset or the layout changes
+    const auto crossFeedPreset = targets.crossFeed;
+    
+    if (crossFeedPreset != mCrossFeed.getPreset() || numChannels != mCrossFeed.getNumChannels())
+        mCrossFeed.setPreset(crossFeedPreset, numChannels);
+    
+    // pick the interpolator once for the whole block. jump mode only ever
+    // reads whole samples, unless the mode changes part way through
+    ProcessFunction<SampleType> process;
+    
+    if (targets.jump && mSegment.isJump) {
+        process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::None, SampleType>;
+    } else {
+        switch (targets.interpolation) {
+            case Interpolators::Quality::cubicHermite:
+                process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::CubicHermite, SampleType>;
+                break;
+            case Interpolators::Quality::lagrange:
+                process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::Lagrange, SampleType>;
+                break;
+            case Interpolators::Quality::thiran:
+                process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::Thiran, SampleType>;
+                break;
+            case Interpolators::Quality::sinc:
+                process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::Sinc, SampleType>;
+                break;
+            case Interpolators::Quality::linear:
+            default:
+                process = &KadenzeDelayAudioProcessor::processDelay<Interpolators::Linear, SampleType>;
+                break;
+        }
+    }
+    
+    SampleType* channels[CrossFeedMatrix::kMaxChannels];
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        channels[channel] = buffer.getWritePointer(channel);
+    
+    const bool collectTelemetry = mTelemetry.isEnabled();
+    
+    if (collectTelemetry)
+        mTelemetry.addInput(channels, numChannels, numSamples);
+    
+    // the ducking key: the sidechain when it is chosen and connected,
+    // otherwise the input, which is read before it is overwritten
+    const SampleType* key[CrossFeedMatrix::kMaxChannels];
+    int numKeyChannels = numChannels;
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        key[channel] = channels[channel];
+    
+    if (targets.duckSource == Ducker::Source::sidechain && getBusCount(true) > 1) {
+        const auto sidechain = getBusBuffer(buffer, true, 1);
+        
+        if (sidechain.getNumChannels() > 0) {
+            numKeyChannels = juce::jmin(sidechain.getNumChannels(), (int) CrossFeedMatrix::kMaxChannels);
+            
+            for (int channel = 0; channel < numKeyChannels; ++channel)
+                key[channel] = sidechain.getReadPointer(channel);
+        }
+    }
+    
+    // the block is split where control intervals start, so each part runs
+    // the vector kernels with a single set of ramps. once every smoother has
+    // settled the ramps are flat and the rest of the block runs in one go.
+    // a flat interval carried over from the last block still has to end at
+    // the grid, where this block's targets are picked up
+    int position = 0;
+    bool hasStartedInterval = false;
+    
+    while (position < numSamples) {
+        if (mControlPosition == 0) {
+            startControlInterval(targets, numChannels);
+            hasStartedInterval = true;
+        }
+        
+        const int remaining = numSamples - position;
+        const int run = mSegment.isFlat && hasStartedInterval ? remaining
+                                                              : juce::jmin(remaining, mControlInterval - mControlPosition);
+        
+        SampleType* segment[CrossFeedMatrix::kMaxChannels];
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            segment[channel] = channels[channel] + position;
+        
+        if (mDucker.isActive()) {
+            const SampleType* keySegment[CrossFeedMatrix::kMaxChannels];
+            
+            for (int channel = 0; channel < numKeyChannels; ++channel)
+                keySegment[channel] = key[channel] + position;
+            
+            mDucker.addKey(keySegment, numKeyChannels, run);
+        }
+        
+        int processed;
+        
+        if (mIsIdle) {
+            // while idle the delay memory holds nothing audible, so silent
+            // input passes straight through. the first audible sample wakes
+            // the engine exactly where it lands; the samples before it only
+            // move the write position on
+            processed = findFirstAudibleSample(segment, numChannels, run);
+            
+            if (mNetwork.getNumLines() > 0)
+                mNetwork.advance(processed);
+            else
+                mCircularBuffer.advance(processed);
+            
+            mModulation.advance(processed);
+            
+            if (mGrains.isActive())
+                mGrains.advance(processed, mSegment.delayStart, mSegment.delayIncrement, numChannels, mControlPosition);
+            
+            if (mSegment.isShimmering)
+                mShifter.advance(processed);
+            
+            if (processed < run) {
+                mIsIdle = false;
+                mSilentSamples = 0;
+            }
+        } else {
+            // returns early if the lines go idle part way through
+            if (mNetwork.getNumLines() > 0)
+                processed = processNetwork(segment, numChannels, run);
+            else
+                processed = (this->*process)(segment, numChannels, run);
+        }
+        
+        position += processed;
+        mControlPosition = (mControlPosition + processed) % mControlInterval;
+    }
+    
+    if (collectTelemetry)
+        mTelemetry.endBlock(numSamples, mCircularBuffer.getWriteIndex());
+}
+
+void KadenzeDelayAudioProcessor::readParameterTargets (ParameterTargets& targets) const
+{
+    targets.dryWet = readParameter(mDryWetParameter);
+    targets.feedback = readParameter(mFeedbackParameter);
+    targets.lowCut = readParameter(mLowCutParameter);
+    targets.highCut = readParameter(mHighCutParameter);
+    targets.drive = readParameter(mDriveParameter) * 0.01f;
+    targets.modulationRate = readParameter(mModulationRateParameter);
+    targets.modulationDepth = readParameter(mModulationDepthParameter);
+    targets.modulationStereo = readParameter(mModulationStereoParameter);
+    targets.modulationShape = (ModulationLfo::Shape) readParameter(mModulationShapeParameter);
+    targets.damping = readParameter(mDampingParameter) * 0.01f;
+    targets.networkLines = FeedbackDelayNetwork::getNumLinesForSize(readParameter(mSmearParameter));
+    targets.playback = targets.networkLines > 0 ? GrainCloud::Mode::normal
+                                                : (GrainCloud::Mode) readParameter(mPlaybackParameter);
+    targets.grainSize = readParameter(mGrainSizeParameter);
+    targets.grainDensity = readParameter(mGrainDensityParameter);
+    targets.grainJitter = readParameter(mGrainJitterParameter) * 0.01f;
+    targets.grainShape = (GrainCloud::Shape) readParameter(mGrainShapeParameter);
+    targets.shimmer = readParameter(mShimmerParameter) * 0.01f;
+    targets.shimmerPitch = readParameter(mShimmerPitchParameter);
+    targets.duckAmount = readParameter(mDuckParameter) * 0.01f;
+    targets.duckThreshold = readParameter(mDuckThresholdParameter);
+    targets.duckAttack = readParameter(mDuckAttackParameter);
+    targets.duckRelease = readParameter(mDuckReleaseParameter);
+    targets.duckSource = (Ducker::Source) readParameter(mDuckSourceParameter);
+    targets.glide = readParameter(mGlideParameter);
+    targets.crossFeed = (CrossFeedMatrix::Preset) readParameter(mCrossFeedParameter);
+    targets.interpolation = (Interpolators::Quality) readParameter(mInterpolationParameter);
+    
+    getDelayTimeTargets(mHostBpm, true, targets.delayTimeLeft, targets.delayTimeRight);
+    
+    // the network's lengths always glide: its reads are interpolated anyway.
+    // grains read whole samples from wherever the glide has got to
+    targets.jump = readParameter(mTimeModeParameter) == 1 && targets.networkLines == 0
+                && targets.playback == GrainCloud::Mode::normal;
+}
+
+float KadenzeDelayAudioProcessor::readParameter (const juce::AudioParameterFloat* parameter) const
+{
+    if (mPresets.isActive())
+        return parameter->convertFrom0to1(mPresets.getValue(parameter->getParameterIndex()));
+    
+    return parameter->get();
+}
+
+int KadenzeDelayAudioProcessor::readParameter (const juce::AudioParameterChoice* parameter) const
+{
+    if (mPresets.isActive())
+        return juce::roundToInt(parameter->convertFrom0to1(mPresets.getValue(parameter->getParameterIndex())));
+    
+    return parameter->getIndex();
+}
 
-    // iterate through each sample in the audio buffer
-    for (int i = 0; i < buffer.getNumSamples(); i++) {
-        // smooth the delay time parameter
-        mDelayTimeLeftSmoothed = mDelayTimeLeftSmoothed - 0.001 * (mDelayTimeLeftSmoothed - *mDelayTimeLeftParameter);
-        mDelayTimeRightSmoothed = mDelayTimeRightSmoothed - 0.001 * (mDelayTimeRightSmoothed - *mDelayTimeRightParameter);
+int KadenzeDelayAudioProcessor::readParameter (const juce::AudioParameterInt* parameter) const
+{
+    if (mPresets.isActive())
+        return juce::roundToInt(parameter->convertFrom0to1(mPresets.getValue(parameter->getParameterIndex())));
+    
+    return parameter->get();
+}
 
-        // calculate delay time in samples based on current smoothed delay time
-        mDelayTimeLeftInSamples = getSampleRate() * mDelayTimeLeftSmoothed;
-        mDelayTimeRightInSamples = getSampleRate() * mDelayTimeRightSmoothed;
+bool KadenzeDelayAudioProcessor::readParameter (const juce::AudioParameterBool* parameter) const
+{
+    if (mPresets.isActive())
+        return mPresets.getValue(parameter->getParameterIndex()) >= 0.5f;
+    
+    return parameter->get();
+}
 
+void KadenzeDelayAudioProcessor::getDelayTimeTargets (double bpm, bool isAudioThread, float& left, float& right) const
+{
+    // only the audio thread follows a preset as it morphs in
+    double leftSeconds = isAudioThread ? readParameter(mDelayTimeLeftParameter) : mDelayTimeLeftParameter->get();
+    double rightSeconds = isAudioThread ? readParameter(mDelayTimeRightParameter) : mDelayTimeRightParameter->get();
+    
+    if (isAudioThread ? readParameter(mTempoSyncParameter) : mTempoSyncParameter->get()) {
+        const int noteLeft = isAudioThread ? readParameter(mNoteLeftParameter) : mNoteLeftParameter->getIndex();
+        const int noteRight = isAudioThread ? readParameter(mNoteRightParameter) : mNoteRightParameter->getIndex();
+        const float swing = isAudioThread ? readParameter(mSwingParameter) : mSwingParameter->get();
         
-        // write input samples to circular buffer with feedback
-        mCircularBufferLeft[mCircularBufferWriteHeadLeft] = rightChannel[i] + mFeedbackRight;
-        mCircularBufferRight[mCircularBufferWriteHeadRight] =  leftChannel[i] + mFeedbackLeft;
+        leftSeconds = TempoSync::getDivisionSeconds(noteLeft, bpm);
+        rightSeconds = TempoSync::getDivisionSeconds(noteRight, bpm);
+        TempoSync::applySwing(leftSeconds, rightSeconds, swing * 0.01);
+    }
+    
+    // slow tempos, long notes and a maximum set below the parameters' range
+    // can ask for more than the lines hold
+    left = (float) juce::jlimit(0.01, mDelayTimeLimit, leftSeconds);
+    right = (float) juce::jlimit(0.01, mDelayTimeLimit, rightSeconds);
+}
+
+void KadenzeDelayAudioProcessor::startControlInterval (const ParameterTargets& targets, int numChannels)
+{
+    mSegment.dryWet = mDryWetSmoother.advance(targets.dryWet);
+    mSegment.feedback = mFeedbackSmoother.advance(targets.feedback);
+    startNetwork(targets);
+    startFeedbackShaping(targets);
+    startModulation(targets);
+    startDucking(targets);
+    startGrains(targets);
+    startShimmer(targets);
+    
+    if (targets.jump) {
+        startJump(targets, numChannels);
+        updateShimmerLatency(numChannels);
+        updateRetainedLength(numChannels);
+        return;
+    }
+    
+    mSegment.isJump = false;
+    
+    const ParameterRamp delayTimeLeft = mDelayTimeLeftSmoother.advance(targets.delayTimeLeft);
+    const ParameterRamp delayTimeRight = mDelayTimeRightSmoother.advance(targets.delayTimeRight);
+    
+    // the first channel takes the left time and the last the right one, with
+    // the channels in between spread evenly. mono uses the left time. grains
+    // are both heard and fed back, so they are brought forward by the
+    // shaper's latency rather than read twice
+    const double grainLatency = mGrains.isActive() ? getLoopLatency() : 0;
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        const double position = numChannels > 1 ? (double) channel / (numChannels - 1) : 0.0;
+        const double start = delayTimeLeft.start + position * (delayTimeRight.start - delayTimeLeft.start);
+        const double increment = delayTimeLeft.increment + position * (delayTimeRight.increment - delayTimeLeft.increment);
+        
+        mSegment.delayStart[channel] = start * mSampleRate - grainLatency;
+        mSegment.delayIncrement[channel] = increment * mSampleRate;
+    }
+    
+    // a flat interval is followed by identical ones until the targets change,
+    // which can only happen at the next block
+    mSegment.isFlat = mSegment.dryWet.isFlat() && mSegment.feedback.isFlat() && mSegment.isShapingFlat
+                   && mSegment.modulationDepth.isFlat() && mSegment.duckGain.isFlat() && ! mDucker.isActive()
+                   && mSegment.shimmer.isFlat() && delayTimeLeft.isFlat() && delayTimeRight.isFlat();
+    
+    if (mNetwork.getNumLines() > 0)
+        mNetwork.setDelays(mSegment.delayStart, mSegment.delayIncrement, numChannels, mControlInterval);
+    
+    updateShimmerLatency(numChannels);
+    updateRetainedLength(numChannels);
+}
+
+void KadenzeDelayAudioProcessor::updateShimmerLatency (int numChannels)
+{
+    // the shifted feedback is read earlier again by the shifter's latency,
+    // as far as the interval's shortest delay allows. it is settled once
+    // per interval, so the read only moves where the delay times do
+    mSegment.shimmerLatency = 0;
+    
+    if (! mSegment.isShimmering || mGrains.isActive())
+        return;
+    
+    double shortestDelay = mSegment.delayStart[0];
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        shortestDelay = juce::jmin(shortestDelay, mSegment.delayStart[channel],
+                                   mSegment.delayStart[channel] + mSegment.delayIncrement[channel] * mControlInterval);
+    
+    mSegment.shimmerLatency = juce::jlimit(0, mShifter.getLatency(),
+                                           (int) shortestDelay - getLoopLatency() - kShortestShimmerReadSamples);
+}
+
+void KadenzeDelayAudioProcessor::updateRetainedLength (int numChannels)
+{
+    // the network hands back its own history as its lengths are set
+    if (mNetwork.getNumLines() > 0) {
+        mIdleAfterSamples = juce::jmax(mNetwork.getHistoryLength(), mMultiTap.getHistoryLength());
+        return;
+    }
+    
+    // the lines keep what this interval's reads reach, and hand back older
+    // history. a flat interval's reads reach no further in later intervals
+    double deepest = kMinimumHistorySeconds * mSampleRate;
+    
+    // modulation reaches out to the depth past the delay. grains reach out
+    // to their jitter, and reverse ones twice their length further, while
+    // grains already playing keep reading from where they started
+    const ParameterRamp& depth = mSegment.modulationDepth;
+    double reach = 0.0;
+    
+    if (mGrains.isActive()) {
+        reach = mGrains.getReach();
+        deepest = juce::jmax(deepest, (double) mGrains.getDeepestDelay());
+    } else if (mSegment.isModulated) {
+        reach = juce::jmax(depth.start, depth.getEnd(mControlInterval)) * mSampleRate * 0.001;
+    }
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        deepest = juce::jmax(deepest, mSegment.delayStart[channel] + reach,
+                             mSegment.delayStart[channel] + mSegment.delayIncrement[channel] * mControlInterval + reach);
         
-        // calculate read head position in circular
-        mDelayReadHeadLeft = mCircularBufferWriteHeadLeft - mDelayTimeLeftInSamples;
-        mDelayReadHeadRight = mCircularBufferWriteHeadRight - mDelayTimeRightInSamples;
+        if (mSegment.isJump)
+            deepest = juce::jmax(deepest, (double) mJumpFrom[channel], (double) mJumpTo[channel]);
+    }
+    
+    mCircularBuffer.setRetainedLength((int) std::ceil(deepest) + 1);
+    
+    // anything older than the retained history is silent already
+    mIdleAfterSamples = juce::jmax(mCircularBuffer.getHistoryLength(), mMultiTap.getHistoryLength());
+}
 
+void KadenzeDelayAudioProcessor::startJump (const ParameterTargets& targets, int numChannels)
+{
+    auto getDelaySamples = [this, numChannels] (int channel, float left, float right)
+    {
+        const double position = numChannels > 1 ? (double) channel / (numChannels - 1) : 0.0;
+        return juce::jmax(1, juce::roundToInt((left + position * (right - left)) * mSampleRate));
+    };
+    
+    // coming from glide mode the heads start where the glide had got to
+    if (! mSegment.isJump) {
+        for (int channel = 0; channel < numChannels; ++channel) {
+            mJumpTo[channel] = getDelaySamples(channel, mDelayTimeLeftSmoother.getCurrentValue(),
+                                               mDelayTimeRightSmoother.getCurrentValue());
+            mJumpFrom[channel] = mJumpTo[channel];
+        }
+        
+        mJumpFadePosition = mJumpFadeLength;
+        mSegment.isJump = true;
+    }
+    
+    // a new time is only taken up once the last jump has faded in, so
+    // there are never more than two heads per channel
+    if (mJumpFadePosition >= mJumpFadeLength) {
+        bool hasChanged = false;
         
-        // handle wrap-around if read head position position is negative
-        if (mDelayReadHeadLeft < 0 ) {
-            mDelayReadHeadLeft += mCircularBufferLength;
+        for (int channel = 0; channel < numChannels; ++channel) {
+            const int target = getDelaySamples(channel, targets.delayTimeLeft, targets.delayTimeRight);
+            mJumpFrom[channel] = mJumpTo[channel];
+            hasChanged = hasChanged || target != mJumpTo[channel];
+            mJumpTo[channel] = target;
         }
         
-        if (mDelayReadHeadRight < 0) {
-            mDelayReadHeadRight += mCircularBufferLength;
+        if (hasChanged)
+            mJumpFadePosition = 0;
+    }
+    
+    // the glide picks up from the new times if the mode is switched back
+    mDelayTimeLeftSmoother.setCurrentValue((float) (mJumpTo[0] / mSampleRate));
+    mDelayTimeRightSmoother.setCurrentValue((float) (mJumpTo[numChannels - 1] / mSampleRate));
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        mSegment.delayStart[channel] = juce::jmin(mJumpFrom[channel], mJumpTo[channel]);
+        mSegment.delayIncrement[channel] = 0.0;
+    }
+    
+    mSegment.isFlat = mSegment.dryWet.isFlat() && mSegment.feedback.isFlat() && mSegment.isShapingFlat
+                   && mSegment.duckGain.isFlat() && ! mDucker.isActive() && mSegment.shimmer.isFlat()
+                   && mJumpFadePosition >= mJumpFadeLength;
+}
+
+void KadenzeDelayAudioProcessor::startFeedbackShaping (const ParameterTargets& targets)
+{
+    // drive glides like the gains. the filters are modulation-safe one-poles,
+    // so the cutoffs are just picked up on the grid. switching drive on or
+    // off changes the loop latency, which moves the reads by a few samples
+    const ParameterRamp drive = mDriveSmoother.advance(targets.drive);
+    mFeedbackShaper.setParameters(targets.lowCut, targets.highCut, mDriveSmoother.getCurrentValue());
+    mSegment.isShapingFlat = drive.isFlat();
+}
+
+void KadenzeDelayAudioProcessor::startNetwork (const ParameterTargets& targets)
+{
+    // switching between the two lines and the network, or resizing it,
+    // starts the engine coming in from silence. the one going out keeps
+    // nothing, so it can't replay a stale tail when it comes back
+    const int numLines = mNetwork.getNumLines();
+    
+    if (targets.networkLines != numLines) {
+        if (numLines == 0 || targets.networkLines == 0) {
+            mCircularBuffer.clear();
+            mFeedbackShaper.reset();
+            juce::zeromem(mFeedback, sizeof(mFeedback));
         }
-        // intergear and fractional parts of the read head position
-        int readHeadL_x = (int)mDelayReadHeadLeft;
-        int readHeadL_x1 = readHeadL_x + 1;
-        float readHeadFloatL = mDelayReadHeadLeft - readHeadL_x;
         
-        int readHeadR_x = (int)mDelayReadHeadRight;
-        int readHeadR_x1 = readHeadR_x + 1;
-        float readHeadFloatR = mDelayReadHeadRight - readHeadR_x;
+        mNetwork.setNumLines(targets.networkLines);
+    }
+    
+    mNetwork.setDamping(targets.damping);
+}
+
+int KadenzeDelayAudioProcessor::getLoopLatency() const
+{
+    return mNetwork.getNumLines() > 0 ? 0 : mFeedbackShaper.getLatency();
+}
+
+void KadenzeDelayAudioProcessor::startModulation (const ParameterTargets& targets)
+{
+    // depth glides; rate, shape and stereo phase are picked up on the grid.
+    // the phase runs on whatever the depth, so modulation comes back in
+    // wherever the LFO has got to
+    mSegment.modulationDepth = mModulationDepthSmoother.advance(targets.modulationDepth);
+    mSegment.isModulated = ! targets.jump && targets.playback == GrainCloud::Mode::normal
+                        && (mSegment.modulationDepth.start != 0.0f || ! mSegment.modulationDepth.isFlat());
+    mModulation.setParameters(targets.modulationRate, targets.modulationShape, targets.modulationStereo);
+}
+
+void KadenzeDelayAudioProcessor::startDucking (const ParameterTargets& targets)
+{
+    // the follower steps on the key it was given over the last interval.
+    // while it is on, every interval has to end on the grid so it sees the
+    // key there, which is why a ducking segment is never flat
+    mDucker.setParameters(targets.duckAmount, targets.duckThreshold, targets.duckAttack, targets.duckRelease);
+    mSegment.duckGain = mDucker.advance();
+}
 
+void KadenzeDelayAudioProcessor::startGrains (const ParameterTargets& targets)
+{
+    // picked up on the grid. each grain keeps the size, window and level it
+    // started with, so changing them never cuts into one that is playing
+    mGrains.setParameters(targets.playback, targets.grainSize, targets.grainDensity, targets.grainJitter, targets.grainShape);
+}
 
-        // hand wrap-around for the next sample if necessary
-        if (readHeadL_x1 >=mCircularBufferLength) {
-            readHeadL_x1 -= mCircularBufferLength;
+void KadenzeDelayAudioProcessor::startShimmer (const ParameterTargets& targets)
+{
+    // the amount glides like the gains and the interval is picked up on the
+    // grid. the shifter comes in from silence, rather than replaying what it
+    // held when it last went out
+    const bool wasShimmering = mSegment.isShimmering;
+    
+    mSegment.shimmer = mShimmerSmoother.advance(targets.shimmer);
+    mSegment.isShimmering = targets.networkLines == 0 && (mSegment.shimmer.start != 0.0f || ! mSegment.shimmer.isFlat());
+    mShifter.setSemitones(targets.shimmerPitch);
+    
+    if (mSegment.isShimmering && ! wasShimmering)
+        mShifter.reset();
+}
+
+void KadenzeDelayAudioProcessor::getModulatedDelays (int channel, int numChannels, double* delays, int numSamples, int offset) const
+{
+    const ParameterRamp& depth = mSegment.modulationDepth;
+    const double samplesPerMillisecond = mSampleRate * 0.001;
+    const double delayStart = mSegment.delayStart[channel];
+    const double delayIncrement = mSegment.delayIncrement[channel];
+    
+    mModulation.render(delays, numSamples, channel, numChannels);
+    
+    for (int i = 0; i < numSamples; ++i) {
+        const double depthSamples = (double) DelayKernels::getRampValue(depth.start, depth.increment, offset + i + 1) * samplesPerMillisecond;
+        delays[i] = delayStart + delayIncrement * (double) (offset + i + 1) + depthSamples * delays[i];
+    }
+}
+
+template <typename Interpolator, typename SampleType>
+int KadenzeDelayAudioProcessor::processDelay (SampleType* const* channels, int numChannels, int numSamples)
+{
+    const BlockParameters& block = mSegment;
+    const ParameterRamp& dryWet = block.dryWet;
+    const ParameterRamp& feedback = block.feedback;
+    
+    // sample i of this run is sample offset + i of the control interval
+    const int offset = mControlPosition;
+    
+    // what is heard is read at the delay time. what goes back round the
+    // loop is read earlier by the latency it picks up on the way, so the
+    // repeats keep their spacing, and what is shimmered earlier again. in
+    // the grain modes the feedback is what the grains play, already brought
+    // forward by the shaper's latency
+    const int feedbackLatency = mGrains.isActive() ? 0 : getLoopLatency();
+    const int shimmerLatency = block.isShimmering ? block.shimmerLatency : 0;
+    
+    // the run is processed in chunks shorter than the shortest delay in it,
+    // less the taps the interpolator reads ahead. nothing read inside a chunk
+    // is written by that chunk, so the reads, the feedback writes and the mix
+    // can each run as a separate branch-free loop
+    double shortestDelay = block.delayStart[0];
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        shortestDelay = juce::jmin(shortestDelay,
+                                   block.delayStart[channel] + block.delayIncrement[channel] * (offset + 1),
+                                   block.delayStart[channel] + block.delayIncrement[channel] * (offset + numSamples));
+    
+    shortestDelay -= feedbackLatency + shimmerLatency;
+    
+    // grains start at the delay time or further back, but one that started
+    // before the delay time grew can still be reading closer
+    if (mGrains.isActive())
+        shortestDelay = juce::jmin(shortestDelay, (double) mGrains.getShortestDelay());
+    
+    const int readAhead = block.isJump ? DelayLine::getReadAhead<Interpolators::None>()
+                                       : DelayLine::getReadAhead<Interpolator>();
+    const int maxChunk = juce::jlimit(1, mScratchSize, (int) shortestDelay - readAhead - 1);
+    
+    // a recursive interpolator's output depends on its last one, so every
+    // read stream keeps its own state. one that starts or stops, when the
+    // loop or shimmer latency comes or goes or the heads switch mode, starts
+    // from rest
+    const bool isReadingRecursively = Interpolator::kIsRecursive && ! mGrains.isActive() && ! block.isJump;
+    const bool isStreamRunning[numReadStreams] = { isReadingRecursively,
+                                                   isReadingRecursively && feedbackLatency > 0,
+                                                   isReadingRecursively && shimmerLatency > 0 };
+    
+    for (int stream = 0; stream < numReadStreams; ++stream) {
+        if (isStreamRunning[stream] != mIsStreamRunning[stream]) {
+            mCircularBuffer.resetStream(stream);
+            mIsStreamRunning[stream] = isStreamRunning[stream];
+        }
+    }
+    
+    // per channel: the delayed signal, the signal offered to the cross-feed
+    // (input plus feedback), for mixing presets what each line is fed, and
+    // the feedback on its way back round the loop. the third also holds the
+    // new head's reads during a jump, as they are mixed into the delayed
+    // signal before the cross-feed needs it, and the second the shimmer's
+    // read, which is shifted before the cross-feed is built
+    SampleType* const scratch = juce::snapPointerToAlignment(reinterpret_cast<SampleType*>(mScratch.get()), (size_t) 64);
+    SampleType* wet[CrossFeedMatrix::kMaxChannels];
+    SampleType* sources[CrossFeedMatrix::kMaxChannels];
+    SampleType* mixed[CrossFeedMatrix::kMaxChannels];
+    SampleType* looped[CrossFeedMatrix::kMaxChannels];
+    const SampleType* lineInputs[CrossFeedMatrix::kMaxChannels];
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        wet[channel] = scratch + (size_t) channel * (size_t) mScratchSize;
+        sources[channel] = wet[channel] + (size_t) numChannels * (size_t) mScratchSize;
+        mixed[channel] = sources[channel] + (size_t) numChannels * (size_t) mScratchSize;
+        looped[channel] = mixed[channel] + (size_t) numChannels * (size_t) mScratchSize;
+    }
+    
+    const bool useSimd = mUseSimd;
+    const bool collectTelemetry = mTelemetry.isEnabled();
+    int chunk;
+    
+    for (int start = 0; start < numSamples; start += chunk) {
+        // a chunk also stops where the lines would have been silent for long
+        // enough to go idle, so that happens at the same sample whatever the
+        // block size
+        chunk = juce::jmin(maxChunk, numSamples - start, juce::jmax(1, mIdleAfterSamples - mSilentSamples));
+        const int chunkOffset = offset + start;
+        
+        // read the delayed samples for the whole chunk. in the reverse and
+        // granular modes the grains stand in for the read heads
+        if (mGrains.isActive()) {
+            mGrains.process(mCircularBuffer, wet, numChannels, chunk, block.delayStart, block.delayIncrement, chunkOffset);
+        } else if (block.isJump) {
+            const bool isFading = mJumpFadePosition < mJumpFadeLength;
+            
+            if (isFading)
+                chunk = juce::jmin(chunk, mJumpFadeLength - mJumpFadePosition);
+            
+            for (int channel = 0; channel < numChannels; ++channel) {
+                readJump(channel, wet[channel], mixed[channel], chunk, isFading, 0);
+                
+                if (feedbackLatency > 0)
+                    readJump(channel, looped[channel], mixed[channel], chunk, isFading, feedbackLatency);
+                
+                if (shimmerLatency > 0)
+                    readJump(channel, sources[channel], mixed[channel], chunk, isFading, feedbackLatency + shimmerLatency);
+            }
+            
+            if (isFading)
+                mJumpFadePosition += chunk;
+        } else if (block.isModulated) {
+            // the LFO is rendered a chunk at a time into per-sample delays,
+            // one channel after another
+            double* const delays = mModulatedDelays.get();
+            
+            for (int channel = 0; channel < numChannels; ++channel) {
+                getModulatedDelays(channel, numChannels, delays, chunk, chunkOffset);
+                mCircularBuffer.readModulated<Interpolator>(channel, wet[channel], chunk, delays, wetStream);
+                
+                if (feedbackLatency > 0) {
+                    juce::FloatVectorOperations::add(delays, -(double) feedbackLatency, chunk);
+                    mCircularBuffer.readModulated<Interpolator>(channel, looped[channel], chunk, delays, loopedStream);
+                }
+                
+                if (shimmerLatency > 0) {
+                    juce::FloatVectorOperations::add(delays, -(double) shimmerLatency, chunk);
+                    mCircularBuffer.readModulated<Interpolator>(channel, sources[channel], chunk, delays, shimmerStream);
+                }
+            }
+        } else {
+            for (int channel = 0; channel < numChannels; ++channel) {
+                mCircularBuffer.read<Interpolator>(channel, wet[channel], chunk,
+                                                   block.delayStart[channel], block.delayIncrement[channel], chunkOffset,
+                                                   wetStream);
+                
+                if (feedbackLatency > 0)
+                    mCircularBuffer.read<Interpolator>(channel, looped[channel], chunk,
+                                                       block.delayStart[channel] - feedbackLatency, block.delayIncrement[channel], chunkOffset,
+                                                       loopedStream);
+                
+                if (shimmerLatency > 0)
+                    mCircularBuffer.read<Interpolator>(channel, sources[channel], chunk,
+                                                       block.delayStart[channel] - feedbackLatency - shimmerLatency,
+                                                       block.delayIncrement[channel], chunkOffset, shimmerStream);
+            }
+        }
+        
+        SampleType* const* fed = feedbackLatency > 0 ? looped : wet;
+        
+        // the shimmer shifts what goes back round the loop. the mixed
+        // buffers aren't needed again until the cross-feed
+        if (block.isShimmering) {
+            applyShimmer(shimmerLatency > 0 ? sources : fed, fed, mixed, numChannels, chunk, chunkOffset);
+            fed = mixed;
         }
         
-        if ( readHeadR_x1 >= mCircularBufferLength) {
-            readHeadR_x1 -= mCircularBufferLength;
+        // so do the loop's filters and saturator, which leave the first
+        // echo as it was played. the wet signal is still to be heard, so
+        // they work on a copy of it
+        if (mFeedbackShaper.isActive()) {
+            if (fed == wet) {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    juce::FloatVectorOperations::copy(looped[channel], wet[channel], chunk);
+                
+                fed = looped;
+            }
+            
+            mFeedbackShaper.process(fed, numChannels, chunk, useSimd);
         }
         
-        // perform linear interpolation to get the delayed samples
-        float delay_sample_left = lin_interp(mCircularBufferLeft[readHeadL_x], mCircularBufferLeft[readHeadL_x1], readHeadFloatL);
-        float delay_sample_right = lin_interp(mCircularBufferRight[readHeadR_x], mCircularBufferRight[readHeadR_x1], readHeadFloatR);
+        // each channel offers its input plus its own feedback from the
+        // previous sample; the matrix decides which lines hear it
+        const SampleType lastFeedbackValue = DelayKernels::getRampValue<SampleType>(feedback.start, feedback.increment, chunkOffset + chunk);
+        
+        for (int channel = 0; channel < numChannels; ++channel) {
+            const SampleType* const input = channels[channel] + start;
+            const SampleType carry = (SampleType) mFeedback[channel];
+            
+            if (useSimd) {
+               #if JUCE_USE_SIMD
+                DelayKernels::feedSimd<SampleType>(sources[channel], input, fed[channel], carry, chunk,
+                                                   feedback.start, feedback.increment, chunkOffset);
+               #endif
+            } else {
+                DelayKernels::feedScalar<SampleType>(sources[channel], input, fed[channel], carry, chunk,
+                                                     feedback.start, feedback.increment, chunkOffset);
+            }
+            
+            mFeedback[channel] = fed[channel][chunk - 1] * lastFeedbackValue;
+        }
+        
+        if (collectTelemetry)
+            mTelemetry.addFeedback(fed, numChannels, chunk, (float) lastFeedbackValue);
+        
+        trackSilence(sources, numChannels, chunk);
+        
+        mCrossFeed.process(sources, mixed, lineInputs, chunk);
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            mCircularBuffer.write(channel, lineInputs[channel], chunk);
         
-        // update feedback values based on the delayed samples
-        mFeedbackLeft = delay_sample_left * *mFeedbackParameter;
-        mFeedbackRight = delay_sample_right * *mFeedbackParameter;
+        if (collectTelemetry)
+            mTelemetry.addToScope(lineInputs, numChannels, chunk, mCircularBuffer.getWriteIndex());
         
-        // increment circular buffer write head
-        mCircularBufferWriteHeadLeft++;
-        mCircularBufferWriteHeadRight++;
+        mCircularBuffer.advance(chunk);
+        mModulation.advance(chunk);
+        
+        // the taps are feed-forward: they join the wet signal after the
+        // feedback has been taken from it
+        const SampleType* inputs[CrossFeedMatrix::kMaxChannels];
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            inputs[channel] = channels[channel] + start;
+        
+        mMultiTap.process(inputs, wet, numChannels, chunk);
+        applyDucking(wet, numChannels, chunk, chunkOffset);
+        
+        if (collectTelemetry)
+            mTelemetry.addWet(wet, numChannels, chunk);
+        
+        // apply dry-wet mix to the output samples
+        for (int channel = 0; channel < numChannels; ++channel) {
+            SampleType* const output = channels[channel] + start;
+            
+            if (useSimd) {
+               #if JUCE_USE_SIMD
+                DelayKernels::mixSimd<SampleType>(output, wet[channel], chunk, dryWet.start, dryWet.increment, chunkOffset);
+               #endif
+            } else {
+                DelayKernels::mixScalar<SampleType>(output, wet[channel], chunk, dryWet.start, dryWet.increment, chunkOffset);
+            }
+        }
+        
+        // everything left in the lines and the tap history was written below
+        // the threshold, so nothing audible can come out of them any more
+        if (mSilentSamples >= mIdleAfterSamples) {
+            mIsIdle = true;
+            return start + chunk;
+        }
+    }
+    
+    return numSamples;
+}
 
+template <typename SampleType>
+int KadenzeDelayAudioProcessor::processNetwork (SampleType* const* channels, int numChannels, int numSamples)
+{
+    const BlockParameters& block = mSegment;
+    const ParameterRamp& dryWet = block.dryWet;
+    const ParameterRamp& feedback = block.feedback;
+    const int offset = mControlPosition;
+    
+    // chunks stay shorter than the shortest line, as in processDelay. each
+    // line reads one sample before the chunk as well
+    const double shortestDelay = mNetwork.getShortestDelay(offset, numSamples);
+    const int maxChunk = juce::jlimit(1, mScratchSize, (int) shortestDelay - DelayLine::getReadAhead<Interpolators::Linear>() - 2);
+    
+    SampleType* const scratch = juce::snapPointerToAlignment(reinterpret_cast<SampleType*>(mScratch.get()), (size_t) 64);
+    SampleType* wet[CrossFeedMatrix::kMaxChannels];
+    
+    for (int channel = 0; channel < numChannels; ++channel)
+        wet[channel] = scratch + (size_t) channel * (size_t) mScratchSize;
+    
+    const bool useSimd = mUseSimd;
+    const bool collectTelemetry = mTelemetry.isEnabled();
+    int chunk;
+    
+    for (int start = 0; start < numSamples; start += chunk) {
+        chunk = juce::jmin(maxChunk, numSamples - start, juce::jmax(1, mIdleAfterSamples - mSilentSamples));
+        const int chunkOffset = offset + start;
+        
+        const SampleType* inputs[CrossFeedMatrix::kMaxChannels];
+        const SampleType* lineInputs[FeedbackDelayNetwork::kMaxLines];
+        
+        for (int channel = 0; channel < numChannels; ++channel)
+            inputs[channel] = channels[channel] + start;
         
-        // apply dry-wet mix to the output samples and update the audio buffer
-        buffer.setSample(0, i, buffer.getSample(0, i) * (1 - *mDryWetParameter) + delay_sample_left * *mDryWetParameter);
-        buffer.setSample(1, i, buffer.getSample(1, i) * (1 - *mDryWetParameter) + delay_sample_right * *mDryWetParameter);
+        mNetwork.process<SampleType>(inputs, wet, lineInputs, chunk, feedback.start, feedback.increment, chunkOffset);
+        trackSilence(lineInputs, mNetwork.getNumLines(), chunk);
+        mModulation.advance(chunk);
         
-        // handle wrap-around for circular buffer write head
-        if (mCircularBufferWriteHeadLeft >= mCircularBufferLength) {
-            mCircularBufferWriteHeadLeft = 0;
+        mMultiTap.process(inputs, wet, numChannels, chunk);
+        applyDucking(wet, numChannels, chunk, chunkOffset);
+        
+        if (collectTelemetry)
+            mTelemetry.addWet(wet, numChannels, chunk);
+        
+        for (int channel = 0; channel < numChannels; ++channel) {
+            SampleType* const output = channels[channel] + start;
+            
+            if (useSimd) {
+               #if JUCE_USE_SIMD
+                DelayKernels::mixSimd<SampleType>(output, wet[channel], chunk, dryWet.start, dryWet.increment, chunkOffset);
+               #endif
+            } else {
+                DelayKernels::mixScalar<SampleType>(output, wet[channel], chunk, dryWet.start, dryWet.increment, chunkOffset);
+            }
         }
         
-        if (mCircularBufferWriteHeadRight >= mCircularBufferLength ) {
-            mCircularBufferWriteHeadRight = 0;
+        if (mSilentSamples >= mIdleAfterSamples) {
+            mIsIdle = true;
+            return start + chunk;
+        }
+    }
+    
+    return numSamples;
+}
+
+template <typename SampleType>
+void KadenzeDelayAudioProcessor::trackSilence (const SampleType* const* written, int numLines, int numSamples)
+{
+    // the peak of what goes into the lines bounds everything that can come
+    // out of them later. the silent stretch is counted from the last audible
+    // sample, not the end of the chunk, so it doesn't depend on where chunks
+    // start
+    SampleType peak = 0;
+    
+    for (int line = 0; line < numLines; ++line) {
+        const auto range = juce::FloatVectorOperations::findMinAndMax(written[line], numSamples);
+        peak = juce::jmax(peak, -range.getStart(), range.getEnd());
+    }
+    
+    if (peak > kSilenceThreshold)
+        mSilentSamples = numSamples - 1 - findLastAudibleSample(written, numLines, numSamples);
+    else
+        mSilentSamples += numSamples;
+}
+
+template <typename SampleType>
+void KadenzeDelayAudioProcessor::applyShimmer (const SampleType* const* delayed, const SampleType* const* unshifted,
+                                               SampleType* const* shifted, int numChannels, int numSamples, int offset)
+{
+    mShifter.process(delayed, shifted, numChannels, numSamples);
+    
+    // at full shimmer all of the feedback is shifted. below it the rest
+    // goes back round at pitch
+    const ParameterRamp& amount = mSegment.shimmer;
+    
+    if (amount.isFlat() && amount.start == 1.0f)
+        return;
+    
+    const SampleType unshiftedStart = SampleType(1) - (SampleType) amount.start;
+    const SampleType unshiftedIncrement = -(SampleType) amount.increment;
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        if (mUseSimd) {
+           #if JUCE_USE_SIMD
+            DelayKernels::mixSimd<SampleType>(shifted[channel], unshifted[channel], numSamples, unshiftedStart, unshiftedIncrement, offset);
+           #endif
+        } else {
+            DelayKernels::mixScalar<SampleType>(shifted[channel], unshifted[channel], numSamples, unshiftedStart, unshiftedIncrement, offset);
         }
     }
 }
 
+template <typename SampleType>
+void KadenzeDelayAudioProcessor::applyDucking (SampleType* const* wet, int numChannels, int numSamples, int offset)
+{
+    const ParameterRamp& gain = mSegment.duckGain;
+    
+    // nothing to do while the wet isn't ducked, which is most of the time
+    if (gain.isFlat() && gain.start == 1.0f)
+        return;
+    
+    for (int channel = 0; channel < numChannels; ++channel) {
+        if (mUseSimd) {
+           #if JUCE_USE_SIMD
+            DelayKernels::gainSimd<SampleType>(wet[channel], numSamples, gain.start, gain.increment, offset);
+           #endif
+        } else {
+            DelayKernels::gainScalar<SampleType>(wet[channel], numSamples, gain.start, gain.increment, offset);
+        }
+    }
+}
+
+template <typename SampleType>
+void KadenzeDelayAudioProcessor::readJump (int channel, SampleType* dest, SampleType* newHead, int numSamples, bool isFading, int latency)
+{
+    // the feedback's heads are brought forward by its latency, as in glide mode
+    const int from = mJumpFrom[channel] - latency;
+    const int to = mJumpTo[channel] - latency;
+    
+    if (! isFading || from == to) {
+        mCircularBuffer.read<Interpolators::None>(channel, dest, numSamples, (double) to, 0.0, 0);
+        return;
+    }
+    
+    // linear crossfade from the old head to the new one
+    const SampleType fadeIncrement = SampleType(1) / (SampleType) mJumpFadeLength;
+    
+    mCircularBuffer.read<Interpolators::None>(channel, dest, numSamples, (double) from, 0.0, 0);
+    mCircularBuffer.read<Interpolators::None>(channel, newHead, numSamples, (double) to, 0.0, 0);
+    
+    if (mUseSimd) {
+       #if JUCE_USE_SIMD
+        DelayKernels::mixSimd<SampleType>(dest, newHead, numSamples, 0, fadeIncrement, mJumpFadePosition);
+       #endif
+    } else {
+        DelayKernels::mixScalar<SampleType>(dest, newHead, numSamples, 0, fadeIncrement, mJumpFadePosition);
+    }
+}
+
+void KadenzeDelayAudioProcessor::setTapPattern (const juce::Array<MultiTapDelay::Tap>& taps)
+{
+    mMultiTap.setPattern(taps);
+    mHasCustomTaps = true;
+    mHasRestoredTaps = false;
+}
+
+void KadenzeDelayAudioProcessor::setMultiTapMode (MultiTapDelay::Mode mode)
+{
+    mMultiTap.setMode(mode);
+    mMultiTap.setPattern(mMultiTap.getPattern());
+}
+
+void KadenzeDelayAudioProcessor::timerCallback()
+{
+    const int tapCount = *mTapCountParameter;
+    const float tapLength = *mTapLengthParameter;
+    
+    if (mHasRestoredTaps) {
+        mLastTapCount = tapCount;
+        mLastTapLength = tapLength;
+        setTapPattern(mRestoredTaps);
+    } else if (tapCount != mLastTapCount || tapLength != mLastTapLength) {
+        mLastTapCount = tapCount;
+        mLastTapLength = tapLength;
+        mMultiTap.setPattern(MultiTapDelay::makeEvenPattern(tapCount, tapLength));
+        mHasCustomTaps = false;
+    }
+    
+    const float load = juce::jlimit(0.0f, 100.0f, mDspLoad.getSnapshot().averagePercent);
+    
+    if (load != mDspLoadParameter->get())
+        mDspLoadParameter->setValueNotifyingHost(mDspLoadParameter->convertTo0to1(load));
+}
+
+void KadenzeDelayAudioProcessor::setControlInterval (int numSamples)
+{
+    mControlInterval = juce::jmax(1, numSamples);
+}
+
+void KadenzeDelayAudioProcessor::setMemoryFormat (DelayMemory::Format format)
+{
+    mMemoryFormat = format;
+}
+
+void KadenzeDelayAudioProcessor::setPresetMorphTime (double seconds)
+{
+    mPresetMorphTime = juce::jmax(0.0, seconds);
+}
+
+void KadenzeDelayAudioProcessor::setMaximumDelayTime (double seconds)
+{
+    mMaximumDelayTime = juce::jlimit(0.01, kMaxDelaySeconds, seconds);
+}
+
+void KadenzeDelayAudioProcessor::setSimdEnabled (bool shouldUseSimd)
+{
+   #if JUCE_USE_SIMD
+    mUseSimd = shouldUseSimd && DelayKernels::isSimdAvailable();
+   #else
+    juce::ignoreUnused(shouldUseSimd);
+    mUseSimd = false;
+   #endif
+    mCircularBuffer.setUseSimd(mUseSimd);
+    mNetwork.setUseSimd(mUseSimd);
+    mShifter.setUseSimd(mUseSimd);
+}
+
 //==============================================================================
 bool KadenzeDelayAudioProcessor::hasEditor() const
 {
@@ -305,15 +1722,112 @@ juce::AudioProcessorEditor* KadenzeDelayAudioProcessor::createEditor()
 //==============================================================================
 void KadenzeDelayAudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
+    // a flat binary layout rather than XML: a session with hundreds of
+    // instances restores each one without a parser. parameters are saved by
+    // ID with their plain values, so ranges and the parameter order can
+    // change between versions. the load meter is an output, so it is left out
+    juce::MemoryOutputStream stream(destData, false);
+    stream.writeInt(kStateMagic);
+    stream.writeInt(kStateVersion);
+    
+    const auto& parameters = getParameters();
+    stream.writeInt(parameters.size() - 1);
+    
+    for (auto* parameter : parameters) {
+        if (parameter == mDspLoadParameter)
+            continue;
+        
+        auto* ranged = dynamic_cast<juce::RangedAudioParameter*>(parameter);
+        stream.writeString(ranged->paramID);
+        stream.writeFloat(ranged->convertFrom0to1(ranged->getValue()));
+    }
+    
+    // the settings that aren't parameters
+    stream.writeInt(mCurrentProgram);
+    stream.writeDouble(mMaximumDelayTime);
+    stream.writeInt((int) mMemoryFormat);
+    stream.writeInt((int) mMultiTap.getMode());
+    
+    const auto& taps = mHasCustomTaps ? mMultiTap.getPattern() : juce::Array<MultiTapDelay::Tap>();
+    stream.writeBool(mHasCustomTaps);
+    stream.writeInt(taps.size());
+    
+    for (const auto& tap : taps) {
+        stream.writeDouble(tap.delaySeconds);
+        stream.writeFloat(tap.gain);
+        stream.writeFloat(tap.pan);
+    }
 }
 
 void KadenzeDelayAudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory block,
-    // whose contents will have been created by the getStateInformation() call.
+    juce::MemoryInputStream stream(data, (size_t) juce::jmax(0, sizeInBytes), false);
+    
+    if (sizeInBytes < 12 || stream.readInt() != kStateMagic || stream.readInt() < 1)
+        return;
+    
+    // parameters the state doesn't mention, such as ones added since it
+    // was saved, go back to their defaults
+    const auto& parameters = getParameters();
+    jassert(parameters.size() <= PresetBank::kMaxParameters);
+    float values[PresetBank::kMaxParameters];
+    
+    for (int i = 0; i < parameters.size(); ++i)
+        values[i] = parameters[i]->getDefaultValue();
+    
+    const int numSaved = stream.readInt();
+    int hint = 0;
+    
+    for (int i = 0; i < numSaved; ++i) {
+        // a state cut short is left alone rather than half applied
+        if (stream.getNumBytesRemaining() < 5)
+            return;
+        
+        const auto parameterID = stream.readString();
+        const float value = stream.readFloat();
+        
+        // saved in the same order as the parameters, so the search almost
+        // always finds the first one it tries
+        const int index = findParameter(parameterID, hint);
+        
+        if (auto* ranged = index >= 0 ? dynamic_cast<juce::RangedAudioParameter*>(parameters[index]) : nullptr) {
+            values[index] = ranged->convertTo0to1(value);
+            hint = index + 1;
+        }
+    }
+    
+    if (stream.getNumBytesRemaining() >= 25) {
+        mCurrentProgram = juce::jlimit(0, getNumPrograms() - 1, stream.readInt());
+        mIsProgramRestored = true;
+        
+        // these two wait for the next prepareToPlay, which reallocates the
+        // lines. the audio thread may be running, so they can't change here
+        setMaximumDelayTime(stream.readDouble());
+        setMemoryFormat(stream.readInt() == (int) DelayMemory::Format::float16 ? DelayMemory::Format::float16
+                                                                               : DelayMemory::Format::float32);
+        mMultiTap.setMode((MultiTapDelay::Mode) juce::jlimit(0, 2, stream.readInt()));
+        
+        mHasRestoredTaps = stream.readBool();
+        mRestoredTaps.clearQuick();
+        
+        const int numTaps = juce::jlimit(0, MultiTapDelay::kMaxTaps, stream.readInt());
+        
+        for (int i = 0; i < numTaps && stream.getNumBytesRemaining() >= 16; ++i) {
+            MultiTapDelay::Tap tap;
+            tap.delaySeconds = stream.readDouble();
+            tap.gain = stream.readFloat();
+            tap.pan = stream.readFloat();
+            mRestoredTaps.add(tap);
+        }
+    }
+    
+    // building a tap pattern runs FFTs, so it is left to the timer rather
+    // than holding up a session load. an even pattern is rebuilt there too,
+    // in case the multi-tap mode changed
+    mLastTapCount = -1;
+    
+    // a session comes back as it was saved, without a morph
+    applyParameterSet(values, 0.0);
 }
 
 //==============================================================================
@@ -322,8 +1836,3 @@ juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter()
 {
     return new KadenzeDelayAudioProcessor();
 }
-
-float KadenzeDelayAudioProcessor::lin_interp(float sample_x, float sample_x1, float inPhase)
-{
-    return (1-inPhase) * sample_x + inPhase * sample_x1;
-}
@@ -9,8 +9,20 @@
 #pragma once
 
 #include <JuceHeader.h>
-
-#define MAX_DELAY_TIME 2
+#include "BlockSmoother.h"
+#include "DelayLine.h"
+#include "CrossFeedMatrix.h"
+#include "MultiTapDelay.h"
+#include "FeedbackShaper.h"
+#include "FeedbackDelayNetwork.h"
+#include "ModulationLfo.h"
+#include "Ducker.h"
+#include "GrainCloud.h"
+#include "PitchShifter.h"
+#include "PresetBank.h"
+#include "TempoSync.h"
+#include "Telemetry.h"
+#include "DspLoad.h"
 
 //==============================================================================
 /**
@@ -19,6 +31,7 @@ class KadenzeDelayAudioProcessor  : public juce::AudioProcessor
                             #if JucePlugin_Enable_ARA
                              , public juce::AudioProcessorARAExtension
                             #endif
+                             , private juce::Timer
 {
 public:
     //==============================================================================
@@ -28,12 +41,15 @@ public:
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
+    void reset() override;
 
    #ifndef JucePlugin_PreferredChannelConfigurations
     bool isBusesLayoutSupported (const BusesLayout& layouts) const override;
    #endif
 
     void processBlock (juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock (juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+    bool supportsDoublePrecisionProcessing() const override;
 
     //==============================================================================
     juce::AudioProcessorEditor* createEditor() override;
@@ -56,37 +72,369 @@ public:
 
     //==============================================================================
     void getStateInformation (juce::MemoryBlock& destData) override;
+    
+    /** Restores the parameters at once, without a morph, and the current
+        program, multi-tap mode and tap pattern with them. The maximum delay
+        time and memory format are restored through their setters, so like
+        any other call to those they are deferred: they take effect at the
+        next prepareToPlay, which hosts run after loading a session anyway.
+        Until then the lines keep the size and format they were prepared
+        with.
+    */
     void setStateInformation (const void* data, int sizeInBytes) override;
     
-    float lin_interp(float sample_x, float sample_x1, float inPhase);
+    //==============================================================================
+    /** The longest delay time, in seconds: the top of the delay time
+        parameters and the most setMaximumDelayTime() accepts.
+    */
+    static constexpr double kMaxDelaySeconds = 600.0;
+    
+    /** Sets the longest delay the lines can reach, in seconds, up to
+        kMaxDelaySeconds. Takes effect at the next prepareToPlay; longer
+        delay times are held to it. The lines only commit memory for the
+        history the delay times read, so a long maximum costs nothing until
+        it is used.
+    */
+    void setMaximumDelayTime (double seconds);
+    double getMaximumDelayTime() const { return mMaximumDelayTime; }
+    
+    /** Bytes the delay lines and the smear network have committed right now. Any thread. */
+    size_t getDelayMemoryBytes() const { return mCircularBuffer.getAllocatedBytes() + mNetwork.getAllocatedBytes(); }
+    
+    /** Picks the SIMD or scalar kernels. SIMD is on by default when the CPU
+        supports it; the benchmark turns it off to compare the two.
+    */
+    void setSimdEnabled (bool shouldUseSimd);
+    bool isSimdEnabled() const { return mUseSimd; }
+    
+    /** Replaces the multi-tap pattern with a custom one. Message thread only.
+        Moving the Taps or Tap Length parameters afterwards replaces it with
+        an evenly spaced pattern again.
+    */
+    void setTapPattern (const juce::Array<MultiTapDelay::Tap>& taps);
+    
+    /** Forces the multi-tap to run directly or through the convolution, or
+        lets it choose by tap count. Message thread only.
+    */
+    void setMultiTapMode (MultiTapDelay::Mode mode);
+    
+    /** Sets how often, in samples, parameter changes are picked up and the
+        smoothers move on. Takes effect at the next prepareToPlay. The
+        benchmark sets this to the block size to measure what splitting
+        blocks costs.
+    */
+    void setControlInterval (int numSamples);
+    int getControlInterval() const { return mControlInterval; }
+    
+    /** Chooses how the delay memory stores samples: at full precision, or
+        as half floats at half the memory and bandwidth. Full precision is
+        doubles when the host has asked for double-precision processing, so
+        the feedback loop never rounds to float. Takes effect at the next
+        prepareToPlay, which converts whatever the lines hold.
+    */
+    void setMemoryFormat (DelayMemory::Format format);
+    DelayMemory::Format getMemoryFormat() const { return mMemoryFormat; }
+    
+    /** How long a program change takes to morph from the old settings to
+        the new ones, in seconds. Restoring a session never morphs.
+    */
+    void setPresetMorphTime (double seconds);
+    double getPresetMorphTime() const { return mPresetMorphTime; }
+    
+    /** Levels and the delay scope for the editor. See Telemetry. */
+    Telemetry& getTelemetry() { return mTelemetry; }
+    
+    /** What processBlock costs, as a share of the real-time budget. See DspLoad. */
+    DspLoad& getDspLoad() { return mDspLoad; }
 
 private:
+    /** Everything processDelay needs from the parameters for one control
+        interval. The ramps start at the beginning of the interval.
+    */
+    struct BlockParameters
+    {
+        ParameterRamp dryWet;
+        ParameterRamp feedback;
+        ParameterRamp modulationDepth;  // milliseconds
+        ParameterRamp duckGain;
+        ParameterRamp shimmer;          // the share of the feedback that is pitch-shifted
+        double delayStart[CrossFeedMatrix::kMaxChannels];
+        double delayIncrement[CrossFeedMatrix::kMaxChannels];
+        bool isJump;
+        bool isFlat;
+        bool isShapingFlat;     // the feedback shaper's drive has settled
+        bool isModulated;       // the LFO moves the heads this interval
+        bool isShimmering;      // the feedback goes through the pitch shifter
+        int shimmerLatency;     // samples the shifter's read is brought forward by, past the loop latency
+    };
+    
+    /** The parameter values a block's control intervals glide towards. */
+    struct ParameterTargets
+    {
+        float dryWet;
+        float feedback;
+        float delayTimeLeft;
+        float delayTimeRight;
+        float lowCut;
+        float highCut;
+        float drive;
+        float modulationRate;
+        float modulationDepth;
+        float modulationStereo;
+        ModulationLfo::Shape modulationShape;
+        float damping;
+        float duckAmount;
+        float duckThreshold;
+        float duckAttack;
+        float duckRelease;
+        GrainCloud::Mode playback;
+        float grainSize;
+        float grainDensity;
+        float grainJitter;
+        GrainCloud::Shape grainShape;
+        float shimmer;
+        int shimmerPitch;       // semitones
+        int networkLines;       // 0 when the smear network is off
+        bool jump;
+        float glide;            // milliseconds
+        CrossFeedMatrix::Preset crossFeed;
+        Interpolators::Quality interpolation;
+        Ducker::Source duckSource;
+    };
+    
+    /** The reads processDelay makes from each channel's line, each with
+        interpolator state of its own: what is heard, the feedback read
+        earlier by the loop latency, and what the shimmer shifts, earlier
+        again by the shifter's.
+    */
+    enum ReadStream
+    {
+        wetStream = 0,
+        loopedStream,
+        shimmerStream,
+        numReadStreams
+    };
+    
+    static_assert (numReadStreams <= DelayLine::kMaxStreams, "the lines keep state for every read stream");
+    
+    template <typename SampleType>
+    using ProcessFunction = int (KadenzeDelayAudioProcessor::*) (SampleType* const*, int, int);
+    
+    void timerCallback() override;
+    
+    /** Reads every parameter processSamples uses, through readParameter. */
+    void readParameterTargets (ParameterTargets& targets) const;
+    
+    /** A parameter's value for the audio thread: the parameter's own, or
+        the preset bank's while a preset morphs in. Audio thread only.
+    */
+    float readParameter (const juce::AudioParameterFloat* parameter) const;
+    int readParameter (const juce::AudioParameterChoice* parameter) const;
+    int readParameter (const juce::AudioParameterInt* parameter) const;
+    bool readParameter (const juce::AudioParameterBool* parameter) const;
+    
+    /** Moves every parameter to values, normalised and in the order of
+        getParameters(), morphing over morphSeconds. Message thread only.
+    */
+    void applyParameterSet (const float* values, double morphSeconds);
+    
+    /** The index of the parameter with parameterID, trying hint first, or -1. */
+    int findParameter (const juce::String& parameterID, int hint) const;
+    
+    /** Both processBlock overloads: the whole engine is written once, for
+        float and double samples.
+    */
+    template <typename SampleType>
+    void processSamples (juce::AudioBuffer<SampleType>& buffer);
+    
+    /** The delay times the parameters ask for, in seconds: either the free
+        times, or the synced note values at bpm. On the audio thread they are
+        read through readParameter.
+    */
+    void getDelayTimeTargets (double bpm, bool isAudioThread, float& left, float& right) const;
+    
+    void startControlInterval (const ParameterTargets& targets, int numChannels);
+    void startJump (const ParameterTargets& targets, int numChannels);
+    void startFeedbackShaping (const ParameterTargets& targets);
+    void startModulation (const ParameterTargets& targets);
+    void startNetwork (const ParameterTargets& targets);
+    void startDucking (const ParameterTargets& targets);
+    void startGrains (const ParameterTargets& targets);
+    void startShimmer (const ParameterTargets& targets);
+    
+    /** Samples the feedback picks up on its way back round the loop: the
+        shaper's latency. The feedback is read that much earlier than the
+        wet signal. The network has no shaper, so none.
+    */
+    int getLoopLatency() const;
+    
+    /** The delay of each sample of a run for one channel, in samples: the
+        interval's ramp plus the modulation depth times the LFO.
+    */
+    void getModulatedDelays (int channel, int numChannels, double* delays, int numSamples, int offset) const;
+    void updateRetainedLength (int numChannels);
+    void updateShimmerLatency (int numChannels);
+    
+    template <typename SampleType>
+    void readJump (int channel, SampleType* dest, SampleType* newHead, int numSamples, bool isFading, int latency);
+    
+    template <typename Interpolator, typename SampleType>
+    int processDelay (SampleType* const* channels, int numChannels, int numSamples);
+    
+    /** processDelay's counterpart for the smear network. */
+    template <typename SampleType>
+    int processNetwork (SampleType* const* channels, int numChannels, int numSamples);
+    
+    /** Counts the silent stretch at the end of a chunk of what went into the
+        lines, for going idle.
+    */
+    template <typename SampleType>
+    void trackSilence (const SampleType* const* written, int numLines, int numSamples);
+    
+    /** Pitch-shifts the delayed signal into shifted, blended with the
+        unshifted one by the interval's shimmer amount, for feeding back.
+        The delayed signal is read earlier than the unshifted one by the
+        shifter's latency, where the delay allows.
+    */
+    template <typename SampleType>
+    void applyShimmer (const SampleType* const* delayed, const SampleType* const* unshifted,
+                       SampleType* const* shifted, int numChannels, int numSamples, int offset);
+    
+    /** Turns the wet signal down by the interval's ducking gain. */
+    template <typename SampleType>
+    void applyDucking (SampleType* const* wet, int numChannels, int numSamples, int offset);
+    
     bool mIsPingPongEnabled;
+    bool mUseSimd;
     
-    float mDelayTimeLeftSmoothed;
-    float mDelayTimeRightSmoothed;
-
+    double mSampleRate;
+    
+    BlockSmoother mDryWetSmoother;
+    BlockSmoother mFeedbackSmoother;
+    BlockSmoother mDelayTimeLeftSmoother;
+    BlockSmoother mDelayTimeRightSmoother;
+    BlockSmoother mDriveSmoother;
+    BlockSmoother mModulationDepthSmoother;
+    BlockSmoother mShimmerSmoother;
     
     juce::AudioParameterFloat* mDryWetParameter;
     juce::AudioParameterFloat* mFeedbackParameter;
     juce::AudioParameterFloat* mDelayTimeLeftParameter;
     juce::AudioParameterFloat* mDelayTimeRightParameter;
+    juce::AudioParameterChoice* mInterpolationParameter;
+    juce::AudioParameterChoice* mCrossFeedParameter;
+    juce::AudioParameterInt* mTapCountParameter;
+    juce::AudioParameterFloat* mTapLengthParameter;
+    juce::AudioParameterFloat* mGlideParameter;
+    juce::AudioParameterChoice* mTimeModeParameter;
+    juce::AudioParameterBool* mTempoSyncParameter;
+    juce::AudioParameterChoice* mNoteLeftParameter;
+    juce::AudioParameterChoice* mNoteRightParameter;
+    juce::AudioParameterFloat* mSwingParameter;
+    juce::AudioParameterFloat* mDspLoadParameter;
+    juce::AudioParameterFloat* mLowCutParameter;
+    juce::AudioParameterFloat* mHighCutParameter;
+    juce::AudioParameterFloat* mDriveParameter;
+    juce::AudioParameterFloat* mModulationRateParameter;
+    juce::AudioParameterFloat* mModulationDepthParameter;
+    juce::AudioParameterChoice* mModulationShapeParameter;
+    juce::AudioParameterFloat* mModulationStereoParameter;
+    juce::AudioParameterChoice* mSmearParameter;
+    juce::AudioParameterFloat* mDampingParameter;
+    juce::AudioParameterFloat* mDuckParameter;
+    juce::AudioParameterFloat* mDuckThresholdParameter;
+    juce::AudioParameterFloat* mDuckAttackParameter;
+    juce::AudioParameterFloat* mDuckReleaseParameter;
+    juce::AudioParameterChoice* mDuckSourceParameter;
+    juce::AudioParameterChoice* mPlaybackParameter;
+    juce::AudioParameterFloat* mGrainSizeParameter;
+    juce::AudioParameterFloat* mGrainDensityParameter;
+    juce::AudioParameterFloat* mGrainJitterParameter;
+    juce::AudioParameterChoice* mGrainShapeParameter;
+    juce::AudioParameterFloat* mShimmerParameter;
+    juce::AudioParameterInt* mShimmerPitchParameter;
     
-    float mFeedbackLeft;
-    float mFeedbackRight;
+    // the tempo the synced times follow: the host's, as of the last block,
+    // or the last one it gave if it stops reporting one
+    std::atomic<double> mHostBpm;
     
-    float mDelayTimeLeftInSamples;
-    float mDelayTimeRightInSamples;
-    float mDelayReadHeadLeft;
-    float mDelayReadHeadRight;
+    // parameters are picked up on a fixed grid of mControlInterval samples,
+    // counted from prepareToPlay, rather than at host block boundaries.
+    // mControlPosition is how far into the current interval processing is
+    // and mSegment holds that interval's ramps
+    int mControlInterval;
+    int mControlPosition;
+    BlockParameters mSegment;
     
-    int mCircularBufferWriteHeadLeft;
-    int mCircularBufferWriteHeadRight;
-
-    int mCircularBufferLength;
+    DelayMemory::Format mMemoryFormat;
+    
+    // the longest delay asked for, and the one the lines were last prepared
+    // with, which the delay times are held to
+    double mMaximumDelayTime;
+    double mDelayTimeLimit;
+    
+    // jump mode: whole-sample read heads per channel. when the delay time
+    // changes the head at mJumpFrom fades out under the one at mJumpTo over
+    // mJumpFadeLength samples; mJumpFadePosition reaches the length once the
+    // fade is over
+    int mJumpFrom[CrossFeedMatrix::kMaxChannels];
+    int mJumpTo[CrossFeedMatrix::kMaxChannels];
+    int mJumpFadeLength;
+    int mJumpFadePosition;
+    
+    // which read streams ran a recursive interpolator in the last run. one
+    // that starts or stops has its state reset, so it never carries on from
+    // wherever it was left
+    bool mIsStreamRunning[numReadStreams];
+    
+    // last values the even tap pattern was built from. a custom pattern
+    // stands until they change; one restored with a session waits in
+    // mRestoredTaps for the timer to build it
+    int mLastTapCount;
+    float mLastTapLength;
+    bool mHasCustomTaps;
+    bool mHasRestoredTaps;
+    juce::Array<MultiTapDelay::Tap> mRestoredTaps;
+    
+    // programs are the factory presets, and program changes morph in over
+    // mPresetMorphTime seconds
+    PresetBank mPresets;
+    int mCurrentProgram;
+    bool mIsProgramRestored;    // mCurrentProgram came from a restored state and hasn't been set since
+    double mPresetMorphTime;
+    
+    // last delayed sample times feedback gain, per channel, carried into
+    // the next chunk. a double holds a float one exactly, so this serves
+    // either precision
+    double mFeedback[CrossFeedMatrix::kMaxChannels];
+    
+    // silence tracking: samples since anything audible went into the lines,
+    // how many it takes before the memory is silent, and whether it is
+    bool mIsIdle;
+    int mSilentSamples;
+    int mIdleAfterSamples;
+    
+    // one line per channel, all sharing a write position
+    DelayLine mCircularBuffer;
+    CrossFeedMatrix mCrossFeed;
+    FeedbackShaper mFeedbackShaper;
+    ModulationLfo mModulation;
+    FeedbackDelayNetwork mNetwork;
+    Ducker mDucker;
+    GrainCloud mGrains;
+    PitchShifter mShifter;
+    MultiTapDelay mMultiTap;
+    Telemetry mTelemetry;
+    DspLoad mDspLoad;
+    
+    // per-chunk working memory for each channel: wet reads, cross-feed,
+    // mixed and looped feedback. processDelay views it as SampleType
+    juce::HeapBlock<double> mScratch;
     
-    float* mCircularBufferLeft;
-    float* mCircularBufferRight;
+    // one chunk of modulated delay times, filled for each channel in turn
+    juce::HeapBlock<double> mModulatedDelays;
+    int mScratchSize;
+    int mScratchChannels;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (KadenzeDelayAudioProcessor)
 };
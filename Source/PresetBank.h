@@ -0,0 +1,236 @@
+/*
+  ==============================================================================
+
+    PresetBank.h
+
+    The factory presets, and how a whole new set of parameter values gets
+    to the audio thread without a lock, an allocation or a click.
+
+    A set is staged on the message thread: every parameter's value now and
+    the value it is going to, normalised. It is written into whichever of
+    three slots neither thread is using and handed over with a single
+    atomic exchange of the slot index, so publishing never waits and the
+    audio thread only ever sees whole sets. A set published before the
+    audio thread has taken the last one simply replaces it.
+
+    The audio thread takes the newest set once per block, after it has
+    read the parameters: any read that already saw part of the new values
+    is then thrown away and done again. For the next morphSeconds the
+    processor reads getValue() in place of the parameters. Continuous
+    values move in a straight line, in normalised terms, and discrete ones
+    switch halfway, so everything downstream glides exactly as it would
+    under automation. A morph that starts while another is running starts
+    from wherever that one had got to.
+
+    The message thread sets the parameters themselves once it has
+    published, and calls setApplied() when it is done. The audio thread
+    holds on to the set until then, however short the morph, so it never
+    reads a half-written preset from the parameters.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CrossFeedMatrix.h"
+#include "FeedbackDelayNetwork.h"
+#include "GrainCloud.h"
+#include "TempoSync.h"
+
+//==============================================================================
+class PresetBank
+{
+public:
+    static constexpr int kMaxParameters = 64;
+
+    /** How long a preset takes to morph in unless the processor is told otherwise. */
+    static constexpr double kDefaultMorphSeconds = 0.5;
+
+    struct Setting
+    {
+        const char* parameterID;
+        float value;                // plain, as the parameter shows it
+    };
+
+    /** A factory preset. Parameters it doesn't mention take their defaults. */
+    struct Preset
+    {
+        juce::String name;
+        juce::Array<Setting> settings;
+    };
+
+    static const juce::Array<Preset>& getFactoryPresets()
+    {
+        static const juce::Array<Preset> presets
+        {
+            { "Init", {} },
+
+            { "Slapback", { { "drywet", 0.35f }, { "feedback", 0.12f },
+                            { "delayTimeLeft", 0.085f }, { "delayTimeRight", 0.095f },
+                            { "crossFeed", (float) (int) CrossFeedMatrix::Preset::straight },
+                            { "highCut", 6000.0f } } },
+
+            { "Dotted Ping Pong", { { "feedback", 0.55f }, { "tempoSync", 1.0f },
+                                    { "noteLeft", (float) TempoSync::getDivisionIndex ("1/8 D") },
+                                    { "noteRight", (float) TempoSync::getDivisionIndex ("1/4") },
+                                    { "lowCut", 150.0f } } },
+
+            { "Tape Wobble", { { "feedback", 0.6f }, { "delayTimeLeft", 0.32f }, { "delayTimeRight", 0.34f },
+                               { "modRate", 0.7f }, { "modDepth", 3.0f }, { "drive", 35.0f },
+                               { "lowCut", 120.0f }, { "highCut", 4500.0f } } },
+
+            { "Ducked Vocal", { { "drywet", 0.4f }, { "feedback", 0.45f }, { "duck", 60.0f },
+                                { "duckThreshold", -35.0f }, { "duckRelease", 400.0f } } },
+
+            { "Smeared Wash", { { "drywet", 0.45f }, { "feedback", 0.8f },
+                                { "smear", (float) (FeedbackDelayNetwork::getSizeNames().size() - 1) },
+                                { "damping", 45.0f } } },
+
+            { "Reverse", { { "drywet", 0.45f }, { "feedback", 0.4f },
+                           { "delayTimeLeft", 0.6f }, { "delayTimeRight", 0.6f },
+                           { "playback", (float) (int) GrainCloud::Mode::reverse }, { "grainSize", 300.0f } } },
+
+            { "Grain Cloud", { { "drywet", 0.5f }, { "feedback", 0.6f },
+                               { "playback", (float) (int) GrainCloud::Mode::granular },
+                               { "grainSize", 120.0f }, { "grainDensity", 30.0f }, { "grainJitter", 60.0f } } },
+
+            { "Shimmer", { { "drywet", 0.45f }, { "feedback", 0.7f },
+                           { "delayTimeLeft", 0.35f }, { "delayTimeRight", 0.5f },
+                           { "shimmer", 70.0f }, { "shimmerPitch", 12.0f }, { "highCut", 9000.0f } } }
+        };
+
+        return presets;
+    }
+
+    //==============================================================================
+    /** Stages a move from where parameters stand now to values, normalised
+        and in the order of parameters, over morphSeconds. Message thread
+        only.
+    */
+    void publish (const juce::Array<juce::AudioProcessorParameter*>& parameters, const float* values, double morphSeconds) noexcept
+    {
+        jassert (parameters.size() <= kMaxParameters);
+
+        Set& set = mSets[mBack];
+        set.numParameters = juce::jmin (parameters.size(), kMaxParameters);
+
+        for (int i = 0; i < set.numParameters; ++i)
+        {
+            set.from[i] = parameters[i]->getValue();
+            set.to[i] = values[i];
+            set.isDiscrete[i] = parameters[i]->isDiscrete();
+        }
+
+        set.morphSeconds = juce::jmax (0.0, morphSeconds);
+        set.serial = ++mPublished;
+
+        mBack = mMiddle.exchange (mBack | kFresh) & kIndexMask;
+    }
+
+    /** Tells the audio thread the parameters now hold the last values
+        published, so it can go back to reading them once the morph is over.
+    */
+    void setApplied() noexcept          { mApplied.store (mPublished); }
+
+    //==============================================================================
+    /** Takes the newest published set, if there is one, and starts morphing
+        to it. True when it did, in which case parameters read before the
+        call should be read again through getValue(). Audio thread only.
+    */
+    bool pull (double sampleRate) noexcept
+    {
+        if ((mMiddle.load() & kFresh) == 0)
+            return false;
+
+        // a running morph carries on from where it has got to
+        if (mIsActive)
+            for (int i = 0; i < mSet->numParameters; ++i)
+                mStart[i] = getValue (i);
+
+        const bool wasActive = mIsActive;
+        mFront = mMiddle.exchange (mFront) & kIndexMask;
+        mSet = &mSets[mFront];
+
+        if (! wasActive)
+            std::copy (mSet->from, mSet->from + mSet->numParameters, mStart);
+
+        mLength = (int) std::ceil (mSet->morphSeconds * sampleRate);
+        mPosition = 0;
+        mIsActive = true;
+        return true;
+    }
+
+    /** True while the processor should read getValue() rather than the
+        parameters. Audio thread only.
+    */
+    bool isActive() const noexcept      { return mIsActive; }
+
+    /** The normalised value of the parameter at index, as of the start of
+        the current block. Only while isActive().
+    */
+    float getValue (int index) const noexcept
+    {
+        jassert (mIsActive && index < mSet->numParameters);
+
+        const float to = mSet->to[index];
+
+        if (mPosition >= mLength)
+            return to;
+
+        const float progress = (float) mPosition / (float) mLength;
+
+        if (mSet->isDiscrete[index])
+            return progress < 0.5f ? mStart[index] : to;
+
+        return mStart[index] + (to - mStart[index]) * progress;
+    }
+
+    /** Moves the morph on by a block. It ends once it has run its length
+        and the parameters hold its values.
+    */
+    void advance (int numSamples) noexcept
+    {
+        if (! mIsActive)
+            return;
+
+        mPosition = juce::jmin (mLength, mPosition + numSamples);
+
+        if (mPosition >= mLength && (juce::int32) (mApplied.load() - mSet->serial) >= 0)
+            mIsActive = false;
+    }
+
+private:
+    struct Set
+    {
+        float from[kMaxParameters];
+        float to[kMaxParameters];
+        bool isDiscrete[kMaxParameters];
+        int numParameters = 0;
+        double morphSeconds = 0.0;
+        juce::uint32 serial = 0;
+    };
+
+    // the middle slot's index, and whether it holds a set the audio thread
+    // hasn't taken yet
+    static constexpr int kIndexMask = 3;
+    static constexpr int kFresh = 4;
+
+    Set mSets[3];
+    std::atomic<int> mMiddle { 1 };
+    std::atomic<juce::uint32> mApplied { 0 };
+
+    // message thread
+    int mBack = 0;
+    juce::uint32 mPublished = 0;
+
+    // audio thread
+    int mFront = 2;
+    const Set* mSet = nullptr;
+    float mStart[kMaxParameters] = {};
+    int mLength = 0;
+    int mPosition = 0;
+    bool mIsActive = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PresetBank)
+};
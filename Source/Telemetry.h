@@ -0,0 +1,240 @@
+/*
+  ==============================================================================
+
+    Telemetry.h
+
+    What the processor is doing, sent from the audio thread to the editor.
+    Levels arrive as frames of peak and RMS for the input, the wet signal
+    and the feedback. The delay memory arrives as a scope: the most recent
+    stretch of the line is cut into kScopeSize bins and the peak of each bin
+    is sent as the write position leaves it.
+
+    Both go through single-producer, single-consumer fifos built on
+    juce::AbstractFifo with fixed storage. Neither side locks or allocates;
+    when the editor falls behind, the audio thread drops data instead of
+    waiting. The audio thread side takes float or double signals, whichever
+    precision the processor runs at.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+//==============================================================================
+class Telemetry
+{
+public:
+    /** Points across the stretch of delay memory the scope shows. */
+    static constexpr int kScopeSize = 512;
+
+    /** Frames cover at least this many samples, so tiny host blocks don't
+        flood the fifo.
+    */
+    static constexpr int kMinFrameSamples = 256;
+
+    struct Level
+    {
+        float peak = 0.0f;
+        float rms = 0.0f;
+    };
+
+    struct Frame
+    {
+        Level input;
+        Level wet;
+        Level feedback;
+        int scopeWriteBin = 0;      // the bin the line is writing into now
+    };
+
+    struct ScopeBin
+    {
+        int index = 0;
+        float peak = 0.0f;
+    };
+
+    //==============================================================================
+    /** Turns collection on or off. The editor switches it on while it is
+        open, so the audio thread does no telemetry work without one.
+    */
+    void setEnabled (bool shouldBeEnabled) noexcept    { mIsEnabled.store (shouldBeEnabled, std::memory_order_relaxed); }
+    bool isEnabled() const noexcept                    { return mIsEnabled.load (std::memory_order_relaxed); }
+
+    //==============================================================================
+    // audio thread
+
+    /** Sets the scope up to show the last scopeLength samples written to the
+        line. It must be a power of two no longer than the line.
+    */
+    void prepare (int scopeLength) noexcept
+    {
+        mScopeBinSize = juce::jmax (1, scopeLength / kScopeSize);
+        mScopeBinPeak = 0.0f;
+        mLevels = {};
+    }
+
+    template <typename Sample>
+    void addInput (const Sample* const* channels, int numChannels, int numSamples) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            mLevels.input.add (channels[channel], numSamples, 1.0f);
+    }
+
+    template <typename Sample>
+    void addWet (const Sample* const* channels, int numChannels, int numSamples) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            mLevels.wet.add (channels[channel], numSamples, 1.0f);
+    }
+
+    /** The feedback is the delayed signal scaled by the feedback gain. */
+    template <typename Sample>
+    void addFeedback (const Sample* const* delayed, int numChannels, int numSamples, float gain) noexcept
+    {
+        for (int channel = 0; channel < numChannels; ++channel)
+            mLevels.feedback.add (delayed[channel], numSamples, gain);
+    }
+
+    /** Records what was written to the line at writeIndex. A bin is sent
+        once the write position moves past it.
+    */
+    template <typename Sample>
+    void addToScope (const Sample* const* written, int numChannels, int numSamples, int writeIndex) noexcept
+    {
+        for (int done = 0; done < numSamples;)
+        {
+            const int positionInBin = (writeIndex + done) % mScopeBinSize;
+            const int run = juce::jmin (numSamples - done, mScopeBinSize - positionInBin);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                const auto range = juce::FloatVectorOperations::findMinAndMax (written[channel] + done, run);
+                mScopeBinPeak = juce::jmax (mScopeBinPeak, (float) -range.getStart(), (float) range.getEnd());
+            }
+
+            done += run;
+
+            if (positionInBin + run == mScopeBinSize)
+            {
+                const int bin = ((writeIndex + done - 1) / mScopeBinSize) % kScopeSize;
+                mScope.push ({ bin, mScopeBinPeak });
+                mScopeBinPeak = 0.0f;
+            }
+        }
+    }
+
+    /** Call at the end of each block with the line's write position. Sends a
+        frame once enough samples have gone by.
+    */
+    void endBlock (int numSamples, int writeIndex) noexcept
+    {
+        mLevels.numSamples += numSamples;
+
+        if (mLevels.numSamples < kMinFrameSamples)
+            return;
+
+        Frame frame;
+        frame.input = mLevels.input.get();
+        frame.wet = mLevels.wet.get();
+        frame.feedback = mLevels.feedback.get();
+        frame.scopeWriteBin = (writeIndex / mScopeBinSize) % kScopeSize;
+
+        mFrames.push (frame);
+        mLevels = {};
+    }
+
+    //==============================================================================
+    // message thread
+
+    /** Pops the oldest frame. Returns false when there are none. */
+    bool popFrame (Frame& frame) noexcept                           { return mFrames.pop (frame); }
+
+    /** Pops the oldest scope bin. Returns false when there are none. */
+    bool popScopeBin (ScopeBin& bin) noexcept                       { return mScope.pop (bin); }
+
+private:
+    //==============================================================================
+    /** Running peak and sum of squares for one signal. */
+    struct Accumulator
+    {
+        template <typename Sample>
+        void add (const Sample* x, int numSamples, float gain) noexcept
+        {
+            Sample sumSquares = 0;
+            Sample peak = 0;
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                sumSquares += x[i] * x[i];
+                peak = juce::jmax (peak, std::abs (x[i]));
+            }
+
+            mPeak = juce::jmax (mPeak, (float) peak * std::abs (gain));
+            mSumSquares += (double) sumSquares * (double) (gain * gain);
+            mCount += numSamples;
+        }
+
+        Level get() const noexcept
+        {
+            Level level;
+            level.peak = mPeak;
+            level.rms = mCount > 0 ? (float) std::sqrt (mSumSquares / (double) mCount) : 0.0f;
+            return level;
+        }
+
+        float mPeak = 0.0f;
+        double mSumSquares = 0.0;
+        juce::int64 mCount = 0;
+    };
+
+    struct Levels
+    {
+        Accumulator input, wet, feedback;
+        int numSamples = 0;
+    };
+
+    /** Fixed-size wait-free queue: one thread pushes, one other pops. */
+    template <typename Item, int kCapacity>
+    class Fifo
+    {
+    public:
+        void push (const Item& item) noexcept
+        {
+            int start1, size1, start2, size2;
+            mFifo.prepareToWrite (1, start1, size1, start2, size2);
+
+            if (size1 + size2 == 0)
+                return;     // full: the reader is behind, so this one is dropped
+
+            mItems[size1 > 0 ? start1 : start2] = item;
+            mFifo.finishedWrite (1);
+        }
+
+        bool pop (Item& item) noexcept
+        {
+            int start1, size1, start2, size2;
+            mFifo.prepareToRead (1, start1, size1, start2, size2);
+
+            if (size1 + size2 == 0)
+                return false;
+
+            item = mItems[size1 > 0 ? start1 : start2];
+            mFifo.finishedRead (1);
+            return true;
+        }
+
+    private:
+        juce::AbstractFifo mFifo { kCapacity };
+        Item mItems[kCapacity];
+    };
+
+    Fifo<Frame, 64> mFrames;
+    Fifo<ScopeBin, 2048> mScope;
+    Levels mLevels;
+    float mScopeBinPeak = 0.0f;
+    int mScopeBinSize = 1;
+    std::atomic<bool> mIsEnabled { false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Telemetry)
+};
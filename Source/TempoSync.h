@@ -0,0 +1,74 @@
+/*
+  ==============================================================================
+
+    TempoSync.h
+
+    Note-value delay times for tempo sync. The divisions are lengths in
+    quarter notes, so a time in seconds is one multiply and one divide per
+    block, whatever the tempo is doing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+namespace TempoSync
+{
+    /** Lengths in quarter notes, shortest first, in the order of the note
+        value parameters. D is dotted, T is triplet.
+    */
+    static constexpr double kDivisionBeats[] =
+    {
+        1.0 / 12.0,     // 1/32 T
+        1.0 / 8.0,      // 1/32
+        1.0 / 6.0,      // 1/16 T
+        3.0 / 16.0,     // 1/32 D
+        1.0 / 4.0,      // 1/16
+        1.0 / 3.0,      // 1/8 T
+        3.0 / 8.0,      // 1/16 D
+        1.0 / 2.0,      // 1/8
+        2.0 / 3.0,      // 1/4 T
+        3.0 / 4.0,      // 1/8 D
+        1.0,            // 1/4
+        4.0 / 3.0,      // 1/2 T
+        3.0 / 2.0,      // 1/4 D
+        2.0,            // 1/2
+        8.0 / 3.0,      // 1/1 T
+        3.0,            // 1/2 D
+        4.0             // 1/1
+    };
+
+    static constexpr int kNumDivisions = (int) (sizeof (kDivisionBeats) / sizeof (kDivisionBeats[0]));
+
+    inline juce::StringArray getDivisionNames()
+    {
+        return { "1/32 T", "1/32", "1/16 T", "1/32 D", "1/16", "1/8 T", "1/16 D", "1/8", "1/4 T",
+                 "1/8 D", "1/4", "1/2 T", "1/4 D", "1/2", "1/1 T", "1/2 D", "1/1" };
+    }
+
+    /** Index of a division by name, for parameter defaults. */
+    inline int getDivisionIndex (const juce::String& name)
+    {
+        return juce::jmax (0, getDivisionNames().indexOf (name));
+    }
+
+    /** The length of a division in seconds at bpm quarter notes per minute. */
+    inline double getDivisionSeconds (int division, double bpm)
+    {
+        jassert (juce::isPositiveAndBelow (division, kNumDivisions) && bpm > 0.0);
+        return kDivisionBeats[division] * 60.0 / bpm;
+    }
+
+    /** Swing for a pair of times, as the share of the pair the first one
+        takes: 0.5 leaves them alone, 2/3 is a triplet shuffle. With equal
+        times, the echoes alternate between long and short while every
+        pair still adds up to the same length.
+    */
+    inline void applySwing (double& first, double& second, double swing)
+    {
+        first *= 2.0 * swing;
+        second *= 2.0 * (1.0 - swing);
+    }
+}